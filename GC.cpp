@@ -1,946 +1,6857 @@
-////////////////////////////////////////////////////////////////////////////
-// GC.cpp -- MZC3 GC
-// This file is part of MZC3.  See file "ReadMe.txt" and "License.txt".
-////////////////////////////////////////////////////////////////////////////
-
-#include "stdafx.h"
-
-#ifndef MZC_NO_GC
-
-#include "GC_unwrap.h"
-
-//////////////////////////////////////////////////////////////////////////////
-// MzcTraceA --- Output a message for debugging
-
-#ifndef MzcTraceA
-    #ifdef _DEBUG
-        void MzcTraceA(const char *fmt, ...)
-        {
-            using namespace std;
-            assert(fmt);
-            #ifdef MZC_DEBUG_OUTPUT_IS_STDERR
-                va_list va;
-                va_start(va, fmt);
-                vfprintf(stderr, fmt, va);
-                va_end(va);
-            #elif defined(MZC_DEBUG_OUTPUT_IS_STDOUT)
-                va_list va;
-                va_start(va, fmt);
-                vfprintf(stdout, fmt, va);
-                va_end(va);
-            #elif defined(_WIN32)
-                static char buf[512];
-                va_list va;
-                va_start(va, fmt);
-                wvsprintfA(buf, fmt, va);
-                OutputDebugStringA(buf);
-                va_end(va);
-            #else
-                va_list va;
-                va_start(va, fmt);
-                vfprintf(stderr, fmt, va);
-                va_end(va);
-            #endif
-        }
-        #define MzcTraceA MzcTraceA
-    #else
-        inline void MzcTraceA(const char *, ...)
-        {
-        }
-        #define MzcTraceA 1 ? (void)0 : (void)MzcTraceA
-    #endif
-#endif  // ndef MzcTraceA
-
-//////////////////////////////////////////////////////////////////////////////
-// MZC3_GC_ENTRY --- GC entry
-
-struct MZC3_GC_ENTRY
-{
-    void *      m_ptr;
-    std::size_t m_size;
-    std::size_t m_depth;
-
-    MZC3_GC_ENTRY()
-    {
-    }
-
-    #ifdef _DEBUG
-        const char *m_file;
-        int         m_line;
-        MZC3_GC_ENTRY(void *ptr, std::size_t size, std::size_t depth,
-                      const char *file, int line)
-        : m_ptr(ptr), m_size(size), m_depth(depth),
-          m_file(file), m_line(line)
-        {
-            assert(ptr);
-            assert(file);
-        }
-    #else   // ndef DEBUG
-        MZC3_GC_ENTRY(void *ptr, std::size_t size, std::size_t depth)
-        : m_ptr(ptr), m_size(size), m_depth(depth)
-        {
-        }
-    #endif  // ndef DEBUG
-};
-
-//////////////////////////////////////////////////////////////////////////////
-// MZC3_GC_STATE
-
-struct MZC3_GC_STATE
-{
-    MZC3_GC_STATE *next;
-    int gc_enabled;
-};
-
-//////////////////////////////////////////////////////////////////////////////
-// TODO: Use Win32 TLS
-
-struct MZC3_GC_THREAD_ENTRY
-{
-    #ifdef MZC3_GC_MT
-        #ifdef _WIN32
-            DWORD tid;
-        #else
-            pid_t tid;
-        #endif
-    #endif
-    std::size_t    depth;
-    MZC3_GC_STATE *state_stack;
-};
-
-#ifdef MZC3_GC_MT
-    static MZC3_GC_THREAD_ENTRY *s_gc_thread_entries = NULL;
-    static std::size_t s_gc_thread_entry_count = 0;
-    static std::size_t s_gc_thread_entry_capacity = 0;
-#else
-    static MZC3_GC_THREAD_ENTRY s_only_one_gc_thread_entry = {0, NULL};
-#endif
-
-//////////////////////////////////////////////////////////////////////////////
-
-#ifndef MZC3_GC_MT
-    inline
-#endif
-MZC3_GC_THREAD_ENTRY *MZC3_GC_GetThreadEntry(void)
-{
-    #ifdef MZC3_GC_MT
-        #ifdef _WIN32
-            const DWORD tid = GetCurrentThreadId();
-        #else
-            const pid_t tid = gettid();
-        #endif
-
-        for (std::size_t i = 0; i < s_gc_thread_entry_count; i++)
-        {
-            if (s_gc_thread_entries[i].tid == tid)
-                return &s_gc_thread_entries[i];
-        }
-
-        if (s_gc_thread_entry_count + 1 < s_gc_thread_entry_capacity)
-        {
-            s_gc_thread_entries[s_gc_thread_entry_count].tid = tid;
-            s_gc_thread_entries[s_gc_thread_entry_count].depth = 0;
-            s_gc_thread_entries[s_gc_thread_entry_count].state_stack = NULL;
-            return &s_gc_thread_entries[s_gc_thread_entry_count++];
-        }
-
-        std::size_t newcapacity;
-        if (s_gc_thread_entry_capacity == 0)
-            newcapacity = 10;
-        else
-            newcapacity = s_gc_thread_entry_capacity * 2;
-        const std::size_t newsize = newcapacity * sizeof(MZC3_GC_THREAD_ENTRY);
-
-        MZC3_GC_THREAD_ENTRY *newentries;
-        newentries = reinterpret_cast<MZC3_GC_THREAD_ENTRY *>(
-            realloc(s_gc_thread_entries, newsize));
-        if (newentries)
-        {
-            s_gc_thread_entries = newentries;
-            s_gc_thread_entries[s_gc_thread_entry_count].tid = tid;
-            s_gc_thread_entries[s_gc_thread_entry_count].depth = 0;
-            s_gc_thread_entries[s_gc_thread_entry_count].state_stack = NULL;
-            return &s_gc_thread_entries[s_gc_thread_entry_count++];
-        }
-
-        MzcTraceA("MZC3_GC_GetThreadEntry: failed\n");
-        return NULL;
-    #else
-        return &s_only_one_gc_thread_entry;
-    #endif
-}
-
-inline std::size_t& MZC3_GC_GetDepth(void)
-{
-    return MZC3_GC_GetThreadEntry()->depth;
-}
-
-inline MZC3_GC_STATE*& MZC3_GC_GetStateStack(void)
-{
-    return MZC3_GC_GetThreadEntry()->state_stack;
-}
-
-inline bool MZC3_GC_IsEnabled(void)
-{
-    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
-    return (entry && entry->state_stack && entry->state_stack->gc_enabled);
-}
-
-//////////////////////////////////////////////////////////////////////////////
-// synchronization
-
-#ifdef MZC3_GC_MT
-    #ifdef _WIN32
-        static CRITICAL_SECTION s_gc_cs;
-    #else
-        static pthread_mutex_t s_gc_cs;
-    #endif
-#endif
-
-inline void InitializeLock(void)
-{
-    #ifdef MZC3_GC_MT
-        #ifdef _WIN32
-            InitializeCriticalSection(&s_gc_cs);
-        #else
-            pthread_mutexattr_t attr;
-            pthread_mutexattr_init(&attr);
-            pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE_NP);
-            pthread_mutex_init(&s_gc_cs, &attr);
-            pthread_mutexattr_destroy(&attr);
-        #endif
-    #endif
-}
-
-inline void EnterLock(void)
-{
-    #ifdef MZC3_GC_MT
-        #ifdef _WIN32
-            EnterCriticalSection(&s_gc_cs);
-        #else
-            pthread_mutex_lock(&s_gc_cs);
-        #endif
-    #endif
-}
-
-inline void LeaveLock(void)
-{
-    #ifdef MZC3_GC_MT
-        #ifdef _WIN32
-            LeaveCriticalSection(&s_gc_cs);
-        #else
-            pthread_mutex_unlock(&s_gc_cs);
-        #endif
-    #endif
-}
-
-inline void DeleteLock(void)
-{
-    #ifdef MZC3_GC_MT
-        #ifdef _WIN32
-            DeleteCriticalSection(&s_gc_cs);
-        #else
-            pthread_mutex_destroy(&s_gc_cs);
-        #endif
-    #endif
-}
-
-//////////////////////////////////////////////////////////////////////////////
-// MZC3_GC
-
-static MZC3_GC_ENTRY *s_gc_entries = NULL;
-static std::size_t    s_gc_count = 0;
-static std::size_t    s_gc_capacity = 0;
-static bool           s_gc_constructed = false;
-
-class MZC3_GC_MGR
-{
-public:
-    MZC3_GC_MGR()
-    {
-        InitializeLock();
-        s_gc_constructed = true;
-    }
-
-    ~MZC3_GC_MGR();
-};
-
-MZC3_GC_MGR::~MZC3_GC_MGR()
-{
-    assert(s_gc_entries == NULL || s_gc_capacity);
-
-    EnterLock();
-    s_gc_constructed = false;
-
-    std::size_t gc_count = s_gc_count;
-    s_gc_count = 0;
-    s_gc_capacity = 0;
-
-    MZC3_GC_ENTRY *gc_entries = s_gc_entries;
-    s_gc_entries = NULL;
-    for (std::size_t i = 0; i < gc_count; i++)
-        free(gc_entries[i].m_ptr);
-    free(gc_entries);
-
-    #ifdef MZC3_GC_MT
-        MZC3_GC_THREAD_ENTRY *gc_thread_entries = s_gc_thread_entries;
-        s_gc_thread_entries = NULL;
-
-        std::size_t gc_thread_entry_count = s_gc_thread_entry_count;
-        s_gc_thread_entry_count = 0;
-        s_gc_thread_entry_capacity = 0;
-
-        for (std::size_t i = 0; i < gc_thread_entry_count; i++)
-        {
-            MZC3_GC_STATE *state = gc_thread_entries[i].state_stack;
-            while (state)
-            {
-                MZC3_GC_STATE *next = state->next;
-                free(state);
-                state = next;
-            }
-        }
-        free(gc_thread_entries);
-    #else
-        MZC3_GC_STATE *state = s_only_one_gc_thread_entry.state_stack;
-        while (state)
-        {
-            MZC3_GC_STATE *next = state->next;
-            free(state);
-            state = next;
-        }
-    #endif
-    LeaveLock();
-
-    DeleteLock();
-}
-
-MZC3_GC_MGR mzc_gc_mgr;
-
-static MZC3_GC_ENTRY *MZC3_GC_Find(void *ptr)
-{
-    assert(s_gc_entries == NULL || s_gc_capacity);
-    if (ptr == NULL || !s_gc_constructed)
-        return NULL;
-
-    for (std::size_t i = 0; i < s_gc_count; i++)
-    {
-        if (s_gc_entries[i].m_ptr == ptr)
-            return &s_gc_entries[i];
-    }
-    return NULL;
-}
-
-static void MZC3_GC_EraseEntry(MZC3_GC_ENTRY *entry)
-{
-    if (entry == NULL || !s_gc_constructed)
-        return;
-
-    assert(s_gc_entries == NULL || s_gc_capacity);
-    MZC3_GC_ENTRY *end = s_gc_entries + --s_gc_count;
-    for (MZC3_GC_ENTRY *e = entry; e != end; e++)
-        *e = *(e + 1);
-}
-
-static void MZC3_GC_ErasePtr(void *ptr)
-{
-    MZC3_GC_ENTRY *entry = MZC3_GC_Find(ptr);
-    if (entry == NULL)
-        return;
-
-    assert(s_gc_count);
-    for (MZC3_GC_ENTRY *e = entry; e < s_gc_entries + s_gc_count; e++)
-        *e = *(e + 1);
-
-    s_gc_count--;
-}
-
-static void MZC3_GC_GarbageCollect(void)
-{
-    assert(s_gc_entries == NULL || s_gc_capacity);
-    for (std::size_t i = s_gc_count - 1; i < s_gc_count; i--)
-    {
-        if (s_gc_entries[i].m_depth >= MZC3_GC_GetDepth())
-        {
-            void *ptr = s_gc_entries[i].m_ptr;
-            MZC3_GC_EraseEntry(&s_gc_entries[i]);
-            free(ptr);
-        }
-    }
-}
-
-#ifdef _DEBUG
-    static void MZC3_GC_AddPtr(void *ptr, std::size_t size, const char *file, int line)
-    {
-        assert(ptr);
-        assert(file);
-        if (!s_gc_constructed)
-            return;
-
-        MZC3_GC_ENTRY entry(ptr, size, MZC3_GC_GetDepth(), file, line);
-        if (s_gc_count + 1 > s_gc_capacity)
-        {
-            std::size_t newcapacity;
-            if (!s_gc_capacity)
-                newcapacity = 50;
-            else
-                newcapacity = s_gc_capacity * 2;
-
-            const std::size_t newsize = newcapacity * sizeof(MZC3_GC_ENTRY);
-            MZC3_GC_ENTRY *newentries =
-                reinterpret_cast<MZC3_GC_ENTRY *>(realloc(s_gc_entries, newsize));
-            if (newentries)
-            {
-                s_gc_entries = newentries;
-                s_gc_capacity = newcapacity;
-            }
-            else
-            {
-                MzcTraceA("%s (%d): MZC3_GC: ERROR: MZC3_GC_AddPtr failed\n",
-                          file, line);
-                return;
-            }
-        }
-        memcpy(&s_gc_entries[s_gc_count], &entry, sizeof(entry));
-        s_gc_count++;
-    }
-#else   // ndef _DEBUG
-    static void MZC3_GC_AddPtr(void *ptr, std::size_t size)
-    {
-        assert(ptr);
-        if (!s_gc_constructed)
-            return;
-
-        MZC3_GC_ENTRY entry(ptr, size, MZC3_GC_GetDepth());
-        if (s_gc_count + 1 > s_gc_capacity)
-        {
-            std::size_t newcapacity;
-            if (!s_gc_capacity)
-                newcapacity = 50;
-            else
-                newcapacity = s_gc_capacity * 2;
-
-            const std::size_t newsize = newcapacity * sizeof(MZC3_GC_ENTRY);
-            MZC3_GC_ENTRY *newentries =
-                reinterpret_cast<MZC3_GC_ENTRY *>(realloc(s_gc_entries, newsize));
-            if (newentries)
-            {
-                s_gc_entries = newentries;
-                s_gc_capacity = newcapacity;
-            }
-            else
-            {
-                return;
-            }
-        }
-        memcpy(&s_gc_entries[s_gc_count], &entry, sizeof(entry));
-        s_gc_count++;
-    }
-#endif  // ndef _DEBUG
-
-//////////////////////////////////////////////////////////////////////////////
-// misc functions
-
-extern "C" void MzcGC_Enter(int enable_gc)
-{
-    EnterLock();
-
-    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
-    if (entry)
-    {
-        MZC3_GC_STATE *state;
-        state = reinterpret_cast<MZC3_GC_STATE *>(malloc(sizeof(MZC3_GC_STATE)));
-        if (state)
-        {
-            state->gc_enabled = enable_gc;
-            state->next = entry->state_stack;
-            entry->state_stack = state;
-            entry->depth++;
-            assert(entry->depth > 0);
-        }
-        else
-            MzcTraceA("ERROR: MzcGC_Enter: malloc failed\n");
-    }
-    else
-        MzcTraceA("ERROR: MzcGC_Enter: MZC3_GC_GetThreadEntry failed\n");
-
-    LeaveLock();
-}
-
-extern "C" void MzcGC_Leave(void)
-{
-    EnterLock();
-
-    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
-    if (entry)
-    {
-        assert(entry->depth > 0);
-        MZC3_GC_STATE *state = entry->state_stack;
-        if (state)
-        {
-            MZC3_GC_STATE *next = state->next;
-            if (state->gc_enabled)
-            {
-                MZC3_GC_GarbageCollect();
-            }
-            free(state);
-            entry->state_stack = next;
-            entry->depth--;
-        }
-        else
-            MzcTraceA("ERROR: MzcGC_Enter and MzcGC_Leave mismatched\n");
-    }
-    else
-        MzcTraceA("ERROR: MzcGC_Leave: MZC3_GC_GetThreadEntry failed\n");
-
-    LeaveLock();
-}
-
-#ifdef _DEBUG
-    extern "C" void MzcGC_Report(void)
-    {
-        EnterLock();
-
-        assert(s_gc_entries == NULL || s_gc_capacity);
-        MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
-        if (entry)
-        {
-            for (std::size_t i = 0; i < s_gc_count; i++)
-            {
-                if (s_gc_entries[i].m_depth >= entry->depth)
-                {
-                    #ifdef _WIN64
-                        MzcTraceA("%s (%d): MZC3_GC: leaked object 0x%p (size: %I64u)\n",
-                            s_gc_entries[i].m_file, s_gc_entries[i].m_line,
-                            s_gc_entries[i].m_ptr, s_gc_entries[i].m_size);
-                    #else
-                        MzcTraceA("%s (%d): MZC3_GC: leaked object 0x%p (size: %u)\n",
-                            s_gc_entries[i].m_file, s_gc_entries[i].m_line,
-                            s_gc_entries[i].m_ptr, s_gc_entries[i].m_size);
-                    #endif
-                }
-            }
-        }
-        else
-            MzcTraceA("ERROR: MzcGC_Report: MZC3_GC_GetThreadEntry failed\n");
-
-        LeaveLock();
-    }
-#endif
-
-extern "C" void MzcGC_GarbageCollect(void)
-{
-    EnterLock();
-
-    MZC3_GC_GarbageCollect();
-
-    LeaveLock();
-}
-
-//////////////////////////////////////////////////////////////////////////////
-// mzcmalloc, mzccalloc, mzcrealloc, mzcfree, mzcstrdup, mzcwcsdup
-
-#ifdef _DEBUG
-    extern "C" void *mzcmalloc(std::size_t size, const char *file, int line)
-    {
-        using namespace std;
-        void *ptr = malloc(size);
-        if (ptr)
-        {
-            EnterLock();
-
-            if (MZC3_GC_IsEnabled())
-                MZC3_GC_AddPtr(ptr, size, file, line);
-
-            LeaveLock();
-        }
-        else if (size > 0)
-        {
-            #ifdef _WIN64
-                MzcTraceA("%s (%d): MZC3_GC ERROR: malloc(%I64u) failed\n",
-                    file, line, size);
-            #else
-                MzcTraceA("%s (%d): MZC3_GC ERROR: malloc(%u) failed\n",
-                    file, line, size);
-            #endif
-        }
-        return ptr;
-    }
-
-    extern "C" void *mzccalloc(std::size_t num, std::size_t size, const char *file, int line)
-    {
-        using namespace std;
-        void *ptr = calloc(num, size);
-        if (ptr)
-        {
-            EnterLock();
-
-            if (MZC3_GC_IsEnabled())
-                MZC3_GC_AddPtr(ptr, num * size, file, line);
-
-            LeaveLock();
-        }
-        else if (num && size)
-        {
-            #ifdef _WIN64
-                MzcTraceA(
-                    "%s (%d): MZC3_GC ERROR: calloc(%I64u, %I64u) failed\n",
-                    file, line, num, size);
-            #else
-                MzcTraceA(
-                    "%s (%d): MZC3_GC ERROR: calloc(%u, %u) failed\n",
-                    file, line, num, size);
-            #endif
-        }
-        return ptr;
-    }
-
-    extern "C" void *mzcrealloc(void *ptr, std::size_t size, const char *file, int line)
-    {
-        using namespace std;
-        void *newptr;
-
-        EnterLock();
-
-        MZC3_GC_ENTRY *entry = MZC3_GC_Find(ptr);
-        if (entry)
-        {
-            newptr = realloc(ptr, size);
-            if (newptr)
-            {
-                entry->m_ptr = newptr;
-                entry->m_size = size;
-                entry->m_file = file;
-                entry->m_line = line;
-            }
-            else if (size)
-            {
-                #ifdef _WIN64
-                    MzcTraceA(
-                        "%s (%d): MZC3_GC ERROR: realloc(%p, %I64u) failed\n",
-                        file, line, ptr, size);
-                #else
-                    MzcTraceA(
-                        "%s (%d): MZC3_GC ERROR: realloc(%p, %u) failed\n",
-                        file, line, ptr, size);
-                #endif
-            }
-        }
-        else if (ptr == NULL)
-        {
-            newptr = realloc(ptr, size);
-            if (newptr)
-            {
-                if (MZC3_GC_IsEnabled())
-                    MZC3_GC_AddPtr(newptr, size, file, line);
-            }
-            else if (size)
-            {
-                #ifdef _WIN64
-                    MzcTraceA(
-                        "%s (%d): MZC3_GC ERROR: realloc(%p, %I64u) failed\n",
-                        file, line, ptr, size);
-                #else
-                    MzcTraceA(
-                        "%s (%d): MZC3_GC ERROR: realloc(%p, %u) failed\n",
-                        file, line, ptr, size);
-                #endif
-            }
-        }
-        else
-        {
-            #ifdef _WIN64
-                MzcTraceA(
-                    "%s (%d): MZC3_GC ERROR: realloc got bad pointer 0x%p\n",
-                    file, line, ptr, size);
-            #else
-                MzcTraceA(
-                    "%s (%d): MZC3_GC ERROR: realloc got bad pointer 0x%p\n",
-                    file, line, ptr, size);
-            #endif
-        }
-
-        LeaveLock();
-
-        return newptr;
-    }
-
-    extern "C" void mzcfree(void *ptr)
-    {
-        using namespace std;
-        if (ptr == NULL)
-            return;
-
-        EnterLock();
-
-        MZC3_GC_ErasePtr(ptr);
-
-        LeaveLock();
-
-        free(ptr);
-    }
-
-    extern "C" char *mzcstrdup(const char *str, const char *file, int line)
-    {
-        using namespace std;
-        const std::size_t len = strlen(str);
-        const std::size_t size = (len + 1) * sizeof(char);
-        char *p = reinterpret_cast<char *>(mzcmalloc(size, file, line));
-        if (p)
-            memcpy(p, str, size);
-        return p;
-    }
-
-    extern "C" wchar_t *mzcwcsdup(const wchar_t *str, const char *file, int line)
-    {
-        using namespace std;
-        const std::size_t len = wcslen(str);
-        const std::size_t size = (len + 1) * sizeof(wchar_t);
-        wchar_t *p = reinterpret_cast<wchar_t *>(mzcmalloc(size, file, line));
-        if (p)
-            memcpy(p, str, size);
-        return p;
-    }
-#else   // ndef _DEBUG
-    extern "C" void *mzcmalloc(std::size_t size)
-    {
-        using namespace std;
-        void *ptr = malloc(size);
-        if (ptr)
-        {
-            EnterLock();
-
-            if (MZC3_GC_IsEnabled())
-                MZC3_GC_AddPtr(ptr, size);
-
-            LeaveLock();
-        }
-        return ptr;
-    }
-
-    extern "C" void *mzccalloc(std::size_t num, std::size_t size)
-    {
-        using namespace std;
-        void *ptr = calloc(num, size);
-        if (ptr)
-        {
-            EnterLock();
-
-            if (MZC3_GC_IsEnabled())
-                MZC3_GC_AddPtr(ptr, num * size);
-
-            LeaveLock();
-        }
-        return ptr;
-    }
-
-    extern "C" void *mzcrealloc(void *ptr, std::size_t size)
-    {
-        using namespace std;
-        void *newptr;
-
-        EnterLock();
-
-        MZC3_GC_ENTRY *entry = MZC3_GC_Find(ptr);
-        if (entry)
-        {
-            newptr = realloc(ptr, size);
-            if (newptr)
-            {
-                entry->m_ptr = newptr;
-                entry->m_size = size;
-            }
-        }
-        else if (ptr == NULL)
-        {
-            newptr = realloc(ptr, size);
-            if (newptr)
-            {
-                if (MZC3_GC_IsEnabled())
-                    MZC3_GC_AddPtr(newptr, size);
-            }
-        }
-
-        LeaveLock();
-
-        return newptr;
-    }
-
-    extern "C" void mzcfree(void *ptr)
-    {
-        using namespace std;
-        if (ptr == NULL)
-            return;
-
-        EnterLock();
-
-        MZC3_GC_ErasePtr(ptr);
-
-        LeaveLock();
-
-        free(ptr);
-    }
-
-    extern "C" char *mzcstrdup(const char *str)
-    {
-        using namespace std;
-        const std::size_t len = strlen(str);
-        const std::size_t size = (len + 1) * sizeof(char);
-        char *p = reinterpret_cast<char *>(mzcmalloc(size));
-        if (p)
-            memcpy(p, str, size);
-        return p;
-    }
-
-    extern "C" wchar_t *mzcwcsdup(const wchar_t *str)
-    {
-        using namespace std;
-        const std::size_t len = wcslen(str);
-        const std::size_t size = (len + 1) * sizeof(wchar_t);
-        wchar_t *p = reinterpret_cast<wchar_t *>(mzcmalloc(size));
-        if (p)
-            memcpy(p, str, size);
-        return p;
-    }
-#endif  // ndef _DEBUG
-
-//////////////////////////////////////////////////////////////////////////////
-// new, delete
-
-void* operator new(std::size_t size) throw(std::bad_alloc)
-{
-    #ifdef _DEBUG
-        void *ptr = mzcmalloc(size ? size : 1, __FILE__, __LINE__);
-    #else
-        void *ptr = mzcmalloc(size ? size : 1);
-    #endif
-    if (ptr == NULL)
-        throw std::bad_alloc();
-    return ptr;
-}
-
-void* operator new[](std::size_t size) throw(std::bad_alloc)
-{
-    #ifdef _DEBUG
-        void *ptr = mzcmalloc(size ? size : 1, __FILE__, __LINE__);
-    #else
-        void *ptr = mzcmalloc(size ? size : 1);
-    #endif
-    if (ptr == NULL)
-        throw std::bad_alloc();
-    return ptr;
-}
-
-#ifndef __BORLANDC__    // avoid E2171
-    void* operator new(std::size_t size, const std::nothrow_t&) throw()
-    {
-        #ifdef _DEBUG
-            void *ptr = mzcmalloc(size ? size : 1, __FILE__, __LINE__);
-        #else
-            void *ptr = mzcmalloc(size ? size : 1);
-        #endif
-        return ptr;
-    }
-
-    void* operator new[](std::size_t size, const std::nothrow_t&) throw()
-    {
-        #ifdef _DEBUG
-            void *ptr = mzcmalloc(size ? size : 1, __FILE__, __LINE__);
-        #else
-            void *ptr = mzcmalloc(size ? size : 1);
-        #endif
-        return ptr;
-    }
-#endif
-
-void operator delete(void* ptr) throw()
-{
-    mzcfree(ptr);
-}
-
-void operator delete[](void* ptr) throw()
-{
-    mzcfree(ptr);
-}
-
-#ifdef _DEBUG
-    void* operator new(std::size_t size, const char *file, int line)
-          throw(std::bad_alloc)
-    {
-        void *ptr = mzcmalloc((size ? size : 1), file, line);
-        if (ptr == NULL)
-            throw std::bad_alloc();
-        return ptr;
-    }
-
-    void* operator new[](std::size_t size, const char *file, int line)
-          throw(std::bad_alloc)
-    {
-        void *ptr = mzcmalloc((size ? size : 1), file, line);
-        if (ptr == NULL)
-            throw std::bad_alloc();
-        return ptr;
-    }
-
-    void* operator new(std::size_t size, const std::nothrow_t&,
-                       const char *file, int line) throw()
-    {
-        return mzcmalloc((size ? size : 1), file, line);
-    }
-
-    void* operator new[](std::size_t size, const std::nothrow_t&,
-                         const char *file, int line) throw()
-    {
-        return mzcmalloc((size ? size : 1), file, line);
-    }
-#endif
-
-//////////////////////////////////////////////////////////////////////////////
-
-#ifdef UNITTEST
-    // unit test and example
-    #include "GC_wrap.h"
-    int main(void)
-    {
-        using namespace std;
-        void *p1;
-        void *p2;
-        void *p3;
-        char *p4;
-        void *p5;
-        char *p6;
-        MzcGC_Enter(1); // GC-enabled section
-        {
-            p1 = malloc(1);
-            printf("p1: %p\n", p1);
-            MzcGC_Enter(1); // GC-enabled section
-            {
-                p2 = realloc(NULL, 2);
-                printf("p2: %p\n", p2);
-                p3 = new char[3];
-                printf("p3: %p\n", p3);
-                MzcGC_Enter(0); // GC-disabled section
-                {
-                    p4 = new char[4];
-                    printf("p4: %p\n", p4);
-                    MzcGC_Report();
-                }
-                MzcGC_Leave();
-                MzcGC_Report();
-            }
-            MzcGC_Leave();
-            p5 = new char[5];
-            printf("p5: %p\n", p5);
-            p6 = strdup("test6");
-            printf("p6: %p\n", p6);
-            char *p7 = new char[7];
-            printf("p7: %p\n", p7);
-            MzcGC_Report();
-        }
-        MzcGC_Leave();
-        delete[] p4;
-        return 0;
-    }
-#endif  // def UNITTEST
-
-#endif  // ndef MZC_NO_GC
+////////////////////////////////////////////////////////////////////////////
+// GC.cpp -- MZC3 GC
+// This file is part of MZC3.  See file "ReadMe.txt" and "License.txt".
+////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#ifndef MZC_NO_GC
+
+#include "GC_unwrap.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// MzcTraceA --- Output a message for debugging
+
+#ifndef MzcTraceA
+    #ifdef _DEBUG
+        void MzcTraceA(const char *fmt, ...)
+        {
+            using namespace std;
+            assert(fmt);
+            #ifdef MZC_DEBUG_OUTPUT_IS_STDERR
+                va_list va;
+                va_start(va, fmt);
+                vfprintf(stderr, fmt, va);
+                va_end(va);
+            #elif defined(MZC_DEBUG_OUTPUT_IS_STDOUT)
+                va_list va;
+                va_start(va, fmt);
+                vfprintf(stdout, fmt, va);
+                va_end(va);
+            #elif defined(_WIN32)
+                // truncated if too long
+                char buf[1024];
+                va_list va;
+                va_start(va, fmt);
+                _vsnprintf(buf, sizeof(buf) - 1, fmt, va);
+                buf[sizeof(buf) - 1] = 0;
+                OutputDebugStringA(buf);
+                va_end(va);
+            #else
+                va_list va;
+                va_start(va, fmt);
+                vfprintf(stderr, fmt, va);
+                va_end(va);
+            #endif
+        }
+        #define MzcTraceA MzcTraceA
+    #else
+        inline void MzcTraceA(const char *, ...)
+        {
+        }
+        #define MzcTraceA 1 ? (void)0 : (void)MzcTraceA
+    #endif
+#endif  // ndef MzcTraceA
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_ENTRY --- GC entry
+
+struct MZC3_GC_STATE;
+struct MZC3_GC_ENTRY;
+
+// A link to an entry.  In the hash index mode, the entries are in chunks
+// that never move, and a link is the 32-bit id of an entry (see
+// MZC3_GC_EntryOf).  Id 0 is no entry.
+#ifdef MZC3_GC_HEADER
+    typedef MZC3_GC_ENTRY *MZC3_GC_LINK;
+#else
+    typedef unsigned MZC3_GC_LINK;
+#endif
+
+struct MZC3_GC_ENTRY
+{
+    MZC3_GC_LINK    m_prev;     // links in the list of m_state
+    MZC3_GC_LINK    m_next;
+    unsigned        m_state;    // the id of the GC section that owns the
+                                // entry, or 0 (see MZC3_GC_StateOf)
+    unsigned        m_depth;
+    void *          m_ptr;
+    std::size_t     m_size;
+    unsigned        m_offset;   // the padding before the entry or m_ptr
+    bool            m_has_finalizer;    // see MzcGC_SetFinalizer
+    bool            m_has_sample;       // see MzcGC_SetSampleRate
+    #ifdef _DEBUG
+        unsigned    m_site;     // see MZC3_GC_InternSite
+    #endif
+};
+
+// The finalizer and the sample of an entry are rare, so they are kept in
+// side tables (see MZC3_GC_EXTRAS).
+//
+// MzcGC_DumpHeap reads the entries in the hash index under the shard lock
+// only.  The fields it reads are set before an entry is indexed, or stored
+// by MZC3_GC_StoreCounter, and it reads the thread of m_state by
+// MZC3_GC_StateThread.
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_STATE
+
+struct MZC3_GC_ARENA_CHUNK;
+struct MZC3_GC_THREAD_ENTRY;
+
+// A section.  The frame part is shared with the inline fast path of GC.h,
+// which pushes and pops sections whose busy is zero.
+struct MZC3_GC_STATE : MZC3_GC_FRAME
+{
+    MZC3_GC_THREAD_ENTRY *owner;
+    unsigned id;                // see MZC3_GC_StateOf
+    MZC3_GC_ENTRY *entries;     // allocations of this section, newest first
+    std::size_t bytes;          // the total size of entries
+    std::size_t finalizers;     // the entries with m_has_finalizer
+                                // (touched by owner only)
+
+    // arena section (see MzcGC_EnterArena)
+    std::size_t          arena_chunk_size;  // zero if not an arena section
+    MZC3_GC_ARENA_CHUNK *arena_chunks;      // newest first
+    char *               arena_ptr;         // bump pointer in arena_chunks
+    char *               arena_last;        // the most recent block
+    std::size_t          arena_bytes;       // the total size of arena_chunks
+
+    // conservative section (see MzcGC_EnterConservative)
+    int         conservative;
+    std::size_t allocated;      // bytes allocated since the last marking
+    std::size_t collect_at;     // marks when allocated reaches this
+
+    // budget (see MzcGC_SetBudget)
+    std::size_t budget;         // zero if none
+    int         budget_policy;  // MZC_GC_BUDGET_*
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// synchronization
+
+#ifdef MZC3_GC_MT
+    #ifdef _WIN32
+        static CRITICAL_SECTION s_gc_cs;
+    #else
+        static pthread_mutex_t s_gc_cs;
+    #endif
+#endif
+
+inline void InitializeLock(void)
+{
+    #ifdef MZC3_GC_MT
+        #ifdef _WIN32
+            InitializeCriticalSection(&s_gc_cs);
+        #else
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE_NP);
+            pthread_mutex_init(&s_gc_cs, &attr);
+            pthread_mutexattr_destroy(&attr);
+        #endif
+    #endif
+}
+
+inline void EnterLock(void)
+{
+    #ifdef MZC3_GC_MT
+        #ifdef _WIN32
+            EnterCriticalSection(&s_gc_cs);
+        #else
+            pthread_mutex_lock(&s_gc_cs);
+        #endif
+    #endif
+}
+
+inline void LeaveLock(void)
+{
+    #ifdef MZC3_GC_MT
+        #ifdef _WIN32
+            LeaveCriticalSection(&s_gc_cs);
+        #else
+            pthread_mutex_unlock(&s_gc_cs);
+        #endif
+    #endif
+}
+
+inline void DeleteLock(void)
+{
+    #ifdef MZC3_GC_MT
+        #ifdef _WIN32
+            DeleteCriticalSection(&s_gc_cs);
+        #else
+            pthread_mutex_destroy(&s_gc_cs);
+        #endif
+    #endif
+}
+
+// MZC3_GC_LOCK --- a non-recursive lock.  s_gc_cs only guards the thread
+// list and the shutdown.  The others are striped: the order is s_gc_cs,
+// a registry shard, a slab class, then the slab pages.  The arena spans
+// lock, the roots lock, the section ids lock, the entry map lock and the
+// locks of the side tables are leaves.  The entry lists of the sections
+// need no lock, since only the thread of a section touches them (see
+// MZC3_GC_FreeRemote).
+#ifdef MZC3_GC_MT
+    #ifdef _WIN32
+        typedef SRWLOCK MZC3_GC_LOCK;
+    #else
+        typedef pthread_mutex_t MZC3_GC_LOCK;
+    #endif
+    static const std::size_t MZC3_GC_STRIPES = 64;  // power of two
+#else
+    typedef int MZC3_GC_LOCK;
+    static const std::size_t MZC3_GC_STRIPES = 1;
+#endif
+
+inline void MZC3_GC_InitLock(MZC3_GC_LOCK *lock)
+{
+    #ifdef MZC3_GC_MT
+        #ifdef _WIN32
+            InitializeSRWLock(lock);
+        #else
+            pthread_mutex_init(lock, NULL);
+        #endif
+    #else
+        *lock = 0;
+    #endif
+}
+
+inline void MZC3_GC_Lock(MZC3_GC_LOCK *lock)
+{
+    #ifdef MZC3_GC_MT
+        #ifdef _WIN32
+            AcquireSRWLockExclusive(lock);
+        #else
+            pthread_mutex_lock(lock);
+        #endif
+    #else
+        (void)lock;
+    #endif
+}
+
+inline void MZC3_GC_Unlock(MZC3_GC_LOCK *lock)
+{
+    #ifdef MZC3_GC_MT
+        #ifdef _WIN32
+            ReleaseSRWLockExclusive(lock);
+        #else
+            pthread_mutex_unlock(lock);
+        #endif
+    #else
+        (void)lock;
+    #endif
+}
+
+#ifdef MZC3_GC_MT
+    // MZC3_GC_COND --- a condition variable used with MZC3_GC_LOCK
+    #ifdef _WIN32
+        typedef CONDITION_VARIABLE MZC3_GC_COND;
+    #else
+        typedef pthread_cond_t MZC3_GC_COND;
+    #endif
+
+    inline void MZC3_GC_InitCond(MZC3_GC_COND *cond)
+    {
+        #ifdef _WIN32
+            InitializeConditionVariable(cond);
+        #else
+            pthread_cond_init(cond, NULL);
+        #endif
+    }
+
+    inline void MZC3_GC_Wait(MZC3_GC_COND *cond, MZC3_GC_LOCK *lock)
+    {
+        #ifdef _WIN32
+            SleepConditionVariableSRW(cond, lock, INFINITE, 0);
+        #else
+            pthread_cond_wait(cond, lock);
+        #endif
+    }
+
+    inline void MZC3_GC_WakeAll(MZC3_GC_COND *cond)
+    {
+        #ifdef _WIN32
+            WakeAllConditionVariable(cond);
+        #else
+            pthread_cond_broadcast(cond);
+        #endif
+    }
+#endif
+
+// Returns the stripe of ptr.  Independent of MZC3_GC_HashPtr, so that a
+// shard does not use only some of its index slots.
+inline std::size_t MZC3_GC_StripeOf(const void *ptr)
+{
+    std::size_t h = reinterpret_cast<std::size_t>(ptr) >> 4;
+    h *= 0x9E3779B1;
+    return (h >> 16) & (MZC3_GC_STRIPES - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_COUNTERS --- per-thread statistics (see MzcGC_GetStats)
+
+// Only its thread writes the counters, and any thread reads them without
+// locking.  Relaxed atomics keep the reads whole.
+struct MZC3_GC_COUNTERS
+{
+    std::size_t allocs[MZC_GC_STATS_DEPTHS];
+    std::size_t frees[MZC_GC_STATS_DEPTHS];
+    std::size_t bytes_in;       // tracked, grown, or arena chunks
+    std::size_t bytes_out;      // freed, shrunk, or untracked
+    std::size_t blocks_in;
+    std::size_t blocks_out;
+    std::size_t peak_bytes;     // the maximum of bytes_in - bytes_out
+    std::size_t peak_blocks;
+    std::size_t collections;
+    std::size_t reclaimed_bytes;
+    std::size_t reclaimed_blocks;
+    double      collect_seconds;
+};
+
+#if defined(MZC3_GC_MT) && defined(__ATOMIC_RELAXED)
+    template <typename T>
+    inline T MZC3_GC_LoadCounter(const T *counter)
+    {
+        T value;
+        __atomic_load(const_cast<T *>(counter), &value, __ATOMIC_RELAXED);
+        return value;
+    }
+
+    template <typename T>
+    inline void MZC3_GC_StoreCounter(T *counter, T value)
+    {
+        __atomic_store(counter, &value, __ATOMIC_RELAXED);
+    }
+#elif defined(MZC3_GC_MT)
+    template <typename T>
+    inline T MZC3_GC_LoadCounter(const T *counter)
+    {
+        return *const_cast<const volatile T *>(counter);
+    }
+
+    template <typename T>
+    inline void MZC3_GC_StoreCounter(T *counter, T value)
+    {
+        *const_cast<volatile T *>(counter) = value;
+    }
+#else
+    template <typename T>
+    inline T MZC3_GC_LoadCounter(const T *counter)
+    {
+        return *counter;
+    }
+
+    template <typename T>
+    inline void MZC3_GC_StoreCounter(T *counter, T value)
+    {
+        *counter = value;
+    }
+#endif
+
+#ifdef MZC3_GC_MT
+    // The pointer atomics of the remote-free queues (see MZC3_GC_SLAB_CACHE)
+    // and of the arena map (see MZC3_GC_ArenaFind).  Without them, the slabs
+    // are shared by all threads, and the arena map is read under its lock.
+    #if defined(__ATOMIC_ACQUIRE)
+        template <typename T>
+        inline T *MZC3_GC_LoadPtr(T *const *ptr)
+        {
+            return __atomic_load_n(const_cast<T **>(ptr), __ATOMIC_ACQUIRE);
+        }
+
+        template <typename T>
+        inline void MZC3_GC_StorePtr(T **ptr, T *value)
+        {
+            __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+        }
+
+        // Replaces *ptr by value if it is expected.
+        inline bool MZC3_GC_CasPtr(void **ptr, void *expected, void *value)
+        {
+            return __atomic_compare_exchange_n(ptr, &expected, value, true,
+                                               __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        }
+
+        inline void *MZC3_GC_ExchangePtr(void **ptr, void *value)
+        {
+            return __atomic_exchange_n(ptr, value, __ATOMIC_ACQUIRE);
+        }
+
+        #define MZC3_GC_ATOMIC_PTR
+        #define MZC3_GC_THREAD_CACHE
+    #elif defined(_WIN32)
+        // NOTE: Volatile accesses of Visual C++ are acquire and release.
+        template <typename T>
+        inline T *MZC3_GC_LoadPtr(T *const *ptr)
+        {
+            return *const_cast<T *const volatile *>(ptr);
+        }
+
+        template <typename T>
+        inline void MZC3_GC_StorePtr(T **ptr, T *value)
+        {
+            *const_cast<T *volatile *>(ptr) = value;
+        }
+
+        inline bool MZC3_GC_CasPtr(void **ptr, void *expected, void *value)
+        {
+            return InterlockedCompareExchangePointer(ptr, value, expected) == expected;
+        }
+
+        inline void *MZC3_GC_ExchangePtr(void **ptr, void *value)
+        {
+            return InterlockedExchangePointer(ptr, value);
+        }
+
+        #define MZC3_GC_ATOMIC_PTR
+        #define MZC3_GC_THREAD_CACHE
+    #endif
+
+    // A thread finds its own cache by MZC3_GC_TLS, even while exiting.
+    #ifndef MZC3_GC_TLS
+        #undef MZC3_GC_THREAD_CACHE
+    #endif
+#endif
+
+#ifndef MZC3_GC_ATOMIC_PTR
+    // Under a lock, or in the single-thread build
+    template <typename T>
+    inline T *MZC3_GC_LoadPtr(T *const *ptr)
+    {
+        return *ptr;
+    }
+
+    template <typename T>
+    inline void MZC3_GC_StorePtr(T **ptr, T *value)
+    {
+        *ptr = value;
+    }
+#endif
+
+// Adds to a counter of the current thread.
+template <typename T>
+inline void MZC3_GC_AddCounter(T *counter, T value)
+{
+    MZC3_GC_StoreCounter(counter, *counter + value);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_THREAD_ENTRY --- per-thread GC state
+
+struct MZC3_GC_SLAB_CACHE;
+
+struct MZC3_GC_THREAD_ENTRY
+{
+    MZC3_GC_STACK stack;        // must be first (see mzc3_gc_stack)
+    const char *stack_base;     // NULL if unknown, or until the first marking
+    MZC3_GC_COUNTERS counters;
+    std::size_t sample_left;    // bytes until the next sample
+    unsigned    sample_seed;
+    std::size_t budgets;        // the open sections with budgets
+    std::size_t id;             // 0, 1, ... in the order of creation
+    int         in_overrun;     // non-zero while handling an overrun
+    #ifdef _DEBUG
+        unsigned site_cache[64];    // recent call sites by hash
+    #endif
+    #ifdef MZC3_GC_THREAD_CACHE
+        MZC3_GC_SLAB_CACHE *slab_cache;     // NULL if out of memory
+    #endif
+    #ifdef MZC3_GC_MT
+        void *remote_entries;   // freed by other threads (see MZC3_GC_FreeRemote)
+        #ifndef MZC3_GC_ATOMIC_PTR
+            MZC3_GC_LOCK remote_lock;   // guards remote_entries
+        #endif
+        MZC3_GC_THREAD_ENTRY *prev;     // links in s_gc_thread_entries
+        MZC3_GC_THREAD_ENTRY *next;
+        // for stopping the thread (see MZC3_GC_StopThreads)
+        #ifdef _WIN32
+            DWORD thread_id;
+        #else
+            pthread_t handle;
+            const char *stop_top;       // the stack top while stopped, or NULL
+        #endif
+    #endif
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_STATE_SLOT --- a section by its 32-bit id
+//
+// An entry keeps the id of its section rather than a pointer.  The slots
+// are stored in segments that never move, so that the slot of an id is
+// read without locking.  Id 0 is no section.  The ids of the freed
+// sections are reused, and the segments are kept until exit.
+
+struct MZC3_GC_STATE_SLOT
+{
+    MZC3_GC_STATE * m_state;    // NULL if free
+    unsigned        m_thread;   // the id + 1 of the thread of m_state
+    unsigned        m_next;     // the next free id
+};
+
+static const std::size_t MZC3_GC_STATE_SEGMENT = 1024;
+static const std::size_t MZC3_GC_STATE_SEGMENTS = 4096;
+
+// (protected by s_gc_state_lock, a leaf.  The segments and the slots are
+// stored by MZC3_GC_StorePtr and MZC3_GC_StoreCounter for the readers.)
+static MZC3_GC_STATE_SLOT *s_gc_state_segments[MZC3_GC_STATE_SEGMENTS];
+static std::size_t s_gc_state_count = 0;    // the ids used so far
+static unsigned s_gc_state_free = 0;        // the free ids, linked by m_next
+static MZC3_GC_LOCK s_gc_state_lock;
+
+inline MZC3_GC_STATE_SLOT *MZC3_GC_StateSlot(unsigned id)
+{
+    MZC3_GC_STATE_SLOT *segment =
+        MZC3_GC_LoadPtr(&s_gc_state_segments[(id - 1) / MZC3_GC_STATE_SEGMENT]);
+    return &segment[(id - 1) % MZC3_GC_STATE_SEGMENT];
+}
+
+// Returns the section of a non-zero id.  The sections of a thread are
+// freed only when it exits, so a tracked entry keeps its section alive.
+inline MZC3_GC_STATE *MZC3_GC_StateOf(unsigned id)
+{
+    return MZC3_GC_LoadPtr(&MZC3_GC_StateSlot(id)->m_state);
+}
+
+// Returns the id + 1 of the thread of the section of id, or zero if none.
+// The section may be gone meanwhile, but its slot is not.
+static unsigned MZC3_GC_StateThread(unsigned id)
+{
+    if (id == 0)
+        return 0;
+    #if defined(MZC3_GC_MT) && !defined(MZC3_GC_ATOMIC_PTR)
+        MZC3_GC_Lock(&s_gc_state_lock);
+    #endif
+    const unsigned thread = MZC3_GC_LoadCounter(&MZC3_GC_StateSlot(id)->m_thread);
+    #if defined(MZC3_GC_MT) && !defined(MZC3_GC_ATOMIC_PTR)
+        MZC3_GC_Unlock(&s_gc_state_lock);
+    #endif
+    return thread;
+}
+
+// Gives the section of a thread an id.  Returns false if out of memory.
+static bool MZC3_GC_AddState(MZC3_GC_STATE *state)
+{
+    using namespace std;
+    MZC3_GC_Lock(&s_gc_state_lock);
+    unsigned id = s_gc_state_free;
+    if (id)
+    {
+        s_gc_state_free = MZC3_GC_StateSlot(id)->m_next;
+    }
+    else if (s_gc_state_count < MZC3_GC_STATE_SEGMENT * MZC3_GC_STATE_SEGMENTS)
+    {
+        const std::size_t segment = s_gc_state_count / MZC3_GC_STATE_SEGMENT;
+        if (s_gc_state_segments[segment] == NULL)
+        {
+            MZC3_GC_STATE_SLOT *slots = reinterpret_cast<MZC3_GC_STATE_SLOT *>(
+                calloc(MZC3_GC_STATE_SEGMENT, sizeof(MZC3_GC_STATE_SLOT)));
+            if (slots)
+                MZC3_GC_StorePtr(&s_gc_state_segments[segment], slots);
+        }
+        if (s_gc_state_segments[segment])
+            id = static_cast<unsigned>(++s_gc_state_count);
+    }
+    if (id)
+    {
+        MZC3_GC_STATE_SLOT *slot = MZC3_GC_StateSlot(id);
+        MZC3_GC_StoreCounter(&slot->m_thread,
+                             static_cast<unsigned>(state->owner->id + 1));
+        MZC3_GC_StorePtr(&slot->m_state, state);
+    }
+    MZC3_GC_Unlock(&s_gc_state_lock);
+    state->id = id;
+    return (id != 0);
+}
+
+// Frees the id of the section.  No entry may have it.
+static void MZC3_GC_RemoveState(MZC3_GC_STATE *state)
+{
+    MZC3_GC_Lock(&s_gc_state_lock);
+    MZC3_GC_STATE_SLOT *slot = MZC3_GC_StateSlot(state->id);
+    MZC3_GC_StorePtr(&slot->m_state, static_cast<MZC3_GC_STATE *>(NULL));
+    MZC3_GC_StoreCounter(&slot->m_thread, 0U);
+    slot->m_next = s_gc_state_free;
+    s_gc_state_free = state->id;
+    MZC3_GC_Unlock(&s_gc_state_lock);
+}
+
+#ifdef MZC3_GC_MT
+    // the live threads (protected by s_gc_cs)
+    static MZC3_GC_THREAD_ENTRY *s_gc_thread_entries = NULL;
+    // the counters of the exited threads (protected by s_gc_cs)
+    static MZC3_GC_COUNTERS s_gc_exited_counters;
+    // the threads created so far (protected by s_gc_cs)
+    static std::size_t s_gc_thread_count = 0;
+
+    static void MZC3_GC_ThreadExit(void *data);
+    static const char *MZC3_GC_StackBase(void);
+    #ifdef MZC3_GC_THREAD_CACHE
+        static MZC3_GC_SLAB_CACHE *MZC3_GC_SlabCacheAcquire(void);
+        static void MZC3_GC_SlabCacheRelease(MZC3_GC_SLAB_CACHE *cache);
+    #endif
+
+    #ifdef _WIN32
+        static INIT_ONCE s_gc_tls_once = INIT_ONCE_STATIC_INIT;
+        static DWORD s_gc_tls_index = FLS_OUT_OF_INDEXES;
+
+        static VOID WINAPI MZC3_GC_FlsCallback(PVOID data)
+        {
+            if (data)
+                MZC3_GC_ThreadExit(data);
+        }
+
+        static BOOL CALLBACK MZC3_GC_InitTls(PINIT_ONCE, PVOID, PVOID *)
+        {
+            s_gc_tls_index = FlsAlloc(MZC3_GC_FlsCallback);
+            return (s_gc_tls_index != FLS_OUT_OF_INDEXES);
+        }
+    #else
+        static pthread_once_t s_gc_tls_once = PTHREAD_ONCE_INIT;
+        static pthread_key_t s_gc_tls_key;
+        static bool s_gc_tls_ok = false;
+
+        static void MZC3_GC_InitTls(void)
+        {
+            s_gc_tls_ok = (pthread_key_create(&s_gc_tls_key, MZC3_GC_ThreadExit) == 0);
+        }
+    #endif
+#else
+    static MZC3_GC_THREAD_ENTRY s_only_one_gc_thread_entry;
+#endif
+
+#ifdef MZC3_GC_TLS
+    MZC3_GC_TLS MZC3_GC_STACK *mzc3_gc_stack = NULL;
+#endif
+
+// Returns the top section, or NULL.
+inline MZC3_GC_STATE *MZC3_GC_Top(MZC3_GC_THREAD_ENTRY *entry)
+{
+    return static_cast<MZC3_GC_STATE *>(entry->stack.top);
+}
+
+// Returns the outer section of state, or NULL.
+inline MZC3_GC_STATE *MZC3_GC_Outer(MZC3_GC_STATE *state)
+{
+    return static_cast<MZC3_GC_STATE *>(state->next);
+}
+
+#ifdef MZC3_GC_MT
+    // Returns the entry of the current thread.  Lock-free except on the
+    // first call in the thread.
+    static MZC3_GC_THREAD_ENTRY *MZC3_GC_GetThreadEntry(void)
+    {
+        using namespace std;
+        MZC3_GC_THREAD_ENTRY *entry;
+        #ifdef MZC3_GC_TLS
+            if (mzc3_gc_stack)
+                return reinterpret_cast<MZC3_GC_THREAD_ENTRY *>(mzc3_gc_stack);
+        #endif
+        #ifdef _WIN32
+            if (!InitOnceExecuteOnce(&s_gc_tls_once, MZC3_GC_InitTls, NULL, NULL))
+                return NULL;
+            entry = reinterpret_cast<MZC3_GC_THREAD_ENTRY *>(FlsGetValue(s_gc_tls_index));
+        #else
+            pthread_once(&s_gc_tls_once, MZC3_GC_InitTls);
+            if (!s_gc_tls_ok)
+                return NULL;
+            entry = reinterpret_cast<MZC3_GC_THREAD_ENTRY *>(pthread_getspecific(s_gc_tls_key));
+        #endif
+        if (entry)
+        {
+            #ifdef MZC3_GC_TLS
+                mzc3_gc_stack = &entry->stack;
+            #endif
+            return entry;
+        }
+
+        entry = reinterpret_cast<MZC3_GC_THREAD_ENTRY *>(calloc(1, sizeof(MZC3_GC_THREAD_ENTRY)));
+        if (entry == NULL)
+        {
+            MzcTraceA("MZC3_GC_GetThreadEntry: failed\n");
+            return NULL;
+        }
+        #ifdef _WIN32
+            FlsSetValue(s_gc_tls_index, entry);
+        #else
+            pthread_setspecific(s_gc_tls_key, entry);
+        #endif
+        #ifdef MZC3_GC_TLS
+            mzc3_gc_stack = &entry->stack;
+        #endif
+        #ifdef MZC3_GC_THREAD_CACHE
+            entry->slab_cache = MZC3_GC_SlabCacheAcquire();
+        #endif
+        #ifndef MZC3_GC_ATOMIC_PTR
+            MZC3_GC_InitLock(&entry->remote_lock);
+        #endif
+        // Another thread may mark from the stack of this one.
+        entry->stack_base = MZC3_GC_StackBase();
+        #ifdef _WIN32
+            entry->thread_id = GetCurrentThreadId();
+        #else
+            entry->handle = pthread_self();
+        #endif
+
+        EnterLock();
+        entry->next = s_gc_thread_entries;
+        if (s_gc_thread_entries)
+            s_gc_thread_entries->prev = entry;
+        s_gc_thread_entries = entry;
+        entry->id = s_gc_thread_count++;
+        LeaveLock();
+        return entry;
+    }
+#else
+    inline MZC3_GC_THREAD_ENTRY *MZC3_GC_GetThreadEntry(void)
+    {
+        mzc3_gc_stack = &s_only_one_gc_thread_entry.stack;
+        return &s_only_one_gc_thread_entry;
+    }
+#endif
+
+inline std::size_t& MZC3_GC_GetDepth(void)
+{
+    return MZC3_GC_GetThreadEntry()->stack.depth;
+}
+
+inline MZC3_GC_STATE *MZC3_GC_GetState(void);
+
+inline bool MZC3_GC_IsEnabled(void)
+{
+    MZC3_GC_STATE *state = MZC3_GC_GetState();
+    return (state && state->gc_enabled);
+}
+
+inline MZC3_GC_STATE *MZC3_GC_GetState(void)
+{
+    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
+    return (entry ? MZC3_GC_Top(entry) : NULL);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// statistics (see MZC3_GC_COUNTERS)
+
+// Returns the counters of the current thread, or NULL.
+inline MZC3_GC_COUNTERS *MZC3_GC_GetCounters(void)
+{
+    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
+    return (entry ? &entry->counters : NULL);
+}
+
+inline std::size_t MZC3_GC_DepthSlot(std::size_t depth)
+{
+    if (depth >= MZC_GC_STATS_DEPTHS)
+        return MZC_GC_STATS_DEPTHS - 1;
+    return (depth ? depth - 1 : 0);
+}
+
+// Counts bytes and blocks that became tracked.
+static void MZC3_GC_CountIn(MZC3_GC_COUNTERS *c, std::size_t bytes,
+                            std::size_t blocks)
+{
+    MZC3_GC_AddCounter(&c->bytes_in, bytes);
+    MZC3_GC_AddCounter(&c->blocks_in, blocks);
+
+    // The net of a thread is negative if it frees the blocks of others.
+    const std::ptrdiff_t net_bytes =
+        static_cast<std::ptrdiff_t>(c->bytes_in - c->bytes_out);
+    if (net_bytes > static_cast<std::ptrdiff_t>(c->peak_bytes))
+        MZC3_GC_StoreCounter(&c->peak_bytes, std::size_t(net_bytes));
+    const std::ptrdiff_t net_blocks =
+        static_cast<std::ptrdiff_t>(c->blocks_in - c->blocks_out);
+    if (net_blocks > static_cast<std::ptrdiff_t>(c->peak_blocks))
+        MZC3_GC_StoreCounter(&c->peak_blocks, std::size_t(net_blocks));
+}
+
+// Counts bytes and blocks that are no longer tracked.
+inline void MZC3_GC_CountOut(MZC3_GC_COUNTERS *c, std::size_t bytes,
+                             std::size_t blocks)
+{
+    MZC3_GC_AddCounter(&c->bytes_out, bytes);
+    MZC3_GC_AddCounter(&c->blocks_out, blocks);
+}
+
+// Counts a tracked block freed.  reclaimed is true if by the GC.
+static void MZC3_GC_CountFree(MZC3_GC_COUNTERS *c, std::size_t depth,
+                              std::size_t size, bool reclaimed)
+{
+    MZC3_GC_AddCounter(&c->frees[MZC3_GC_DepthSlot(depth)], std::size_t(1));
+    MZC3_GC_CountOut(c, size, 1);
+    if (reclaimed)
+    {
+        MZC3_GC_AddCounter(&c->reclaimed_bytes, size);
+        MZC3_GC_AddCounter(&c->reclaimed_blocks, std::size_t(1));
+    }
+}
+
+// Counts a tracked block resized.
+static void MZC3_GC_CountResize(std::size_t oldsize, std::size_t size)
+{
+    if (MZC3_GC_COUNTERS *c = MZC3_GC_GetCounters())
+    {
+        if (size > oldsize)
+            MZC3_GC_CountIn(c, size - oldsize, 0);
+        else
+            MZC3_GC_CountOut(c, oldsize - size, 0);
+    }
+}
+
+// Returns the time in seconds, for intervals.
+static double MZC3_GC_Now(void)
+{
+    #ifdef _WIN32
+        LARGE_INTEGER freq, count;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&count);
+        return double(count.QuadPart) / double(freq.QuadPart);
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+    #endif
+}
+
+// Counts a garbage collection begun at start (see MZC3_GC_Now).
+inline void MZC3_GC_CountCollection(MZC3_GC_COUNTERS *c, double start)
+{
+    MZC3_GC_AddCounter(&c->collections, std::size_t(1));
+    MZC3_GC_AddCounter(&c->collect_seconds, MZC3_GC_Now() - start);
+}
+
+// Adds the counters of src to dest.  dest is not shared.
+static void MZC3_GC_SumCounters(MZC3_GC_COUNTERS *dest,
+                                const MZC3_GC_COUNTERS *src)
+{
+    for (std::size_t i = 0; i < MZC_GC_STATS_DEPTHS; i++)
+    {
+        dest->allocs[i] += MZC3_GC_LoadCounter(&src->allocs[i]);
+        dest->frees[i] += MZC3_GC_LoadCounter(&src->frees[i]);
+    }
+    dest->bytes_in += MZC3_GC_LoadCounter(&src->bytes_in);
+    dest->bytes_out += MZC3_GC_LoadCounter(&src->bytes_out);
+    dest->blocks_in += MZC3_GC_LoadCounter(&src->blocks_in);
+    dest->blocks_out += MZC3_GC_LoadCounter(&src->blocks_out);
+    dest->peak_bytes += MZC3_GC_LoadCounter(&src->peak_bytes);
+    dest->peak_blocks += MZC3_GC_LoadCounter(&src->peak_blocks);
+    dest->collections += MZC3_GC_LoadCounter(&src->collections);
+    dest->reclaimed_bytes += MZC3_GC_LoadCounter(&src->reclaimed_bytes);
+    dest->reclaimed_blocks += MZC3_GC_LoadCounter(&src->reclaimed_blocks);
+    dest->collect_seconds += MZC3_GC_LoadCounter(&src->collect_seconds);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// sampling profiler (see MzcGC_SetSampleRate)
+//
+// Each thread counts down the bytes of its tracked allocations, and the
+// allocation that crosses zero is sampled.  The intervals are random with
+// the mean of the rate, so that a sample of size bytes stands for
+// 1 / (1 - exp(-size / rate)) allocations of the stack.
+
+static const std::size_t MZC3_GC_PROFILE_DEPTH = 32;
+static const std::size_t MZC3_GC_PROFILE_BUCKETS = 1024;   // power of two
+
+// MZC3_GC_PROFILE_STACK --- the totals of a call stack
+struct MZC3_GC_PROFILE_STACK
+{
+    MZC3_GC_PROFILE_STACK * m_next;         // in the bucket
+    std::size_t             m_hash;
+    std::size_t             m_live_count;
+    std::size_t             m_live_bytes;
+    std::size_t             m_alloc_count;
+    std::size_t             m_alloc_bytes;
+    std::size_t             m_reclaimed_count;
+    std::size_t             m_reclaimed_bytes;
+    std::size_t             m_depth;
+    void *                  m_frames[1];    // innermost first
+};
+
+// MZC3_GC_SAMPLE --- a sampled allocation
+struct MZC3_GC_SAMPLE
+{
+    MZC3_GC_PROFILE_STACK * m_stack;
+    std::size_t             m_count;        // the allocations it stands for
+    std::size_t             m_bytes;        // the bytes it stands for
+};
+
+// the mean bytes between samples, or zero
+static std::size_t s_gc_sample_rate = 0;
+// the stacks sampled (protected by s_gc_profile_lock, a leaf)
+static MZC3_GC_PROFILE_STACK *s_gc_profile[MZC3_GC_PROFILE_BUCKETS];
+static MZC3_GC_LOCK s_gc_profile_lock;
+
+// Returns the return addresses of the current thread, innermost first.
+static std::size_t MZC3_GC_Backtrace(void **frames, std::size_t max)
+{
+    #ifdef _WIN32
+        return CaptureStackBackTrace(0, static_cast<DWORD>(max), frames, NULL);
+    #elif defined(__GLIBC__) || defined(__APPLE__)
+        const int count = backtrace(frames, static_cast<int>(max));
+        return (count > 0 ? count : 0);
+    #else
+        (void)frames;
+        (void)max;
+        return 0;
+    #endif
+}
+
+// Returns the bytes until the next sample of the thread.
+static std::size_t MZC3_GC_NextSample(MZC3_GC_THREAD_ENTRY *thread,
+                                      std::size_t rate)
+{
+    // xorshift, seeded by the entry
+    unsigned x = thread->sample_seed;
+    if (x == 0)
+        x = static_cast<unsigned>(reinterpret_cast<std::size_t>(thread) >> 4) | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    thread->sample_seed = x;
+
+    // exponential distribution
+    const double u = (double(x) + 1.0) / 4294967296.0;
+    const double interval = -std::log(u) * double(rate);
+    if (interval >= double(~std::size_t(0)))
+        return ~std::size_t(0);
+    return static_cast<std::size_t>(interval) + 1;
+}
+
+// Returns the sample of an allocation of size bytes, or NULL if not sampled.
+static MZC3_GC_SAMPLE *MZC3_GC_Sample(MZC3_GC_THREAD_ENTRY *thread,
+                                      std::size_t size)
+{
+    using namespace std;
+    const std::size_t rate = MZC3_GC_LoadCounter(&s_gc_sample_rate);
+    if (rate == 0)
+        return NULL;
+    if (size < thread->sample_left)
+    {
+        thread->sample_left -= size;
+        return NULL;
+    }
+    thread->sample_left = MZC3_GC_NextSample(thread, rate);
+
+    void *frames[MZC3_GC_PROFILE_DEPTH];
+    const std::size_t depth = MZC3_GC_Backtrace(frames, MZC3_GC_PROFILE_DEPTH);
+    std::size_t hash = depth;
+    for (std::size_t i = 0; i < depth; i++)
+        hash = hash * 31 + (reinterpret_cast<std::size_t>(frames[i]) >> 2);
+
+    MZC3_GC_SAMPLE *sample =
+        reinterpret_cast<MZC3_GC_SAMPLE *>(malloc(sizeof(MZC3_GC_SAMPLE)));
+    if (sample == NULL)
+        return NULL;
+    const double p = 1.0 - exp(-double(size ? size : 1) / double(rate));
+    sample->m_count = static_cast<std::size_t>(1.0 / p + 0.5);
+    sample->m_bytes = static_cast<std::size_t>(double(size) / p + 0.5);
+
+    MZC3_GC_Lock(&s_gc_profile_lock);
+    MZC3_GC_PROFILE_STACK **bucket =
+        &s_gc_profile[hash & (MZC3_GC_PROFILE_BUCKETS - 1)];
+    MZC3_GC_PROFILE_STACK *stack = *bucket;
+    for (; stack; stack = stack->m_next)
+    {
+        if (stack->m_hash == hash && stack->m_depth == depth &&
+            memcmp(stack->m_frames, frames, depth * sizeof(void *)) == 0)
+        {
+            break;
+        }
+    }
+    if (stack == NULL)
+    {
+        stack = reinterpret_cast<MZC3_GC_PROFILE_STACK *>(calloc(1,
+            sizeof(MZC3_GC_PROFILE_STACK) + depth * sizeof(void *)));
+        if (stack == NULL)
+        {
+            MZC3_GC_Unlock(&s_gc_profile_lock);
+            free(sample);
+            return NULL;
+        }
+        stack->m_next = *bucket;
+        stack->m_hash = hash;
+        stack->m_depth = depth;
+        memcpy(stack->m_frames, frames, depth * sizeof(void *));
+        *bucket = stack;
+    }
+    stack->m_live_count += sample->m_count;
+    stack->m_live_bytes += sample->m_bytes;
+    stack->m_alloc_count += sample->m_count;
+    stack->m_alloc_bytes += sample->m_bytes;
+    MZC3_GC_Unlock(&s_gc_profile_lock);
+
+    sample->m_stack = stack;
+    return sample;
+}
+
+// Takes the sample of a block freed off the live ones, and frees it.
+// reclaimed is true if freed by the GC.
+static void MZC3_GC_Unsample(MZC3_GC_SAMPLE *sample, bool reclaimed)
+{
+    using namespace std;
+    MZC3_GC_Lock(&s_gc_profile_lock);
+    MZC3_GC_PROFILE_STACK *stack = sample->m_stack;
+    stack->m_live_count -= sample->m_count;
+    stack->m_live_bytes -= sample->m_bytes;
+    if (reclaimed)
+    {
+        stack->m_reclaimed_count += sample->m_count;
+        stack->m_reclaimed_bytes += sample->m_bytes;
+    }
+    MZC3_GC_Unlock(&s_gc_profile_lock);
+
+    free(sample);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_INDEX --- pointer-keyed hash index (open addressing)
+
+struct MZC3_GC_INDEX_SLOT
+{
+    void *      m_key;      // NULL if empty
+    void *      m_value;
+};
+
+struct MZC3_GC_INDEX
+{
+    MZC3_GC_INDEX_SLOT *m_slots;
+    std::size_t         m_count;
+    std::size_t         m_capacity;     // zero or power of two
+};
+
+inline std::size_t MZC3_GC_HashPtr(const void *ptr)
+{
+    std::size_t h = reinterpret_cast<std::size_t>(ptr);
+    h ^= (h >> 4) ^ (h >> 16);
+    h *= 0x45D9F3B;
+    return h ^ (h >> 16);
+}
+
+// Returns the slot of key, or the empty slot where it would be inserted.
+inline MZC3_GC_INDEX_SLOT *MZC3_GC_IndexProbe(MZC3_GC_INDEX *index, const void *key)
+{
+    assert(index->m_capacity);
+    const std::size_t mask = index->m_capacity - 1;
+    std::size_t i = MZC3_GC_HashPtr(key) & mask;
+    while (index->m_slots[i].m_key && index->m_slots[i].m_key != key)
+        i = (i + 1) & mask;
+    return &index->m_slots[i];
+}
+
+static MZC3_GC_INDEX_SLOT *MZC3_GC_IndexFind(MZC3_GC_INDEX *index, const void *key)
+{
+    if (key == NULL || index->m_count == 0)
+        return NULL;
+
+    MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexProbe(index, key);
+    return (slot->m_key ? slot : NULL);
+}
+
+// Makes room for one more key.  Keeps the load factor at most 1/2.
+static bool MZC3_GC_IndexReserve(MZC3_GC_INDEX *index)
+{
+    using namespace std;
+    if ((index->m_count + 1) * 2 <= index->m_capacity)
+        return true;
+
+    std::size_t newcapacity;
+    if (!index->m_capacity)
+        newcapacity = 64;
+    else
+        newcapacity = index->m_capacity * 2;
+
+    MZC3_GC_INDEX_SLOT *newslots = reinterpret_cast<MZC3_GC_INDEX_SLOT *>(
+        calloc(newcapacity, sizeof(MZC3_GC_INDEX_SLOT)));
+    if (newslots == NULL)
+        return false;
+
+    MZC3_GC_INDEX_SLOT *oldslots = index->m_slots;
+    const std::size_t oldcapacity = index->m_capacity;
+    index->m_slots = newslots;
+    index->m_capacity = newcapacity;
+    for (std::size_t i = 0; i < oldcapacity; i++)
+    {
+        if (oldslots[i].m_key)
+            *MZC3_GC_IndexProbe(index, oldslots[i].m_key) = oldslots[i];
+    }
+    free(oldslots);
+    return true;
+}
+
+// The caller must call MZC3_GC_IndexReserve in advance.
+inline void MZC3_GC_IndexInsert(MZC3_GC_INDEX *index, void *key, void *value)
+{
+    assert(key);
+    assert((index->m_count + 1) * 2 <= index->m_capacity);
+    MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexProbe(index, key);
+    if (slot->m_key == NULL)
+        index->m_count++;
+    slot->m_key = key;
+    slot->m_value = value;
+}
+
+// Removes the slot by backward shifting.  No tombstones are left.
+static void MZC3_GC_IndexErase(MZC3_GC_INDEX *index, MZC3_GC_INDEX_SLOT *slot)
+{
+    assert(slot && slot->m_key);
+    const std::size_t mask = index->m_capacity - 1;
+    std::size_t i = static_cast<std::size_t>(slot - index->m_slots);
+    std::size_t j = i;
+    for (;;)
+    {
+        j = (j + 1) & mask;
+        if (index->m_slots[j].m_key == NULL)
+            break;
+
+        // move slot j to the hole i if its home is not in (i, j]
+        const std::size_t home = MZC3_GC_HashPtr(index->m_slots[j].m_key) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            index->m_slots[i] = index->m_slots[j];
+            i = j;
+        }
+    }
+    index->m_slots[i].m_key = NULL;
+    index->m_count--;
+}
+
+static void MZC3_GC_IndexDestroy(MZC3_GC_INDEX *index)
+{
+    using namespace std;
+    free(index->m_slots);
+    index->m_slots = NULL;
+    index->m_count = 0;
+    index->m_capacity = 0;
+}
+
+// Shrinks the index to the load factor of at least 1/8, since it never
+// shrinks otherwise.  Returns the bytes released.
+static std::size_t MZC3_GC_IndexShrink(MZC3_GC_INDEX *index)
+{
+    using namespace std;
+    std::size_t newcapacity = index->m_capacity;
+    while (newcapacity > 64 && index->m_count * 8 < newcapacity)
+        newcapacity /= 2;
+    if (newcapacity == index->m_capacity)
+        return 0;
+
+    MZC3_GC_INDEX_SLOT *newslots = reinterpret_cast<MZC3_GC_INDEX_SLOT *>(
+        calloc(newcapacity, sizeof(MZC3_GC_INDEX_SLOT)));
+    if (newslots == NULL)
+        return 0;
+
+    MZC3_GC_INDEX_SLOT *oldslots = index->m_slots;
+    const std::size_t oldcapacity = index->m_capacity;
+    index->m_slots = newslots;
+    index->m_capacity = newcapacity;
+    for (std::size_t i = 0; i < oldcapacity; i++)
+    {
+        if (oldslots[i].m_key)
+            *MZC3_GC_IndexProbe(index, oldslots[i].m_key) = oldslots[i];
+    }
+    free(oldslots);
+    return (oldcapacity - newcapacity) * sizeof(MZC3_GC_INDEX_SLOT);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_EXTRAS --- the finalizers and the samples of the entries
+//
+// Few entries have them, so an entry has only the flags m_has_finalizer and
+// m_has_sample, and the values are in side tables keyed by the entry and
+// striped like the registry.
+
+typedef void (*MZC3_GC_FINALIZER)(void *);
+
+enum MZC3_GC_EXTRA
+{
+    MZC3_GC_EXTRA_FINALIZER,    // MZC3_GC_FINALIZER
+    MZC3_GC_EXTRA_SAMPLE,       // MZC3_GC_SAMPLE *
+    MZC3_GC_EXTRA_KINDS
+};
+
+struct MZC3_GC_EXTRAS
+{
+    MZC3_GC_LOCK    m_lock;     // a leaf
+    MZC3_GC_INDEX   m_tables[MZC3_GC_EXTRA_KINDS];  // entry --> value
+};
+
+static MZC3_GC_EXTRAS s_gc_extras[MZC3_GC_STRIPES];
+
+// Sets the value of the entry in the table of kind.  Returns false if out
+// of memory.
+static bool MZC3_GC_SetExtra(const MZC3_GC_ENTRY *entry, MZC3_GC_EXTRA kind,
+                             void *value)
+{
+    MZC3_GC_EXTRAS *extras = &s_gc_extras[MZC3_GC_StripeOf(entry)];
+    MZC3_GC_INDEX *table = &extras->m_tables[kind];
+    MZC3_GC_Lock(&extras->m_lock);
+    const bool ok = MZC3_GC_IndexReserve(table);
+    if (ok)
+        MZC3_GC_IndexInsert(table, const_cast<MZC3_GC_ENTRY *>(entry), value);
+    MZC3_GC_Unlock(&extras->m_lock);
+    return ok;
+}
+
+// Returns the value of the entry in the table of kind, or NULL.  If take,
+// it is erased.
+static void *MZC3_GC_GetExtra(const MZC3_GC_ENTRY *entry, MZC3_GC_EXTRA kind,
+                              bool take)
+{
+    MZC3_GC_EXTRAS *extras = &s_gc_extras[MZC3_GC_StripeOf(entry)];
+    MZC3_GC_INDEX *table = &extras->m_tables[kind];
+    MZC3_GC_Lock(&extras->m_lock);
+    MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(table, entry);
+    void *value = (slot ? slot->m_value : NULL);
+    if (slot && take)
+        MZC3_GC_IndexErase(table, slot);
+    MZC3_GC_Unlock(&extras->m_lock);
+    return value;
+}
+
+inline void *MZC3_GC_FinalizerValue(MZC3_GC_FINALIZER finalizer)
+{
+    return reinterpret_cast<void *>(reinterpret_cast<std::size_t>(finalizer));
+}
+
+inline MZC3_GC_FINALIZER MZC3_GC_FinalizerOf(void *value)
+{
+    return reinterpret_cast<MZC3_GC_FINALIZER>(reinterpret_cast<std::size_t>(value));
+}
+
+// Erases the finalizer of the entry, and takes its sample.  Returns the
+// sample, or NULL.
+static MZC3_GC_SAMPLE *MZC3_GC_DropExtras(MZC3_GC_ENTRY *entry)
+{
+    if (entry->m_has_finalizer)
+    {
+        MZC3_GC_GetExtra(entry, MZC3_GC_EXTRA_FINALIZER, true);
+        entry->m_has_finalizer = false;
+    }
+    MZC3_GC_SAMPLE *sample = NULL;
+    if (entry->m_has_sample)
+    {
+        sample = static_cast<MZC3_GC_SAMPLE *>(
+            MZC3_GC_GetExtra(entry, MZC3_GC_EXTRA_SAMPLE, true));
+        entry->m_has_sample = false;
+    }
+    return sample;
+}
+
+// Shrinks the side tables.  Returns the bytes released.
+static std::size_t MZC3_GC_ExtrasShrink(void)
+{
+    std::size_t released = 0;
+    for (std::size_t i = 0; i < MZC3_GC_STRIPES; i++)
+    {
+        MZC3_GC_EXTRAS *extras = &s_gc_extras[i];
+        MZC3_GC_Lock(&extras->m_lock);
+        for (int kind = 0; kind < MZC3_GC_EXTRA_KINDS; kind++)
+            released += MZC3_GC_IndexShrink(&extras->m_tables[kind]);
+        MZC3_GC_Unlock(&extras->m_lock);
+    }
+    return released;
+}
+
+#ifdef _DEBUG
+    //////////////////////////////////////////////////////////////////////////
+    // MZC3_GC_SITE --- a call site, interned to a 32-bit id
+    //
+    // The sites are stored in segments that never move, so that the site
+    // of an id is read without locking.  Id 0 is the unknown site.  The
+    // sites are kept until exit, since blocks may outlive the GC.
+
+    struct MZC3_GC_SITE
+    {
+        const char *m_file;
+        int         m_line;
+    };
+
+    static const std::size_t MZC3_GC_SITE_SEGMENT = 1024;
+    static const std::size_t MZC3_GC_SITE_SEGMENTS = 4096;
+
+    static MZC3_GC_SITE *s_gc_site_segments[MZC3_GC_SITE_SEGMENTS];
+    static std::size_t s_gc_site_count = 0;
+    // (file, line) --> id by open addressing (protected by s_gc_site_lock,
+    // a leaf)
+    static unsigned *s_gc_site_table = NULL;
+    static std::size_t s_gc_site_capacity = 0;     // zero or power of two
+    static MZC3_GC_LOCK s_gc_site_lock;
+
+    inline const MZC3_GC_SITE *MZC3_GC_SiteOf(unsigned id)
+    {
+        static const MZC3_GC_SITE unknown = {"(unknown)", 0};
+        if (id == 0)
+            return &unknown;
+        return &s_gc_site_segments[(id - 1) / MZC3_GC_SITE_SEGMENT]
+                                  [(id - 1) % MZC3_GC_SITE_SEGMENT];
+    }
+
+    inline std::size_t MZC3_GC_SiteHash(const char *file, int line)
+    {
+        return MZC3_GC_HashPtr(file) ^ (static_cast<std::size_t>(line) * 0x9E3779B1);
+    }
+
+    // Returns the slot of (file, line) in the table, or the empty slot.
+    static unsigned *MZC3_GC_SiteProbe(const char *file, int line)
+    {
+        const std::size_t mask = s_gc_site_capacity - 1;
+        std::size_t i = MZC3_GC_SiteHash(file, line) & mask;
+        for (;;)
+        {
+            unsigned *slot = &s_gc_site_table[i];
+            if (*slot == 0)
+                return slot;
+            const MZC3_GC_SITE *site = MZC3_GC_SiteOf(*slot);
+            if (site->m_file == file && site->m_line == line)
+                return slot;
+            i = (i + 1) & mask;
+        }
+    }
+
+    // Adds an empty slot for a new site.  Needs s_gc_site_lock.
+    static bool MZC3_GC_SiteReserve(void)
+    {
+        using namespace std;
+        if ((s_gc_site_count + 1) * 2 <= s_gc_site_capacity)
+            return true;
+
+        const std::size_t capacity = (s_gc_site_capacity ? s_gc_site_capacity * 2 : 256);
+        unsigned *table = reinterpret_cast<unsigned *>(calloc(capacity, sizeof(unsigned)));
+        if (table == NULL)
+            return false;
+        unsigned *oldtable = s_gc_site_table;
+        const std::size_t oldcapacity = s_gc_site_capacity;
+        s_gc_site_table = table;
+        s_gc_site_capacity = capacity;
+        for (std::size_t i = 0; i < oldcapacity; i++)
+        {
+            if (oldtable[i])
+            {
+                const MZC3_GC_SITE *site = MZC3_GC_SiteOf(oldtable[i]);
+                *MZC3_GC_SiteProbe(site->m_file, site->m_line) = oldtable[i];
+            }
+        }
+        free(oldtable);
+        return true;
+    }
+
+    // Returns the id of the call site, or zero if out of memory.  The
+    // cache of the thread saves locking for a repeated site.
+    static unsigned MZC3_GC_InternSite(MZC3_GC_THREAD_ENTRY *thread,
+                                       const char *file, int line)
+    {
+        using namespace std;
+        const std::size_t hash = MZC3_GC_SiteHash(file, line);
+        unsigned *cached = NULL;
+        if (thread)
+        {
+            cached = &thread->site_cache[hash % (sizeof(thread->site_cache) /
+                                                 sizeof(thread->site_cache[0]))];
+            const MZC3_GC_SITE *site = MZC3_GC_SiteOf(*cached);
+            if (*cached && site->m_file == file && site->m_line == line)
+                return *cached;
+        }
+
+        MZC3_GC_Lock(&s_gc_site_lock);
+        unsigned id = 0;
+        if (MZC3_GC_SiteReserve())
+        {
+            unsigned *slot = MZC3_GC_SiteProbe(file, line);
+            if (*slot == 0 &&
+                s_gc_site_count < MZC3_GC_SITE_SEGMENT * MZC3_GC_SITE_SEGMENTS)
+            {
+                const std::size_t segment = s_gc_site_count / MZC3_GC_SITE_SEGMENT;
+                if (s_gc_site_segments[segment] == NULL)
+                {
+                    s_gc_site_segments[segment] = reinterpret_cast<MZC3_GC_SITE *>(
+                        malloc(MZC3_GC_SITE_SEGMENT * sizeof(MZC3_GC_SITE)));
+                }
+                if (s_gc_site_segments[segment])
+                {
+                    MZC3_GC_SITE *site = &s_gc_site_segments[segment]
+                        [s_gc_site_count % MZC3_GC_SITE_SEGMENT];
+                    site->m_file = file;
+                    site->m_line = line;
+                    *slot = static_cast<unsigned>(++s_gc_site_count);
+                }
+            }
+            id = *slot;
+        }
+        MZC3_GC_Unlock(&s_gc_site_lock);
+
+        if (cached && id)
+            *cached = id;
+        return id;
+    }
+#endif  // def _DEBUG
+
+static bool MZC3_GC_CheckBudget(MZC3_GC_THREAD_ENTRY *thread, std::size_t size);
+static void *MZC3_GC_MapPages(std::size_t length);
+static void MZC3_GC_UnmapPages(void *ptr, std::size_t length);
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_ARENA_CHUNK --- bump-pointer chunk of an arena section
+
+// The alignment of the blocks in arena chunks.
+static const std::size_t MZC3_GC_ALIGNMENT = 16;
+// The alignment of the blocks from malloc.  A block of larger alignment is
+// padded (see mzcaligned_alloc).
+static const std::size_t MZC3_GC_MIN_ALIGNMENT = 2 * sizeof(void *);
+
+// Arena chunks are mapped pages aligned to and sized by the multiple of this
+// value, the allocation granularity of Windows.
+static const std::size_t MZC3_GC_ARENA_GRANULE = 0x10000;
+
+static const std::size_t MZC3_GC_ARENA_DEFAULT_CHUNK_SIZE = 0x10000;
+
+struct MZC3_GC_ARENA_CHUNK
+{
+    MZC3_GC_ARENA_CHUNK *m_next;
+    MZC3_GC_STATE *      m_state;   // the owner
+    char *               m_end;     // the end of the mapping
+};
+
+// MZC3_GC_ARENA_NODE --- a node of the arena map, a radix tree from the
+// granule number to the chunk.  The root has the upper bits, and covers
+// 2^48 bytes; its children have the middle 10 bits, and theirs (the leaves)
+// have the lower 10 bits.  The nodes are published by MZC3_GC_StorePtr
+// under s_gc_arena_lock and live until the manager ends, so that
+// MZC3_GC_ArenaFind walks them without locking.
+static const unsigned MZC3_GC_ARENA_NODE_BITS = 10;
+static const std::size_t MZC3_GC_ARENA_NODE_SLOTS =
+    std::size_t(1) << MZC3_GC_ARENA_NODE_BITS;
+static const std::size_t MZC3_GC_ARENA_ROOT_SLOTS = 0x1000;
+
+struct MZC3_GC_ARENA_NODE
+{
+    void *m_slots[MZC3_GC_ARENA_NODE_SLOTS];    // nodes, or chunks in leaves
+};
+
+static void *s_gc_arena_map[MZC3_GC_ARENA_ROOT_SLOTS];
+static MZC3_GC_LOCK s_gc_arena_lock;
+// the number of the granules in the arena map, read without locking
+static std::size_t s_gc_arena_span_count = 0;
+
+inline std::size_t MZC3_GC_RoundUp(std::size_t size, std::size_t unit)
+{
+    return (size + unit - 1) & ~(unit - 1);
+}
+
+inline bool MZC3_GC_IsAlignment(std::size_t align)
+{
+    return (align && (align & (align - 1)) == 0);
+}
+
+// The padding that a block needs to be aligned to align.
+inline std::size_t MZC3_GC_AlignPad(std::size_t align)
+{
+    return (align > MZC3_GC_MIN_ALIGNMENT ? align - MZC3_GC_MIN_ALIGNMENT : 0);
+}
+
+inline char *MZC3_GC_AlignUp(void *ptr, std::size_t align)
+{
+    return reinterpret_cast<char *>(
+        MZC3_GC_RoundUp(reinterpret_cast<std::size_t>(ptr), align));
+}
+
+inline char *MZC3_GC_ArenaData(MZC3_GC_ARENA_CHUNK *chunk)
+{
+    return reinterpret_cast<char *>(chunk) +
+           MZC3_GC_RoundUp(sizeof(MZC3_GC_ARENA_CHUNK), MZC3_GC_ALIGNMENT);
+}
+
+// Returns the slot of the arena map for the granule of ptr, or NULL if it
+// is beyond the map or not mapped yet.  If create, the missing nodes are
+// made under s_gc_arena_lock, and NULL means out of memory.
+static void **MZC3_GC_ArenaSlot(const void *ptr, bool create)
+{
+    using namespace std;
+    const std::size_t granule =
+        reinterpret_cast<std::size_t>(ptr) / MZC3_GC_ARENA_GRANULE;
+    const std::size_t root = granule >> (2 * MZC3_GC_ARENA_NODE_BITS);
+    if (root >= MZC3_GC_ARENA_ROOT_SLOTS)
+        return NULL;
+
+    void **pnode = &s_gc_arena_map[root];
+    for (unsigned shift = MZC3_GC_ARENA_NODE_BITS;; shift -= MZC3_GC_ARENA_NODE_BITS)
+    {
+        MZC3_GC_ARENA_NODE *node =
+            static_cast<MZC3_GC_ARENA_NODE *>(MZC3_GC_LoadPtr(pnode));
+        if (node == NULL)
+        {
+            if (!create)
+                return NULL;
+            node = static_cast<MZC3_GC_ARENA_NODE *>(
+                calloc(1, sizeof(MZC3_GC_ARENA_NODE)));
+            if (node == NULL)
+                return NULL;
+            MZC3_GC_StorePtr(pnode, static_cast<void *>(node));
+        }
+        void **slot =
+            &node->m_slots[(granule >> shift) & (MZC3_GC_ARENA_NODE_SLOTS - 1)];
+        if (shift == 0)
+            return slot;
+        pnode = slot;
+    }
+}
+
+// Returns the arena chunk containing ptr, or NULL.
+static MZC3_GC_ARENA_CHUNK *MZC3_GC_ArenaFind(const void *ptr)
+{
+    // No walk for the common case of no arena.  A chunk holding ptr was
+    // registered before ptr was handed out.
+    if (MZC3_GC_LoadCounter(&s_gc_arena_span_count) == 0)
+        return NULL;
+
+    #if defined(MZC3_GC_MT) && !defined(MZC3_GC_ATOMIC_PTR)
+        MZC3_GC_Lock(&s_gc_arena_lock);
+    #endif
+    void **slot = MZC3_GC_ArenaSlot(ptr, false);
+    MZC3_GC_ARENA_CHUNK *chunk =
+        (slot ? static_cast<MZC3_GC_ARENA_CHUNK *>(MZC3_GC_LoadPtr(slot)) : NULL);
+    #if defined(MZC3_GC_MT) && !defined(MZC3_GC_ATOMIC_PTR)
+        MZC3_GC_Unlock(&s_gc_arena_lock);
+    #endif
+
+    // A chunk has its granules whole, so only its header is not data.
+    if (chunk && MZC3_GC_ArenaData(chunk) <= static_cast<const char *>(ptr))
+        return chunk;
+    return NULL;
+}
+
+// Unregisters the granules of the chunk below end.  Needs s_gc_arena_lock.
+static void MZC3_GC_ArenaUnregister(MZC3_GC_ARENA_CHUNK *chunk, const char *end)
+{
+    std::size_t count = s_gc_arena_span_count;
+    for (const char *p = reinterpret_cast<char *>(chunk); p < end;
+         p += MZC3_GC_ARENA_GRANULE)
+    {
+        void **slot = MZC3_GC_ArenaSlot(p, false);
+        if (slot && *slot == chunk)
+        {
+            MZC3_GC_StorePtr(slot, static_cast<void *>(NULL));
+            count--;
+        }
+    }
+    MZC3_GC_StoreCounter(&s_gc_arena_span_count, count);
+}
+
+// Unregisters and unmaps the chunk.
+static void MZC3_GC_ArenaFreeChunk(MZC3_GC_ARENA_CHUNK *chunk)
+{
+    char *end = chunk->m_end;
+    MZC3_GC_Lock(&s_gc_arena_lock);
+    MZC3_GC_ArenaUnregister(chunk, end);
+    MZC3_GC_Unlock(&s_gc_arena_lock);
+    MZC3_GC_UnmapPages(chunk, end - reinterpret_cast<char *>(chunk));
+}
+
+// Frees the nodes of the arena map.  Needs s_gc_arena_lock, and no reader.
+static void MZC3_GC_ArenaFreeMap(void)
+{
+    using namespace std;
+    for (std::size_t i = 0; i < MZC3_GC_ARENA_ROOT_SLOTS; i++)
+    {
+        MZC3_GC_ARENA_NODE *node = static_cast<MZC3_GC_ARENA_NODE *>(s_gc_arena_map[i]);
+        if (node == NULL)
+            continue;
+        for (std::size_t j = 0; j < MZC3_GC_ARENA_NODE_SLOTS; j++)
+            free(node->m_slots[j]);
+        free(node);
+        s_gc_arena_map[i] = NULL;
+    }
+}
+
+// Maps size bytes, a multiple of MZC3_GC_ARENA_GRANULE, aligned to
+// MZC3_GC_ARENA_GRANULE.  Returns NULL on failure.
+static void *MZC3_GC_ArenaMapChunk(std::size_t size)
+{
+    #ifdef _WIN32
+        // VirtualAlloc aligns to the allocation granularity.  If it is
+        // smaller, an aligned address is found in a larger reservation.
+        void *ptr = MZC3_GC_MapPages(size);
+        if (ptr == NULL || MZC3_GC_AlignUp(ptr, MZC3_GC_ARENA_GRANULE) == ptr)
+            return ptr;
+        MZC3_GC_UnmapPages(ptr, size);
+        for (int retry = 0; retry < 8; retry++)
+        {
+            void *raw = VirtualAlloc(NULL, size + MZC3_GC_ARENA_GRANULE,
+                                     MEM_RESERVE, PAGE_NOACCESS);
+            if (raw == NULL)
+                return NULL;
+            char *aligned = MZC3_GC_AlignUp(raw, MZC3_GC_ARENA_GRANULE);
+            VirtualFree(raw, 0, MEM_RELEASE);
+            ptr = VirtualAlloc(aligned, size, MEM_RESERVE | MEM_COMMIT,
+                               PAGE_READWRITE);
+            if (ptr)
+                return ptr;
+        }
+        return NULL;
+    #else
+        // Maps a granule more, and unmaps the excess at both ends.
+        char *raw = static_cast<char *>(
+            MZC3_GC_MapPages(size + MZC3_GC_ARENA_GRANULE));
+        if (raw == NULL)
+            return NULL;
+        char *ptr = MZC3_GC_AlignUp(raw, MZC3_GC_ARENA_GRANULE);
+        const std::size_t head = ptr - raw;
+        if (head)
+            MZC3_GC_UnmapPages(raw, head);
+        if (head != MZC3_GC_ARENA_GRANULE)
+            MZC3_GC_UnmapPages(ptr + size, MZC3_GC_ARENA_GRANULE - head);
+        return ptr;
+    #endif
+}
+
+// Allocates a chunk whose data area can hold size bytes, and makes it
+// current.
+static bool MZC3_GC_ArenaAddChunk(MZC3_GC_STATE *state, std::size_t size)
+{
+    using namespace std;
+    const std::size_t header =
+        MZC3_GC_RoundUp(sizeof(MZC3_GC_ARENA_CHUNK), MZC3_GC_ALIGNMENT);
+    std::size_t chunk_size = (state->arena_chunk_size ? state->arena_chunk_size
+                                                      : MZC3_GC_ARENA_DEFAULT_CHUNK_SIZE);
+    if (chunk_size - header < size)
+    {
+        if (size > ~std::size_t(0) - header - 2 * MZC3_GC_ARENA_GRANULE)
+            return false;
+        chunk_size = header + size;
+    }
+    chunk_size = MZC3_GC_RoundUp(chunk_size, MZC3_GC_ARENA_GRANULE);
+    if (!MZC3_GC_CheckBudget(state->owner, chunk_size))
+        return false;
+
+    MZC3_GC_ARENA_CHUNK *chunk =
+        static_cast<MZC3_GC_ARENA_CHUNK *>(MZC3_GC_ArenaMapChunk(chunk_size));
+    if (chunk == NULL)
+        return false;
+    chunk->m_state = state;
+    chunk->m_end = reinterpret_cast<char *>(chunk) + chunk_size;
+
+    MZC3_GC_Lock(&s_gc_arena_lock);
+    for (const char *p = reinterpret_cast<char *>(chunk); p < chunk->m_end;
+         p += MZC3_GC_ARENA_GRANULE)
+    {
+        void **slot = MZC3_GC_ArenaSlot(p, true);
+        if (slot == NULL)
+        {
+            MZC3_GC_ArenaUnregister(chunk, p);
+            MZC3_GC_Unlock(&s_gc_arena_lock);
+            MZC3_GC_UnmapPages(chunk, chunk_size);
+            return false;
+        }
+        MZC3_GC_StorePtr(slot, static_cast<void *>(chunk));
+        MZC3_GC_StoreCounter(&s_gc_arena_span_count, s_gc_arena_span_count + 1);
+    }
+    MZC3_GC_Unlock(&s_gc_arena_lock);
+
+    chunk->m_next = state->arena_chunks;
+    state->arena_chunks = chunk;
+    state->arena_ptr = MZC3_GC_ArenaData(chunk);
+    state->arena_last = NULL;
+    state->arena_bytes += chunk_size;
+    state->busy = 1;
+    MZC3_GC_CountIn(&state->owner->counters, chunk_size, 0);
+    return true;
+}
+
+// Bump-allocates size bytes from the arena chunks of the section.  Any
+// section has them for MzcGC_SectionAlloc, but only an arena section
+// allocates its blocks from them.
+static void *MZC3_GC_ArenaAlloc(MZC3_GC_STATE *state, std::size_t size)
+{
+    if (size > ~std::size_t(0) - MZC3_GC_ALIGNMENT)
+        return NULL;
+    size = MZC3_GC_RoundUp(size ? size : 1, MZC3_GC_ALIGNMENT);
+
+    if (state->arena_chunks == NULL ||
+        static_cast<std::size_t>(state->arena_chunks->m_end - state->arena_ptr) < size)
+    {
+        if (!MZC3_GC_ArenaAddChunk(state, size))
+            return NULL;
+    }
+
+    char *ptr = state->arena_ptr;
+    state->arena_ptr += size;
+    state->arena_last = ptr;
+    return ptr;
+}
+
+// MZC3_GC_ArenaAlloc aligned to align, a power of two.
+static void *MZC3_GC_ArenaAllocAligned(MZC3_GC_STATE *state, std::size_t size,
+                                       std::size_t align)
+{
+    const std::size_t pad =
+        (align > MZC3_GC_ALIGNMENT ? align - MZC3_GC_ALIGNMENT : 0);
+    if (size > ~std::size_t(0) - pad)
+        return NULL;
+    char *ptr = static_cast<char *>(MZC3_GC_ArenaAlloc(state, size + pad));
+    if (ptr && pad)
+    {
+        // The padding is lost, but the block is still the most recent.
+        ptr = MZC3_GC_AlignUp(ptr, align);
+        state->arena_last = ptr;
+    }
+    return ptr;
+}
+
+// The bump pointer of an arena belongs to the thread of the section.
+// Other threads must not touch it.
+inline bool MZC3_GC_ArenaIsMine(MZC3_GC_ARENA_CHUNK *chunk)
+{
+    return (chunk->m_state->owner == MZC3_GC_GetThreadEntry());
+}
+
+// Freeing a block in an arena is no-op, except the most recent block
+// is given back to the bump pointer.  Needs MZC3_GC_ArenaIsMine.
+inline void MZC3_GC_ArenaFree(MZC3_GC_ARENA_CHUNK *chunk, void *ptr)
+{
+    MZC3_GC_STATE *state = chunk->m_state;
+    if (ptr == state->arena_last)
+    {
+        state->arena_ptr = state->arena_last;
+        state->arena_last = NULL;
+    }
+}
+
+// The most recent block grows or shrinks in place.  Needs
+// MZC3_GC_ArenaIsMine.
+static void *MZC3_GC_ArenaRealloc(MZC3_GC_ARENA_CHUNK *chunk, void *ptr, std::size_t size)
+{
+    using namespace std;
+    MZC3_GC_STATE *state = chunk->m_state;
+    char *p = static_cast<char *>(ptr);
+    if (size == 0)
+    {
+        MZC3_GC_ArenaFree(chunk, ptr);
+        return NULL;
+    }
+
+    if (p == state->arena_last && size <= ~std::size_t(0) - MZC3_GC_ALIGNMENT)
+    {
+        const std::size_t newsize = MZC3_GC_RoundUp(size, MZC3_GC_ALIGNMENT);
+        if (static_cast<std::size_t>(chunk->m_end - p) >= newsize)
+        {
+            state->arena_ptr = p + newsize;
+            return ptr;
+        }
+    }
+
+    // The old size is unknown, but the blocks after it are in the same
+    // chunk.  Copying up to the used end of the chunk is safe.
+    const char *used_end = (chunk == state->arena_chunks ? state->arena_ptr
+                                                         : chunk->m_end);
+    std::size_t count = static_cast<std::size_t>(used_end - p);
+    if (count > size)
+        count = size;
+
+    void *newptr = MZC3_GC_ArenaAlloc(state, size);
+    if (newptr)
+        memmove(newptr, ptr, count);
+    return newptr;
+}
+
+// Frees the chunks, and counts them into c.
+static void MZC3_GC_ArenaFreeChunks(MZC3_GC_ARENA_CHUNK *chunk,
+                                    MZC3_GC_COUNTERS *c)
+{
+    while (chunk)
+    {
+        MZC3_GC_ARENA_CHUNK *next = chunk->m_next;
+        const std::size_t size = chunk->m_end - reinterpret_cast<char *>(chunk);
+        MZC3_GC_ArenaFreeChunk(chunk);
+        if (c)
+        {
+            MZC3_GC_CountOut(c, size, 0);
+            MZC3_GC_AddCounter(&c->reclaimed_bytes, size);
+        }
+        chunk = next;
+    }
+}
+
+// Frees all the chunks of the arena section.
+static void MZC3_GC_ArenaRelease(MZC3_GC_STATE *state)
+{
+    MZC3_GC_ARENA_CHUNK *chunk = state->arena_chunks;
+    state->arena_chunks = NULL;
+    state->arena_ptr = NULL;
+    state->arena_last = NULL;
+    state->arena_bytes = 0;
+    MZC3_GC_ArenaFreeChunks(chunk, &state->owner->counters);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_SLAB --- size-class slab allocator for tracked blocks
+
+static const std::size_t MZC3_GC_SLAB_SIZE = 0x1000;     // a page
+static const std::size_t MZC3_GC_SLAB_MAX = 256;         // the largest class
+static const std::size_t MZC3_GC_SLAB_CLASSES = MZC3_GC_SLAB_MAX / MZC3_GC_ALIGNMENT;
+static const std::size_t MZC3_GC_SLAB_PAGES = 16;        // pages per allocation
+
+// A slab is a page of the blocks of one size class.  The header is at the
+// top of the page.
+struct MZC3_GC_SLAB
+{
+    MZC3_GC_SLAB *  m_prev;     // links in s_gc_slab_partial[m_class]
+    MZC3_GC_SLAB *  m_next;     // or in the lists of m_owner
+    void *          m_free;     // the freed blocks
+    char *          m_bump;     // the blocks never used start here
+    std::size_t     m_class;
+    std::size_t     m_live;     // the number of the blocks in use
+    #ifdef MZC3_GC_THREAD_CACHE
+        MZC3_GC_SLAB_CACHE *m_owner;    // NULL if shared
+    #endif
+};
+
+// The slabs that have free blocks (protected by s_gc_slab_locks)
+static MZC3_GC_SLAB *s_gc_slab_partial[MZC3_GC_SLAB_CLASSES];
+static MZC3_GC_LOCK s_gc_slab_locks[MZC3_GC_SLAB_CLASSES];
+// The empty slabs, linked by m_next (protected by s_gc_slab_pages_lock)
+static MZC3_GC_SLAB *s_gc_slab_empty = NULL;
+// The pages not carved yet (protected by s_gc_slab_pages_lock)
+static char *s_gc_slab_pages = NULL;
+static char *s_gc_slab_pages_end = NULL;
+static MZC3_GC_LOCK s_gc_slab_pages_lock;
+// The empty slabs given back to the OS (protected by s_gc_slab_pages_lock).
+// They cannot link themselves, since their headers are gone.
+static MZC3_GC_SLAB **s_gc_slab_trimmed = NULL;
+static std::size_t s_gc_slab_trimmed_count = 0;
+static std::size_t s_gc_slab_trimmed_capacity = 0;
+
+inline std::size_t MZC3_GC_SlabClass(std::size_t size)
+{
+    return (size ? (size - 1) / MZC3_GC_ALIGNMENT : 0);
+}
+
+inline std::size_t MZC3_GC_SlabClassSize(std::size_t cls)
+{
+    return (cls + 1) * MZC3_GC_ALIGNMENT;
+}
+
+inline MZC3_GC_SLAB *MZC3_GC_SlabOf(void *ptr)
+{
+    return reinterpret_cast<MZC3_GC_SLAB *>(
+        reinterpret_cast<std::size_t>(ptr) & ~(MZC3_GC_SLAB_SIZE - 1));
+}
+
+inline bool MZC3_GC_SlabIsFull(MZC3_GC_SLAB *slab)
+{
+    const char *end = reinterpret_cast<char *>(slab) + MZC3_GC_SLAB_SIZE;
+    return (slab->m_free == NULL &&
+            slab->m_bump + MZC3_GC_SlabClassSize(slab->m_class) > end);
+}
+
+inline void MZC3_GC_SlabLinkTo(MZC3_GC_SLAB **head, MZC3_GC_SLAB *slab)
+{
+    slab->m_prev = NULL;
+    slab->m_next = *head;
+    if (*head)
+        (*head)->m_prev = slab;
+    *head = slab;
+}
+
+inline void MZC3_GC_SlabUnlinkFrom(MZC3_GC_SLAB **head, MZC3_GC_SLAB *slab)
+{
+    if (slab->m_prev)
+        slab->m_prev->m_next = slab->m_next;
+    else
+        *head = slab->m_next;
+    if (slab->m_next)
+        slab->m_next->m_prev = slab->m_prev;
+}
+
+inline void MZC3_GC_SlabLink(MZC3_GC_SLAB *slab)
+{
+    MZC3_GC_SlabLinkTo(&s_gc_slab_partial[slab->m_class], slab);
+}
+
+inline void MZC3_GC_SlabUnlink(MZC3_GC_SLAB *slab)
+{
+    MZC3_GC_SlabUnlinkFrom(&s_gc_slab_partial[slab->m_class], slab);
+}
+
+// Gets an empty slab for the class, linked nowhere.
+static MZC3_GC_SLAB *MZC3_GC_SlabPage(std::size_t cls)
+{
+    using namespace std;
+    MZC3_GC_Lock(&s_gc_slab_pages_lock);
+    MZC3_GC_SLAB *slab = s_gc_slab_empty;
+    if (slab)
+    {
+        s_gc_slab_empty = slab->m_next;
+    }
+    else if (s_gc_slab_trimmed_count)
+    {
+        slab = s_gc_slab_trimmed[--s_gc_slab_trimmed_count];
+    }
+    else
+    {
+        if (s_gc_slab_pages == s_gc_slab_pages_end)
+        {
+            // NOTE: The slab pages are kept until the process ends.
+            void *raw = malloc((MZC3_GC_SLAB_PAGES + 1) * MZC3_GC_SLAB_SIZE);
+            if (raw == NULL)
+            {
+                MZC3_GC_Unlock(&s_gc_slab_pages_lock);
+                return NULL;
+            }
+            s_gc_slab_pages = reinterpret_cast<char *>(
+                MZC3_GC_RoundUp(reinterpret_cast<std::size_t>(raw), MZC3_GC_SLAB_SIZE));
+            s_gc_slab_pages_end = s_gc_slab_pages + MZC3_GC_SLAB_PAGES * MZC3_GC_SLAB_SIZE;
+        }
+        slab = reinterpret_cast<MZC3_GC_SLAB *>(s_gc_slab_pages);
+        s_gc_slab_pages += MZC3_GC_SLAB_SIZE;
+    }
+    MZC3_GC_Unlock(&s_gc_slab_pages_lock);
+
+    slab->m_free = NULL;
+    slab->m_bump = reinterpret_cast<char *>(slab) +
+                   MZC3_GC_RoundUp(sizeof(MZC3_GC_SLAB), MZC3_GC_ALIGNMENT);
+    slab->m_class = cls;
+    slab->m_live = 0;
+    #ifdef MZC3_GC_THREAD_CACHE
+        slab->m_owner = NULL;
+    #endif
+    return slab;
+}
+
+// Gives back an empty slab linked nowhere.
+static void MZC3_GC_SlabRetire(MZC3_GC_SLAB *slab)
+{
+    MZC3_GC_Lock(&s_gc_slab_pages_lock);
+    slab->m_next = s_gc_slab_empty;
+    s_gc_slab_empty = slab;
+    MZC3_GC_Unlock(&s_gc_slab_pages_lock);
+}
+
+// Takes a block from the slab, which must not be full.
+inline void *MZC3_GC_SlabTake(MZC3_GC_SLAB *slab)
+{
+    void *ptr = slab->m_free;
+    if (ptr)
+    {
+        slab->m_free = *reinterpret_cast<void **>(ptr);
+    }
+    else
+    {
+        ptr = slab->m_bump;
+        slab->m_bump += MZC3_GC_SlabClassSize(slab->m_class);
+    }
+    slab->m_live++;
+    return ptr;
+}
+
+// Puts a block back into its slab.
+inline void MZC3_GC_SlabPut(MZC3_GC_SLAB *slab, void *ptr)
+{
+    assert(slab->m_live);
+    *reinterpret_cast<void **>(ptr) = slab->m_free;
+    slab->m_free = ptr;
+    slab->m_live--;
+}
+
+// The shared slabs.  Used by the threads without caches.
+static void *MZC3_GC_SlabAllocShared(std::size_t cls)
+{
+    assert(cls < MZC3_GC_SLAB_CLASSES);
+    MZC3_GC_Lock(&s_gc_slab_locks[cls]);
+    MZC3_GC_SLAB *slab = s_gc_slab_partial[cls];
+    if (slab == NULL)
+    {
+        slab = MZC3_GC_SlabPage(cls);
+        if (slab == NULL)
+        {
+            MZC3_GC_Unlock(&s_gc_slab_locks[cls]);
+            return NULL;
+        }
+        MZC3_GC_SlabLink(slab);
+    }
+
+    void *ptr = MZC3_GC_SlabTake(slab);
+    if (MZC3_GC_SlabIsFull(slab))
+        MZC3_GC_SlabUnlink(slab);
+    MZC3_GC_Unlock(&s_gc_slab_locks[cls]);
+    return ptr;
+}
+
+static void MZC3_GC_SlabFreeShared(MZC3_GC_SLAB *slab, void *ptr);
+
+#ifdef MZC3_GC_THREAD_CACHE
+    // MZC3_GC_SLAB_CACHE --- the slabs owned by a thread
+    //
+    // The owner thread allocates from and frees into its slabs without
+    // locking.  Another thread pushes the blocks it frees onto m_remote,
+    // and the owner takes them all at once on its next allocation or
+    // MzcGC_Leave.  A cache is never freed, but reused by the next thread,
+    // since the other threads may push onto it after its thread exits.
+    struct MZC3_GC_SLAB_CACHE
+    {
+        MZC3_GC_SLAB *      m_partial[MZC3_GC_SLAB_CLASSES];
+        MZC3_GC_SLAB *      m_full;
+        void *              m_remote;   // linked by the first word
+        MZC3_GC_SLAB_CACHE *m_next;     // in s_gc_spare_caches
+    };
+
+    // the cache of the current thread, or NULL
+    static MZC3_GC_TLS MZC3_GC_SLAB_CACHE *s_gc_slab_cache = NULL;
+    // the caches of the exited threads (protected by s_gc_slab_pages_lock)
+    static MZC3_GC_SLAB_CACHE *s_gc_spare_caches = NULL;
+
+    // Frees a block of a slab of the current thread.
+    inline void MZC3_GC_SlabFreeLocal(MZC3_GC_SLAB_CACHE *cache,
+                                      MZC3_GC_SLAB *slab, void *ptr)
+    {
+        MZC3_GC_SLAB **partial = &cache->m_partial[slab->m_class];
+        if (MZC3_GC_SlabIsFull(slab))
+        {
+            MZC3_GC_SlabUnlinkFrom(&cache->m_full, slab);
+            MZC3_GC_SlabLinkTo(partial, slab);
+        }
+        MZC3_GC_SlabPut(slab, ptr);
+
+        // An empty slab is kept only if the last one of the class.
+        if (slab->m_live == 0 && (slab->m_prev || slab->m_next))
+        {
+            MZC3_GC_SlabUnlinkFrom(partial, slab);
+            MZC3_GC_StorePtr(&slab->m_owner, static_cast<MZC3_GC_SLAB_CACHE *>(NULL));
+            MZC3_GC_SlabRetire(slab);
+        }
+    }
+
+    // Pushes a block onto the remote-free queue of its owner.
+    inline void MZC3_GC_SlabFreeRemote(MZC3_GC_SLAB_CACHE *owner, void *ptr)
+    {
+        void *head;
+        do
+        {
+            head = MZC3_GC_LoadPtr(&owner->m_remote);
+            *reinterpret_cast<void **>(ptr) = head;
+        } while (!MZC3_GC_CasPtr(&owner->m_remote, head, ptr));
+    }
+
+    // Frees the blocks that other threads have freed into the cache.
+    static void MZC3_GC_SlabCacheDrain(MZC3_GC_SLAB_CACHE *cache)
+    {
+        void *ptr = MZC3_GC_ExchangePtr(&cache->m_remote, NULL);
+        while (ptr)
+        {
+            void *next = *reinterpret_cast<void **>(ptr);
+            MZC3_GC_SLAB *slab = MZC3_GC_SlabOf(ptr);
+            MZC3_GC_SLAB_CACHE *owner = MZC3_GC_LoadPtr(&slab->m_owner);
+            if (owner == cache)
+                MZC3_GC_SlabFreeLocal(cache, slab, ptr);
+            else if (owner)
+                MZC3_GC_SlabFreeRemote(owner, ptr);    // the slab moved
+            else
+                MZC3_GC_SlabFreeShared(slab, ptr);
+            ptr = next;
+        }
+    }
+
+    static MZC3_GC_SLAB_CACHE *MZC3_GC_SlabCacheAcquire(void)
+    {
+        using namespace std;
+        MZC3_GC_Lock(&s_gc_slab_pages_lock);
+        MZC3_GC_SLAB_CACHE *cache = s_gc_spare_caches;
+        if (cache)
+            s_gc_spare_caches = cache->m_next;
+        MZC3_GC_Unlock(&s_gc_slab_pages_lock);
+
+        if (cache == NULL)
+        {
+            cache = reinterpret_cast<MZC3_GC_SLAB_CACHE *>(
+                calloc(1, sizeof(MZC3_GC_SLAB_CACHE)));
+        }
+        s_gc_slab_cache = cache;
+        return cache;
+    }
+
+    // Makes the slab shared.
+    static void MZC3_GC_SlabDisown(MZC3_GC_SLAB *slab)
+    {
+        const std::size_t cls = slab->m_class;
+        MZC3_GC_Lock(&s_gc_slab_locks[cls]);
+        MZC3_GC_StorePtr(&slab->m_owner, static_cast<MZC3_GC_SLAB_CACHE *>(NULL));
+        if (slab->m_live == 0)
+            MZC3_GC_SlabRetire(slab);
+        else if (!MZC3_GC_SlabIsFull(slab))
+            MZC3_GC_SlabLink(slab);
+        MZC3_GC_Unlock(&s_gc_slab_locks[cls]);
+    }
+
+    // Makes the slabs of the exiting thread shared, and keeps the cache
+    // for the next thread.
+    static void MZC3_GC_SlabCacheRelease(MZC3_GC_SLAB_CACHE *cache)
+    {
+        MZC3_GC_SlabCacheDrain(cache);
+        for (std::size_t cls = 0; cls < MZC3_GC_SLAB_CLASSES; cls++)
+        {
+            while (MZC3_GC_SLAB *slab = cache->m_partial[cls])
+            {
+                cache->m_partial[cls] = slab->m_next;
+                MZC3_GC_SlabDisown(slab);
+            }
+        }
+        while (MZC3_GC_SLAB *slab = cache->m_full)
+        {
+            cache->m_full = slab->m_next;
+            MZC3_GC_SlabDisown(slab);
+        }
+        // the blocks pushed meanwhile
+        MZC3_GC_SlabCacheDrain(cache);
+        s_gc_slab_cache = NULL;
+
+        MZC3_GC_Lock(&s_gc_slab_pages_lock);
+        cache->m_next = s_gc_spare_caches;
+        s_gc_spare_caches = cache;
+        MZC3_GC_Unlock(&s_gc_slab_pages_lock);
+    }
+
+    // Gets a slab with a free block for the cache: a shared one if any.
+    static MZC3_GC_SLAB *MZC3_GC_SlabCacheRefill(MZC3_GC_SLAB_CACHE *cache,
+                                                 std::size_t cls)
+    {
+        MZC3_GC_Lock(&s_gc_slab_locks[cls]);
+        MZC3_GC_SLAB *slab = s_gc_slab_partial[cls];
+        if (slab)
+        {
+            MZC3_GC_SlabUnlink(slab);
+            MZC3_GC_StorePtr(&slab->m_owner, cache);
+        }
+        MZC3_GC_Unlock(&s_gc_slab_locks[cls]);
+
+        if (slab == NULL)
+        {
+            slab = MZC3_GC_SlabPage(cls);
+            if (slab == NULL)
+                return NULL;
+            MZC3_GC_StorePtr(&slab->m_owner, cache);
+        }
+        MZC3_GC_SlabLinkTo(&cache->m_partial[cls], slab);
+        return slab;
+    }
+#endif  // def MZC3_GC_THREAD_CACHE
+
+static void *MZC3_GC_SlabAlloc(std::size_t cls)
+{
+    assert(cls < MZC3_GC_SLAB_CLASSES);
+    #ifdef MZC3_GC_THREAD_CACHE
+        MZC3_GC_SLAB_CACHE *cache = s_gc_slab_cache;
+        if (cache)
+        {
+            if (MZC3_GC_LoadPtr(&cache->m_remote))
+                MZC3_GC_SlabCacheDrain(cache);
+
+            MZC3_GC_SLAB *slab = cache->m_partial[cls];
+            if (slab == NULL)
+            {
+                slab = MZC3_GC_SlabCacheRefill(cache, cls);
+                if (slab == NULL)
+                    return NULL;
+            }
+            void *ptr = MZC3_GC_SlabTake(slab);
+            if (MZC3_GC_SlabIsFull(slab))
+            {
+                MZC3_GC_SlabUnlinkFrom(&cache->m_partial[cls], slab);
+                MZC3_GC_SlabLinkTo(&cache->m_full, slab);
+            }
+            return ptr;
+        }
+    #endif
+    return MZC3_GC_SlabAllocShared(cls);
+}
+
+static void MZC3_GC_SlabFreeShared(MZC3_GC_SLAB *slab, void *ptr)
+{
+    // The class of a slab in use does not change.
+    const std::size_t cls = slab->m_class;
+    MZC3_GC_Lock(&s_gc_slab_locks[cls]);
+    #ifdef MZC3_GC_THREAD_CACHE
+        // A thread may have taken the slab meanwhile.
+        if (MZC3_GC_SLAB_CACHE *owner = MZC3_GC_LoadPtr(&slab->m_owner))
+        {
+            MZC3_GC_Unlock(&s_gc_slab_locks[cls]);
+            MZC3_GC_SlabFreeRemote(owner, ptr);
+            return;
+        }
+    #endif
+    const bool was_full = MZC3_GC_SlabIsFull(slab);
+    MZC3_GC_SlabPut(slab, ptr);
+
+    if (slab->m_live == 0)
+    {
+        if (!was_full)
+            MZC3_GC_SlabUnlink(slab);
+        MZC3_GC_SlabRetire(slab);
+    }
+    else if (was_full)
+    {
+        MZC3_GC_SlabLink(slab);
+    }
+    MZC3_GC_Unlock(&s_gc_slab_locks[cls]);
+}
+
+static void MZC3_GC_SlabFree(void *ptr)
+{
+    MZC3_GC_SLAB *slab = MZC3_GC_SlabOf(ptr);
+    #ifdef MZC3_GC_THREAD_CACHE
+        MZC3_GC_SLAB_CACHE *owner = MZC3_GC_LoadPtr(&slab->m_owner);
+        if (owner)
+        {
+            if (owner == s_gc_slab_cache)
+                MZC3_GC_SlabFreeLocal(owner, slab, ptr);
+            else
+                MZC3_GC_SlabFreeRemote(owner, ptr);
+            return;
+        }
+    #endif
+    MZC3_GC_SlabFreeShared(slab, ptr);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_LARGE --- large-object space (see MzcGC_SetLargeThreshold)
+//
+// A tracked block of the threshold or more bytes is mapped from the OS by
+// itself, and unmapped when freed, so that its pages go back to the OS at
+// once instead of fragmenting the heap.
+
+static const std::size_t MZC3_GC_LARGE_DEFAULT_THRESHOLD = 0x100000;
+
+// the minimum size of a mapped block, or zero if none are mapped
+static std::size_t s_gc_large_threshold = MZC3_GC_LARGE_DEFAULT_THRESHOLD;
+// pointer --> the length of the mapping (protected by s_gc_large_lock)
+static MZC3_GC_INDEX s_gc_large_index = {NULL, 0, 0};
+static MZC3_GC_LOCK s_gc_large_lock;
+// the number of the mapped blocks, read without locking
+static std::size_t s_gc_large_blocks = 0;
+
+static std::size_t MZC3_GC_PageSize(void)
+{
+    static std::size_t s_page_size = 0;
+    std::size_t page_size = MZC3_GC_LoadCounter(&s_page_size);
+    if (page_size == 0)
+    {
+        #ifdef _WIN32
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            page_size = info.dwPageSize;
+        #else
+            page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        #endif
+        MZC3_GC_StoreCounter(&s_page_size, page_size);
+    }
+    return page_size;
+}
+
+inline bool MZC3_GC_IsLargeSize(std::size_t size)
+{
+    const std::size_t threshold = MZC3_GC_LoadCounter(&s_gc_large_threshold);
+    return (threshold && size >= threshold);
+}
+
+// Returns the length of the mapping of a mapped block, or zero.
+static std::size_t MZC3_GC_LargeLength(void *ptr)
+{
+    // Mapped blocks are page-aligned.
+    if (MZC3_GC_LoadCounter(&s_gc_large_blocks) == 0 ||
+        (reinterpret_cast<std::size_t>(ptr) & (MZC3_GC_PageSize() - 1)))
+    {
+        return 0;
+    }
+
+    MZC3_GC_Lock(&s_gc_large_lock);
+    MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&s_gc_large_index, ptr);
+    const std::size_t length =
+        (slot ? reinterpret_cast<std::size_t>(slot->m_value) : 0);
+    MZC3_GC_Unlock(&s_gc_large_lock);
+    return length;
+}
+
+static void *MZC3_GC_MapPages(std::size_t length)
+{
+    #ifdef _WIN32
+        return VirtualAlloc(NULL, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    #else
+        void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return (ptr == MAP_FAILED ? NULL : ptr);
+    #endif
+}
+
+static void MZC3_GC_UnmapPages(void *ptr, std::size_t length)
+{
+    #ifdef _WIN32
+        (void)length;
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    #else
+        munmap(ptr, length);
+    #endif
+}
+
+// Registers a mapping.  Returns false if out of memory.
+static bool MZC3_GC_LargeAdd(void *ptr, std::size_t length)
+{
+    MZC3_GC_Lock(&s_gc_large_lock);
+    const bool ok = MZC3_GC_IndexReserve(&s_gc_large_index);
+    if (ok)
+    {
+        MZC3_GC_IndexInsert(&s_gc_large_index, ptr, reinterpret_cast<void *>(length));
+        MZC3_GC_StoreCounter(&s_gc_large_blocks, s_gc_large_index.m_count);
+    }
+    MZC3_GC_Unlock(&s_gc_large_lock);
+    return ok;
+}
+
+static void MZC3_GC_LargeRemove(void *ptr)
+{
+    MZC3_GC_Lock(&s_gc_large_lock);
+    MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&s_gc_large_index, ptr);
+    assert(slot);
+    MZC3_GC_IndexErase(&s_gc_large_index, slot);
+    MZC3_GC_StoreCounter(&s_gc_large_blocks, s_gc_large_index.m_count);
+    MZC3_GC_Unlock(&s_gc_large_lock);
+}
+
+// Maps a block of size bytes, zero-filled.  Returns NULL on failure.
+static void *MZC3_GC_LargeAlloc(std::size_t size)
+{
+    const std::size_t page_size = MZC3_GC_PageSize();
+    if (size > ~std::size_t(0) - page_size)
+        return NULL;
+    const std::size_t length = MZC3_GC_RoundUp(size, page_size);
+    void *ptr = MZC3_GC_MapPages(length);
+    if (ptr && !MZC3_GC_LargeAdd(ptr, length))
+    {
+        MZC3_GC_UnmapPages(ptr, length);
+        ptr = NULL;
+    }
+    return ptr;
+}
+
+static void MZC3_GC_LargeFree(void *ptr, std::size_t length)
+{
+    MZC3_GC_LargeRemove(ptr);
+    MZC3_GC_UnmapPages(ptr, length);
+}
+
+// Resizes a mapped block to size bytes, which must be large.  Returns
+// NULL on failure.
+static void *MZC3_GC_LargeRealloc(void *ptr, std::size_t length, std::size_t size)
+{
+    using namespace std;
+    const std::size_t page_size = MZC3_GC_PageSize();
+    if (size > ~std::size_t(0) - page_size)
+        return NULL;
+    const std::size_t newlength = MZC3_GC_RoundUp(size, page_size);
+    if (newlength == length)
+        return ptr;
+
+    #if defined(__linux__) && defined(MREMAP_MAYMOVE)
+        // Linux moves the pages without copying.
+        MZC3_GC_LargeRemove(ptr);
+        void *newptr = mremap(ptr, length, newlength, MREMAP_MAYMOVE);
+        if (newptr == MAP_FAILED)
+        {
+            MZC3_GC_LargeAdd(ptr, length);  // never grows the index
+            return NULL;
+        }
+        if (!MZC3_GC_LargeAdd(newptr, newlength))
+        {
+            MZC3_GC_UnmapPages(newptr, newlength);
+            return NULL;
+        }
+        return newptr;
+    #else
+        void *newptr = MZC3_GC_LargeAlloc(size);
+        if (newptr)
+        {
+            memcpy(newptr, ptr, (length < newlength ? length : newlength));
+            MZC3_GC_LargeFree(ptr, length);
+        }
+        return newptr;
+    #endif
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// The backing store of tracked blocks.  A tracked block of at most
+// MZC3_GC_SLAB_MAX bytes is in a slab, and a large one is mapped.
+
+static void *MZC3_GC_AllocBlock(std::size_t size, bool zero)
+{
+    using namespace std;
+    if (size > MZC3_GC_SLAB_MAX)
+    {
+        if (MZC3_GC_IsLargeSize(size))
+        {
+            if (void *ptr = MZC3_GC_LargeAlloc(size))
+                return ptr;     // zero-filled
+        }
+        return (zero ? calloc(size, 1) : malloc(size));
+    }
+
+    void *ptr = MZC3_GC_SlabAlloc(MZC3_GC_SlabClass(size));
+    if (ptr && zero)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+static void MZC3_GC_FreeBlock(void *ptr, std::size_t size)
+{
+    using namespace std;
+    if (size > MZC3_GC_SLAB_MAX)
+    {
+        // The threshold may have changed since the allocation.
+        if (std::size_t length = MZC3_GC_LargeLength(ptr))
+            MZC3_GC_LargeFree(ptr, length);
+        else
+            free(ptr);
+    }
+    else
+    {
+        MZC3_GC_SlabFree(ptr);
+    }
+}
+
+// Returns the usable bytes of a block from malloc, or zero if unknown.
+static std::size_t MZC3_GC_MallocUsable(void *ptr)
+{
+    using namespace std;
+    #ifdef _WIN32
+        return _msize(ptr);
+    #elif defined(__GLIBC__)
+        return malloc_usable_size(ptr);
+    #else
+        (void)ptr;
+        return 0;
+    #endif
+}
+
+// Returns the usable bytes of a block of size bytes, at least size.
+static std::size_t MZC3_GC_BlockCapacity(void *ptr, std::size_t size)
+{
+    if (size <= MZC3_GC_SLAB_MAX)
+        return MZC3_GC_SlabClassSize(MZC3_GC_SlabClass(size));
+    if (std::size_t length = MZC3_GC_LargeLength(ptr))
+        return length;
+    const std::size_t usable = MZC3_GC_MallocUsable(ptr);
+    return (usable > size ? usable : size);
+}
+
+// Returns true if reallocating keeps the block in place: a small block
+// stays in its class, and a block grows into its slack.  A large block
+// shrinks by MZC3_GC_ReallocBlock, to give back the memory.
+inline bool MZC3_GC_BlockStays(void *ptr, std::size_t oldsize, std::size_t size)
+{
+    if (oldsize <= MZC3_GC_SLAB_MAX && size <= MZC3_GC_SLAB_MAX)
+        return (MZC3_GC_SlabClass(oldsize) == MZC3_GC_SlabClass(size));
+    return (oldsize > MZC3_GC_SLAB_MAX && size >= oldsize &&
+            size <= MZC3_GC_BlockCapacity(ptr, oldsize));
+}
+
+static void *MZC3_GC_ReallocBlock(void *ptr, std::size_t oldsize, std::size_t size)
+{
+    using namespace std;
+    if (MZC3_GC_BlockStays(ptr, oldsize, size))
+        return ptr;
+
+    if (oldsize > MZC3_GC_SLAB_MAX && size > MZC3_GC_SLAB_MAX)
+    {
+        const std::size_t length = MZC3_GC_LargeLength(ptr);
+        if (length && MZC3_GC_IsLargeSize(size))
+            return MZC3_GC_LargeRealloc(ptr, length, size);
+        if (length == 0 && !MZC3_GC_IsLargeSize(size))
+            return realloc(ptr, size);
+    }
+
+    void *newptr = MZC3_GC_AllocBlock(size, false);
+    if (newptr)
+    {
+        // The slack may be in use (see mzcusable_size).
+        const std::size_t capacity = MZC3_GC_BlockCapacity(ptr, oldsize);
+        memcpy(newptr, ptr, (capacity < size ? capacity : size));
+        MZC3_GC_FreeBlock(ptr, oldsize);
+    }
+    return newptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC
+
+static bool s_gc_constructed = false;
+// Never cleared, since the locks and the untracked blocks still in the
+// registry outlive MZC3_GC_MGR.
+static bool s_gc_initialized = false;
+
+#ifdef MZC3_GC_HEADER
+    // Every block from mzcmalloc has an entry as the header, and the magic
+    // word just before the pointer.  Tracked or not, a block is found in
+    // O(1) without any global table.
+    static const std::size_t MZC3_GC_HEADER_SIZE =
+        (sizeof(MZC3_GC_ENTRY) + sizeof(std::size_t) + MZC3_GC_ALIGNMENT - 1) &
+        ~(MZC3_GC_ALIGNMENT - 1);
+    static const std::size_t MZC3_GC_MAGIC = 0x4D5A4333;
+
+    inline std::size_t& MZC3_GC_MagicOf(void *ptr)
+    {
+        return reinterpret_cast<std::size_t *>(ptr)[-1];
+    }
+
+    inline std::size_t MZC3_GC_Magic(void *ptr)
+    {
+        return reinterpret_cast<std::size_t>(ptr) ^ MZC3_GC_MAGIC;
+    }
+
+    inline MZC3_GC_ENTRY *MZC3_GC_EntryOf(MZC3_GC_LINK link)
+    {
+        return link;
+    }
+
+    inline MZC3_GC_LINK MZC3_GC_LinkOf(MZC3_GC_ENTRY *entry)
+    {
+        return entry;
+    }
+#else
+    // MZC3_GC_ENTRY_CHUNK --- a page of entries.  Entries never move.  A
+    // chunk is aligned to its size, so that the id of an entry is found
+    // from its address.  The id is the chunk number and the index in the
+    // chunk.
+    static const std::size_t MZC3_GC_ENTRY_CHUNK_SIZE = 4096;
+    static const unsigned MZC3_GC_ENTRY_INDEX_BITS = 7;
+
+    struct MZC3_GC_ENTRY_CHUNK
+    {
+        MZC3_GC_ENTRY_CHUNK *m_next;    // in the shard
+        unsigned             m_number;  // from 1
+        MZC3_GC_ENTRY        m_entries[1];
+    };
+
+    static const std::size_t MZC3_GC_ENTRY_CHUNK_COUNT =
+        (MZC3_GC_ENTRY_CHUNK_SIZE - sizeof(MZC3_GC_ENTRY_CHUNK)) /
+        sizeof(MZC3_GC_ENTRY) + 1;
+
+    // the chunks by number, in nodes of the lower bits of the number
+    // (protected by s_gc_entry_map_lock, a leaf).  The number of an entry
+    // reaches a reader through the locks after its chunk is stored, so the
+    // map is read without locking.
+    static const unsigned MZC3_GC_ENTRY_NODE_BITS = 12;
+    static const std::size_t MZC3_GC_ENTRY_NODE_SLOTS =
+        std::size_t(1) << MZC3_GC_ENTRY_NODE_BITS;
+    static const std::size_t MZC3_GC_ENTRY_ROOT_SLOTS = std::size_t(1) <<
+        (32 - MZC3_GC_ENTRY_INDEX_BITS - MZC3_GC_ENTRY_NODE_BITS);
+
+    struct MZC3_GC_ENTRY_NODE
+    {
+        MZC3_GC_ENTRY_CHUNK *m_chunks[MZC3_GC_ENTRY_NODE_SLOTS];
+    };
+
+    static MZC3_GC_ENTRY_NODE *s_gc_entry_map[MZC3_GC_ENTRY_ROOT_SLOTS];
+    static unsigned s_gc_entry_chunk_count = 0;
+    static MZC3_GC_LOCK s_gc_entry_map_lock;
+
+    inline MZC3_GC_ENTRY *MZC3_GC_EntryOf(MZC3_GC_LINK link)
+    {
+        if (link == 0)
+            return NULL;
+        const unsigned number = link >> MZC3_GC_ENTRY_INDEX_BITS;
+        MZC3_GC_ENTRY_NODE *node = s_gc_entry_map[number >> MZC3_GC_ENTRY_NODE_BITS];
+        MZC3_GC_ENTRY_CHUNK *chunk =
+            node->m_chunks[number & (MZC3_GC_ENTRY_NODE_SLOTS - 1)];
+        return &chunk->m_entries[link & ((1U << MZC3_GC_ENTRY_INDEX_BITS) - 1)];
+    }
+
+    inline MZC3_GC_LINK MZC3_GC_LinkOf(MZC3_GC_ENTRY *entry)
+    {
+        if (entry == NULL)
+            return 0;
+        MZC3_GC_ENTRY_CHUNK *chunk = reinterpret_cast<MZC3_GC_ENTRY_CHUNK *>(
+            reinterpret_cast<std::size_t>(entry) & ~(MZC3_GC_ENTRY_CHUNK_SIZE - 1));
+        return (chunk->m_number << MZC3_GC_ENTRY_INDEX_BITS) |
+               static_cast<unsigned>(entry - chunk->m_entries);
+    }
+
+    static void MZC3_GC_FreeEntryChunk(MZC3_GC_ENTRY_CHUNK *chunk)
+    {
+        using namespace std;
+        #ifdef _WIN32
+            _aligned_free(chunk);
+        #else
+            free(chunk);
+        #endif
+    }
+
+    // Allocates a chunk of entries, and gives it a number.  Returns NULL if
+    // out of memory.
+    static MZC3_GC_ENTRY_CHUNK *MZC3_GC_NewEntryChunk(void)
+    {
+        using namespace std;
+        #ifdef _WIN32
+            void *ptr = _aligned_malloc(MZC3_GC_ENTRY_CHUNK_SIZE,
+                                        MZC3_GC_ENTRY_CHUNK_SIZE);
+        #else
+            void *ptr;
+            if (posix_memalign(&ptr, MZC3_GC_ENTRY_CHUNK_SIZE,
+                               MZC3_GC_ENTRY_CHUNK_SIZE) != 0)
+            {
+                ptr = NULL;
+            }
+        #endif
+        if (ptr == NULL)
+            return NULL;
+        MZC3_GC_ENTRY_CHUNK *chunk = static_cast<MZC3_GC_ENTRY_CHUNK *>(ptr);
+
+        MZC3_GC_Lock(&s_gc_entry_map_lock);
+        const unsigned number = s_gc_entry_chunk_count + 1;
+        MZC3_GC_ENTRY_NODE **pnode = NULL;
+        if (number < (MZC3_GC_ENTRY_ROOT_SLOTS << MZC3_GC_ENTRY_NODE_BITS))
+        {
+            pnode = &s_gc_entry_map[number >> MZC3_GC_ENTRY_NODE_BITS];
+            if (*pnode == NULL)
+            {
+                *pnode = reinterpret_cast<MZC3_GC_ENTRY_NODE *>(
+                    calloc(1, sizeof(MZC3_GC_ENTRY_NODE)));
+            }
+        }
+        if (pnode && *pnode)
+        {
+            (*pnode)->m_chunks[number & (MZC3_GC_ENTRY_NODE_SLOTS - 1)] = chunk;
+            s_gc_entry_chunk_count = number;
+            chunk->m_number = number;
+        }
+        else
+        {
+            chunk = NULL;
+        }
+        MZC3_GC_Unlock(&s_gc_entry_map_lock);
+        if (chunk == NULL)
+            MZC3_GC_FreeEntryChunk(static_cast<MZC3_GC_ENTRY_CHUNK *>(ptr));
+        return chunk;
+    }
+
+    // MZC3_GC_SHARD --- a part of the registry.  A tracked block is in the
+    // shard of its pointer.
+    struct MZC3_GC_SHARD
+    {
+        MZC3_GC_LOCK         m_lock;
+        MZC3_GC_INDEX        m_index;           // m_ptr --> entry
+        MZC3_GC_ENTRY_CHUNK *m_chunks;
+        MZC3_GC_LINK         m_free_entries;    // linked by m_next
+    };
+
+    static MZC3_GC_SHARD s_gc_shards[MZC3_GC_STRIPES];
+
+    inline MZC3_GC_SHARD *MZC3_GC_ShardOf(const void *ptr)
+    {
+        return &s_gc_shards[MZC3_GC_StripeOf(ptr)];
+    }
+#endif
+
+// Frees the sections of the thread, both open and spare.
+static void MZC3_GC_FreeStates(MZC3_GC_THREAD_ENTRY *entry)
+{
+    MZC3_GC_STATE *state = MZC3_GC_Top(entry);
+    entry->stack.top = NULL;
+    entry->stack.depth = 0;
+    while (state)
+    {
+        MZC3_GC_STATE *next = MZC3_GC_Outer(state);
+        MZC3_GC_ArenaRelease(state);
+        MZC3_GC_RemoveState(state);
+        free(state);
+        state = next;
+    }
+
+    state = static_cast<MZC3_GC_STATE *>(entry->stack.spare);
+    entry->stack.spare = NULL;
+    while (state)
+    {
+        MZC3_GC_STATE *next = MZC3_GC_Outer(state);
+        MZC3_GC_RemoveState(state);
+        free(state);
+        state = next;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_TRIM --- giving the freed memory back to the OS (see
+// MzcGC_SetTrimPolicy)
+//
+// The empty slabs are kept by the GC and the tables never shrink by
+// themselves, so after a large collection the process would keep its peak
+// size.  Trimming advises the OS to drop the pages of the empty slabs, and
+// shrinks the tables that are mostly empty.
+
+// the bytes freed that trigger trimming, or zero if never
+static std::size_t s_gc_trim_threshold = 0;
+// the bytes freed since the last trimming, and the bytes released by all
+// the trimmings (protected by s_gc_trim_lock)
+static std::size_t s_gc_trim_pending = 0;
+static std::size_t s_gc_trimmed_bytes = 0;
+static MZC3_GC_LOCK s_gc_trim_lock;
+
+// Lets the OS drop the pages, which keep their addresses.  Their contents
+// are lost.
+static void MZC3_GC_AdvisePages(void *ptr, std::size_t length)
+{
+    #ifdef _WIN32
+        VirtualAlloc(ptr, length, MEM_RESET, PAGE_READWRITE);
+    #elif defined(MADV_DONTNEED)
+        madvise(ptr, length, MADV_DONTNEED);
+    #else
+        (void)ptr;
+        (void)length;
+    #endif
+}
+
+// Moves the empty slabs to s_gc_slab_trimmed and drops their pages.
+// Returns the bytes released.
+static std::size_t MZC3_GC_SlabTrim(void)
+{
+    using namespace std;
+    // A slab must be whole pages.
+    if (MZC3_GC_PageSize() > MZC3_GC_SLAB_SIZE)
+        return 0;
+
+    std::size_t released = 0;
+    MZC3_GC_Lock(&s_gc_slab_pages_lock);
+    while (s_gc_slab_empty)
+    {
+        if (s_gc_slab_trimmed_count == s_gc_slab_trimmed_capacity)
+        {
+            const std::size_t capacity =
+                (s_gc_slab_trimmed_capacity ? s_gc_slab_trimmed_capacity * 2 : 64);
+            MZC3_GC_SLAB **slabs = reinterpret_cast<MZC3_GC_SLAB **>(
+                realloc(s_gc_slab_trimmed, capacity * sizeof(MZC3_GC_SLAB *)));
+            if (slabs == NULL)
+                break;
+            s_gc_slab_trimmed = slabs;
+            s_gc_slab_trimmed_capacity = capacity;
+        }
+
+        MZC3_GC_SLAB *slab = s_gc_slab_empty;
+        s_gc_slab_empty = slab->m_next;
+        s_gc_slab_trimmed[s_gc_slab_trimmed_count++] = slab;
+        MZC3_GC_AdvisePages(slab, MZC3_GC_SLAB_SIZE);
+        released += MZC3_GC_SLAB_SIZE;
+    }
+    MZC3_GC_Unlock(&s_gc_slab_pages_lock);
+    return released;
+}
+
+// Gives the freed memory back to the OS.  Returns the bytes released.
+static std::size_t MZC3_GC_Trim(void)
+{
+    std::size_t released = MZC3_GC_SlabTrim();
+
+    #ifndef MZC3_GC_HEADER
+        for (std::size_t i = 0; i < MZC3_GC_STRIPES; i++)
+        {
+            MZC3_GC_SHARD *shard = &s_gc_shards[i];
+            MZC3_GC_Lock(&shard->m_lock);
+            released += MZC3_GC_IndexShrink(&shard->m_index);
+            MZC3_GC_Unlock(&shard->m_lock);
+        }
+    #endif
+    MZC3_GC_Lock(&s_gc_large_lock);
+    released += MZC3_GC_IndexShrink(&s_gc_large_index);
+    MZC3_GC_Unlock(&s_gc_large_lock);
+    released += MZC3_GC_ExtrasShrink();
+
+    #ifdef __GLIBC__
+        // The arena chunks and the tables went back to malloc.  Not
+        // counted, since it does not tell how much.
+        malloc_trim(0);
+    #endif
+
+    MZC3_GC_Lock(&s_gc_trim_lock);
+    s_gc_trimmed_bytes += released;
+    MZC3_GC_Unlock(&s_gc_trim_lock);
+    return released;
+}
+
+// Counts the bytes freed by a collection, and trims if the policy says.
+static void MZC3_GC_MaybeTrim(std::size_t freed)
+{
+    const std::size_t threshold = MZC3_GC_LoadCounter(&s_gc_trim_threshold);
+    if (threshold == 0 || freed == 0)
+        return;
+
+    MZC3_GC_Lock(&s_gc_trim_lock);
+    s_gc_trim_pending += freed;
+    const bool trim = (s_gc_trim_pending >= threshold);
+    if (trim)
+        s_gc_trim_pending = 0;
+    MZC3_GC_Unlock(&s_gc_trim_lock);
+
+    if (trim)
+        MZC3_GC_Trim();
+}
+
+static void MZC3_GC_CollectState(MZC3_GC_STATE *state);
+
+#ifdef MZC3_GC_MT
+    // MZC3_GC_BATCH --- the allocations of a section left, waiting for
+    // the collector thread
+    struct MZC3_GC_BATCH
+    {
+        MZC3_GC_BATCH *         m_next;
+        MZC3_GC_ENTRY *         m_entries;
+        MZC3_GC_ARENA_CHUNK *   m_arena_chunks;
+        std::size_t             m_bytes;
+    };
+
+    static const std::size_t MZC3_GC_DEFAULT_MAX_BACKLOG = 64 * 1024 * 1024;
+
+    // the collector (protected by s_gc_collector_lock)
+    static MZC3_GC_LOCK     s_gc_collector_lock;
+    static MZC3_GC_COND     s_gc_collector_wake;    // work or stop
+    static MZC3_GC_COND     s_gc_collector_idle;    // no work
+    static bool             s_gc_collector_running = false;
+    static bool             s_gc_collector_stopping = false;
+    static bool             s_gc_collector_busy = false;
+    static MZC3_GC_BATCH *  s_gc_batches = NULL;
+    static std::size_t      s_gc_backlog = 0;       // bytes in s_gc_batches
+    static std::size_t      s_gc_max_backlog = 0;
+    #ifdef _WIN32
+        static HANDLE       s_gc_collector_thread = NULL;
+    #else
+        static pthread_t    s_gc_collector_thread;
+    #endif
+
+    static void MZC3_GC_StopCollector(void);
+#endif
+
+// MZC3_GC_ROOTS --- a root range of the conservative marking
+struct MZC3_GC_ROOTS
+{
+    const char *    m_begin;
+    const char *    m_end;
+};
+
+// the registered root ranges (protected by s_gc_roots_lock)
+static MZC3_GC_ROOTS *  s_gc_roots = NULL;
+static std::size_t      s_gc_roots_count = 0;
+static std::size_t      s_gc_roots_capacity = 0;
+static MZC3_GC_LOCK     s_gc_roots_lock;
+
+class MZC3_GC_MGR
+{
+public:
+    MZC3_GC_MGR()
+    {
+        InitializeLock();
+
+        // NOTE: The striped locks are never deleted, since blocks may be
+        // freed after this object.
+        for (std::size_t i = 0; i < MZC3_GC_STRIPES; i++)
+        {
+            MZC3_GC_InitLock(&s_gc_extras[i].m_lock);
+            #ifndef MZC3_GC_HEADER
+                MZC3_GC_InitLock(&s_gc_shards[i].m_lock);
+            #endif
+        }
+        MZC3_GC_InitLock(&s_gc_state_lock);
+        #ifndef MZC3_GC_HEADER
+            MZC3_GC_InitLock(&s_gc_entry_map_lock);
+        #endif
+        for (std::size_t i = 0; i < MZC3_GC_SLAB_CLASSES; i++)
+            MZC3_GC_InitLock(&s_gc_slab_locks[i]);
+        MZC3_GC_InitLock(&s_gc_slab_pages_lock);
+        MZC3_GC_InitLock(&s_gc_arena_lock);
+        MZC3_GC_InitLock(&s_gc_large_lock);
+        MZC3_GC_InitLock(&s_gc_trim_lock);
+        MZC3_GC_InitLock(&s_gc_roots_lock);
+        MZC3_GC_InitLock(&s_gc_profile_lock);
+        #ifdef _DEBUG
+            MZC3_GC_InitLock(&s_gc_site_lock);
+        #endif
+        #ifdef MZC3_GC_MT
+            MZC3_GC_InitLock(&s_gc_collector_lock);
+            MZC3_GC_InitCond(&s_gc_collector_wake);
+            MZC3_GC_InitCond(&s_gc_collector_idle);
+        #endif
+
+        s_gc_constructed = true;
+        s_gc_initialized = true;
+    }
+
+    ~MZC3_GC_MGR();
+};
+
+MZC3_GC_MGR::~MZC3_GC_MGR()
+{
+    #ifdef MZC3_GC_MT
+        MZC3_GC_StopCollector();
+    #endif
+
+    EnterLock();
+
+    #ifdef MZC3_GC_MT
+        // The threads still alive will free their own entries on exit.
+        for (MZC3_GC_THREAD_ENTRY *entry = s_gc_thread_entries; entry;
+             entry = entry->next)
+        {
+            for (MZC3_GC_STATE *state = MZC3_GC_Top(entry); state;
+                 state = MZC3_GC_Outer(state))
+            {
+                MZC3_GC_CollectState(state);
+            }
+            MZC3_GC_FreeStates(entry);
+        }
+        s_gc_thread_entries = NULL;
+    #else
+        for (MZC3_GC_STATE *state = MZC3_GC_Top(&s_only_one_gc_thread_entry);
+             state; state = MZC3_GC_Outer(state))
+        {
+            MZC3_GC_CollectState(state);
+        }
+        MZC3_GC_FreeStates(&s_only_one_gc_thread_entry);
+    #endif
+    MZC3_GC_Lock(&s_gc_arena_lock);
+    MZC3_GC_StoreCounter(&s_gc_arena_span_count, std::size_t(0));
+    MZC3_GC_ArenaFreeMap();
+    MZC3_GC_Unlock(&s_gc_arena_lock);
+    s_gc_constructed = false;
+
+    #ifndef MZC3_GC_HEADER
+        for (std::size_t i = 0; i < MZC3_GC_STRIPES; i++)
+        {
+            MZC3_GC_SHARD *shard = &s_gc_shards[i];
+            MZC3_GC_Lock(&shard->m_lock);
+            if (shard->m_index.m_count)
+            {
+                // untracked blocks still in use (see MZC3_GC_PassOut)
+                MZC3_GC_Unlock(&shard->m_lock);
+                continue;
+            }
+            MZC3_GC_IndexDestroy(&shard->m_index);
+
+            MZC3_GC_ENTRY_CHUNK *chunk = shard->m_chunks;
+            shard->m_chunks = NULL;
+            shard->m_free_entries = 0;
+            while (chunk)
+            {
+                MZC3_GC_ENTRY_CHUNK *next = chunk->m_next;
+                MZC3_GC_FreeEntryChunk(chunk);
+                chunk = next;
+            }
+            MZC3_GC_Unlock(&shard->m_lock);
+        }
+
+        // No links are followed any more.  The numbers of the chunks left
+        // are not reused.
+        MZC3_GC_Lock(&s_gc_entry_map_lock);
+        for (std::size_t i = 0; i < MZC3_GC_ENTRY_ROOT_SLOTS; i++)
+        {
+            free(s_gc_entry_map[i]);
+            s_gc_entry_map[i] = NULL;
+        }
+        MZC3_GC_Unlock(&s_gc_entry_map_lock);
+    #endif
+    LeaveLock();
+
+    DeleteLock();
+}
+
+MZC3_GC_MGR mzc_gc_mgr;
+
+#ifdef _DEBUG
+    #define MZC3_GC_SITE_PARAMS     , const char *file, int line
+    #define MZC3_GC_SITE_ARGS       , file, line
+#else
+    #define MZC3_GC_SITE_PARAMS     /*empty*/
+    #define MZC3_GC_SITE_ARGS       /*empty*/
+#endif
+
+#ifdef MZC3_GC_HEADER
+    // Returns the header of a block from mzcmalloc, or NULL.
+    static MZC3_GC_ENTRY *MZC3_GC_Find(void *ptr)
+    {
+        if (ptr == NULL ||
+            (reinterpret_cast<std::size_t>(ptr) & (MZC3_GC_ALIGNMENT - 1)))
+        {
+            return NULL;
+        }
+
+        // The word just before a pointer from any malloc is in its heap
+        // block.  Check it before reading the rest of the header.
+        if (MZC3_GC_MagicOf(ptr) != MZC3_GC_Magic(ptr))
+            return NULL;
+
+        MZC3_GC_ENTRY *entry = reinterpret_cast<MZC3_GC_ENTRY *>(
+            static_cast<char *>(ptr) - MZC3_GC_HEADER_SIZE);
+        assert(entry->m_ptr == ptr);
+        return entry;
+    }
+#else
+    // Returns the entry of a tracked block, or NULL.
+    static MZC3_GC_ENTRY *MZC3_GC_Find(void *ptr)
+    {
+        if (ptr == NULL || !s_gc_initialized)
+            return NULL;
+
+        MZC3_GC_SHARD *shard = MZC3_GC_ShardOf(ptr);
+        MZC3_GC_Lock(&shard->m_lock);
+        MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&shard->m_index, ptr);
+        MZC3_GC_ENTRY *entry =
+            (slot ? static_cast<MZC3_GC_ENTRY *>(slot->m_value) : NULL);
+        MZC3_GC_Unlock(&shard->m_lock);
+
+        assert(entry == NULL || entry->m_ptr == ptr);
+        return entry;
+    }
+
+    // Takes an entry from the free list of the shard.  Adds a new chunk
+    // if necessary.  Needs the shard lock.
+    static MZC3_GC_ENTRY *MZC3_GC_NewEntry(MZC3_GC_SHARD *shard)
+    {
+        if (shard->m_free_entries == 0)
+        {
+            MZC3_GC_ENTRY_CHUNK *chunk = MZC3_GC_NewEntryChunk();
+            if (chunk == NULL)
+                return NULL;
+
+            chunk->m_next = shard->m_chunks;
+            shard->m_chunks = chunk;
+            for (std::size_t i = MZC3_GC_ENTRY_CHUNK_COUNT - 1;
+                 i < MZC3_GC_ENTRY_CHUNK_COUNT; i--)
+            {
+                chunk->m_entries[i].m_next = shard->m_free_entries;
+                shard->m_free_entries = MZC3_GC_LinkOf(&chunk->m_entries[i]);
+            }
+        }
+
+        MZC3_GC_ENTRY *entry = MZC3_GC_EntryOf(shard->m_free_entries);
+        shard->m_free_entries = entry->m_next;
+        return entry;
+    }
+
+    // Recycles the entry, and returns its sample.  Needs the shard lock,
+    // and the entry must be out of the index and of any section.
+    static MZC3_GC_SAMPLE *MZC3_GC_RecycleEntry(MZC3_GC_SHARD *shard,
+                                                MZC3_GC_ENTRY *entry)
+    {
+        MZC3_GC_SAMPLE *sample = MZC3_GC_DropExtras(entry);
+        entry->m_state = 0;
+        entry->m_next = shard->m_free_entries;
+        shard->m_free_entries = MZC3_GC_LinkOf(entry);
+        return sample;
+    }
+
+    // Removes the block of the entry from the shard, and recycles the
+    // entry.  Returns its sample.
+    static MZC3_GC_SAMPLE *MZC3_GC_EraseEntry(MZC3_GC_ENTRY *entry)
+    {
+        MZC3_GC_SHARD *shard = MZC3_GC_ShardOf(entry->m_ptr);
+        MZC3_GC_Lock(&shard->m_lock);
+        MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&shard->m_index, entry->m_ptr);
+        assert(slot);
+        MZC3_GC_IndexErase(&shard->m_index, slot);
+        MZC3_GC_SAMPLE *sample = MZC3_GC_RecycleEntry(shard, entry);
+        MZC3_GC_Unlock(&shard->m_lock);
+        return sample;
+    }
+#endif
+
+inline MZC3_GC_ENTRY *MZC3_GC_Next(const MZC3_GC_ENTRY *entry)
+{
+    return MZC3_GC_EntryOf(entry->m_next);
+}
+
+inline MZC3_GC_ENTRY *MZC3_GC_Prev(const MZC3_GC_ENTRY *entry)
+{
+    return MZC3_GC_EntryOf(entry->m_prev);
+}
+
+// Returns the oldest entry of the section.
+inline MZC3_GC_ENTRY *MZC3_GC_Oldest(MZC3_GC_STATE *state)
+{
+    MZC3_GC_ENTRY *entry = state->entries;
+    while (entry && entry->m_next)
+        entry = MZC3_GC_Next(entry);
+    return entry;
+}
+
+// Links the entry into the section as the newest.  Only the thread of the
+// section may call it.
+inline void MZC3_GC_ListPush(MZC3_GC_STATE *state, MZC3_GC_ENTRY *entry)
+{
+    const MZC3_GC_LINK link = MZC3_GC_LinkOf(entry);
+    entry->m_prev = 0;
+    entry->m_next = MZC3_GC_LinkOf(state->entries);
+    MZC3_GC_StoreCounter(&entry->m_state, state->id);
+    state->busy = 1;
+    state->bytes += entry->m_size;
+    if (entry->m_has_finalizer)
+        state->finalizers++;
+    if (state->entries)
+        state->entries->m_prev = link;
+    state->entries = entry;
+}
+
+// Unlinks the entry from its section.  Only the thread of the section may
+// call it.
+inline void MZC3_GC_ListRemove(MZC3_GC_STATE *state, MZC3_GC_ENTRY *entry)
+{
+    assert(entry->m_state == state->id);
+    MZC3_GC_ENTRY *prev = MZC3_GC_Prev(entry);
+    MZC3_GC_ENTRY *next = MZC3_GC_Next(entry);
+    if (prev)
+        prev->m_next = entry->m_next;
+    else
+        state->entries = next;
+    if (next)
+        next->m_prev = entry->m_prev;
+    MZC3_GC_StoreCounter(&entry->m_state, 0U);
+    state->bytes -= entry->m_size;
+    if (entry->m_has_finalizer)
+        state->finalizers--;
+}
+
+// Returns the thread of the section of the entry, or NULL if untracked.
+// Any thread may call it: the entry moves only among the sections of the
+// thread (see MZC3_GC_PassOut), which keep their ids until it exits.
+inline MZC3_GC_THREAD_ENTRY *MZC3_GC_EntryThread(const MZC3_GC_ENTRY *entry)
+{
+    const unsigned id = MZC3_GC_LoadCounter(&entry->m_state);
+    return (id ? MZC3_GC_StateOf(id)->owner : NULL);
+}
+
+// Unlinks the entry from its section, if any, and counts it as freed.
+// Only the thread of the section may call it.
+static void MZC3_GC_UnlinkEntry(MZC3_GC_ENTRY *entry)
+{
+    if (const unsigned id = entry->m_state)
+    {
+        MZC3_GC_STATE *state = MZC3_GC_StateOf(id);
+        MZC3_GC_ListRemove(state, entry);
+        MZC3_GC_CountFree(&state->owner->counters, entry->m_depth,
+                          entry->m_size, false);
+    }
+}
+
+// Frees the block of the entry, and its sample.  reclaimed is true if freed
+// by the GC.  The entry must be out of the list of its section.
+static void MZC3_GC_ReleaseEntry(MZC3_GC_ENTRY *entry, bool reclaimed)
+{
+    #ifdef MZC3_GC_HEADER
+        MZC3_GC_SAMPLE *sample = MZC3_GC_DropExtras(entry);
+        entry->m_state = 0;
+        MZC3_GC_MagicOf(entry->m_ptr) = 0;
+        MZC3_GC_FreeBlock(reinterpret_cast<char *>(entry) - entry->m_offset,
+                          entry->m_offset + MZC3_GC_HEADER_SIZE + entry->m_size);
+    #else
+        // The sample goes with the entry from the hash index, where
+        // MzcGC_DumpHeap may read it.
+        char *ptr = static_cast<char *>(entry->m_ptr);
+        const std::size_t size = entry->m_size;
+        const std::size_t offset = entry->m_offset;
+        MZC3_GC_SAMPLE *sample = MZC3_GC_EraseEntry(entry);
+        MZC3_GC_FreeBlock(ptr - offset, offset + size);
+    #endif
+    if (sample)
+        MZC3_GC_Unsample(sample, reclaimed);
+}
+
+#ifdef MZC3_GC_MT
+    // A tracked block freed by another thread than the thread of its
+    // section goes to the remote-free queue of that thread, which unlinks
+    // and frees the blocks all at once on its next allocation, MzcGC_Leave
+    // or collection.  In the hash index mode, the block leaves the index at
+    // once.
+
+    // Returns the link of the entry in a remote-free queue: the magic word,
+    // or the first word of the block in the hash index mode.
+    inline void **MZC3_GC_RemoteLink(MZC3_GC_ENTRY *entry)
+    {
+        #ifdef MZC3_GC_HEADER
+            return reinterpret_cast<void **>(&MZC3_GC_MagicOf(entry->m_ptr));
+        #else
+            return reinterpret_cast<void **>(
+                static_cast<char *>(entry->m_ptr) - entry->m_offset);
+        #endif
+    }
+
+    // Pushes the entry onto the remote-free queue of the thread of its
+    // section.
+    static void MZC3_GC_FreeRemote(MZC3_GC_THREAD_ENTRY *thread,
+                                   MZC3_GC_ENTRY *entry)
+    {
+        void **link = MZC3_GC_RemoteLink(entry);
+        #ifdef MZC3_GC_ATOMIC_PTR
+            void *head;
+            do
+            {
+                head = MZC3_GC_LoadPtr(&thread->remote_entries);
+                *link = head;
+            } while (!MZC3_GC_CasPtr(&thread->remote_entries, head, entry));
+        #else
+            MZC3_GC_Lock(&thread->remote_lock);
+            *link = thread->remote_entries;
+            thread->remote_entries = entry;
+            MZC3_GC_Unlock(&thread->remote_lock);
+        #endif
+    }
+
+    // Frees the blocks of the thread that the other threads have freed.
+    static void MZC3_GC_DoDrainRemote(MZC3_GC_THREAD_ENTRY *thread)
+    {
+        #ifdef MZC3_GC_ATOMIC_PTR
+            void *head = MZC3_GC_ExchangePtr(&thread->remote_entries, NULL);
+        #else
+            MZC3_GC_Lock(&thread->remote_lock);
+            void *head = thread->remote_entries;
+            thread->remote_entries = NULL;
+            MZC3_GC_Unlock(&thread->remote_lock);
+        #endif
+        MZC3_GC_ENTRY *entry = static_cast<MZC3_GC_ENTRY *>(head);
+        while (entry)
+        {
+            MZC3_GC_ENTRY *next =
+                static_cast<MZC3_GC_ENTRY *>(*MZC3_GC_RemoteLink(entry));
+            MZC3_GC_UnlinkEntry(entry);
+            #ifdef MZC3_GC_HEADER
+                MZC3_GC_ReleaseEntry(entry, false);
+            #else
+                // out of the index already
+                char *raw = static_cast<char *>(entry->m_ptr) - entry->m_offset;
+                const std::size_t size = entry->m_offset + entry->m_size;
+                MZC3_GC_SHARD *shard = MZC3_GC_ShardOf(entry->m_ptr);
+                MZC3_GC_Lock(&shard->m_lock);
+                MZC3_GC_SAMPLE *sample = MZC3_GC_RecycleEntry(shard, entry);
+                MZC3_GC_Unlock(&shard->m_lock);
+                MZC3_GC_FreeBlock(raw, size);
+                if (sample)
+                    MZC3_GC_Unsample(sample, false);
+            #endif
+            entry = next;
+        }
+    }
+#endif
+
+// Frees the blocks of the thread that the other threads have freed, if any.
+inline void MZC3_GC_DrainRemote(MZC3_GC_THREAD_ENTRY *thread)
+{
+    #ifdef MZC3_GC_ATOMIC_PTR
+        if (MZC3_GC_LoadPtr(&thread->remote_entries))
+            MZC3_GC_DoDrainRemote(thread);
+    #elif defined(MZC3_GC_MT)
+        MZC3_GC_DoDrainRemote(thread);
+    #else
+        (void)thread;
+    #endif
+}
+
+#ifndef MZC3_GC_HEADER
+    // Unregisters and frees a tracked block, or queues it to the thread of
+    // its section (see MZC3_GC_FreeRemote).  Returns false if ptr is not
+    // tracked.
+    static bool MZC3_GC_FreeTracked(void *ptr)
+    {
+        if (!s_gc_initialized)
+            return false;
+
+        #ifdef MZC3_GC_MT
+            MZC3_GC_THREAD_ENTRY *self = MZC3_GC_GetThreadEntry();
+        #endif
+        MZC3_GC_SHARD *shard = MZC3_GC_ShardOf(ptr);
+        MZC3_GC_Lock(&shard->m_lock);
+        MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&shard->m_index, ptr);
+        if (slot == NULL)
+        {
+            MZC3_GC_Unlock(&shard->m_lock);
+            return false;
+        }
+
+        MZC3_GC_ENTRY *entry = static_cast<MZC3_GC_ENTRY *>(slot->m_value);
+        MZC3_GC_IndexErase(&shard->m_index, slot);
+        #ifdef MZC3_GC_MT
+            MZC3_GC_THREAD_ENTRY *thread = MZC3_GC_EntryThread(entry);
+            if (thread && thread != self)
+            {
+                MZC3_GC_Unlock(&shard->m_lock);
+                MZC3_GC_FreeRemote(thread, entry);
+                return true;
+            }
+        #endif
+        MZC3_GC_UnlinkEntry(entry);
+        const std::size_t size = entry->m_size;
+        const std::size_t offset = entry->m_offset;
+        MZC3_GC_SAMPLE *sample = MZC3_GC_RecycleEntry(shard, entry);
+        MZC3_GC_Unlock(&shard->m_lock);
+
+        MZC3_GC_FreeBlock(static_cast<char *>(ptr) - offset, offset + size);
+        if (sample)
+            MZC3_GC_Unsample(sample, false);
+        return true;
+    }
+
+    // In the hash index mode, an untracked aligned block needs an entry,
+    // which needs the GC.  In static constructors and destructors, such a
+    // block is from libc instead.  On Windows, _aligned_free must free it,
+    // so it is remembered.
+    #ifdef _WIN32
+        // pointer --> the alignment (protected by s_gc_libc_aligned_lock)
+        static MZC3_GC_INDEX s_gc_libc_aligned_index = {NULL, 0, 0};
+        #ifdef MZC3_GC_MT
+            static MZC3_GC_LOCK s_gc_libc_aligned_lock = SRWLOCK_INIT;
+        #else
+            static MZC3_GC_LOCK s_gc_libc_aligned_lock = 0;
+        #endif
+        // the number of the blocks, read without locking
+        static std::size_t s_gc_libc_aligned_blocks = 0;
+
+        // Returns the alignment of a block of MZC3_GC_LibcAlignedAlloc, or
+        // zero.
+        static std::size_t MZC3_GC_LibcAlignment(void *ptr)
+        {
+            if (MZC3_GC_LoadCounter(&s_gc_libc_aligned_blocks) == 0)
+                return 0;
+            MZC3_GC_Lock(&s_gc_libc_aligned_lock);
+            MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&s_gc_libc_aligned_index, ptr);
+            const std::size_t align =
+                (slot ? reinterpret_cast<std::size_t>(slot->m_value) : 0);
+            MZC3_GC_Unlock(&s_gc_libc_aligned_lock);
+            return align;
+        }
+
+        static void MZC3_GC_LibcAlignedFree(void *ptr)
+        {
+            MZC3_GC_Lock(&s_gc_libc_aligned_lock);
+            MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&s_gc_libc_aligned_index, ptr);
+            assert(slot);
+            MZC3_GC_IndexErase(&s_gc_libc_aligned_index, slot);
+            MZC3_GC_StoreCounter(&s_gc_libc_aligned_blocks,
+                                 s_gc_libc_aligned_index.m_count);
+            MZC3_GC_Unlock(&s_gc_libc_aligned_lock);
+            _aligned_free(ptr);
+        }
+    #endif
+
+    // Allocates an untracked block aligned to align from libc.  Returns NULL
+    // on failure.
+    static void *MZC3_GC_LibcAlignedAlloc(std::size_t size, std::size_t align,
+                                          bool zero)
+    {
+        using namespace std;
+        #ifdef _WIN32
+            void *ptr = _aligned_malloc(size ? size : 1, align);
+            if (ptr == NULL)
+                return NULL;
+            MZC3_GC_Lock(&s_gc_libc_aligned_lock);
+            const bool ok = MZC3_GC_IndexReserve(&s_gc_libc_aligned_index);
+            if (ok)
+            {
+                MZC3_GC_IndexInsert(&s_gc_libc_aligned_index, ptr,
+                                    reinterpret_cast<void *>(align));
+                MZC3_GC_StoreCounter(&s_gc_libc_aligned_blocks,
+                                     s_gc_libc_aligned_index.m_count);
+            }
+            MZC3_GC_Unlock(&s_gc_libc_aligned_lock);
+            if (!ok)
+            {
+                _aligned_free(ptr);
+                return NULL;
+            }
+        #else
+            // free takes it.
+            void *ptr;
+            if (posix_memalign(&ptr, align, size ? size : 1) != 0)
+                return NULL;
+        #endif
+        if (zero)
+            memset(ptr, 0, size);
+        return ptr;
+    }
+#endif
+
+// Fills in the fields of a new entry of size bytes but m_ptr and m_offset.
+// It is linked into state later.
+static void MZC3_GC_InitEntry(MZC3_GC_ENTRY *entry, std::size_t size
+                              MZC3_GC_SITE_PARAMS)
+{
+    entry->m_prev = entry->m_next = 0;
+    entry->m_state = 0;
+    entry->m_depth = static_cast<unsigned>(MZC3_GC_GetDepth());
+    entry->m_size = size;
+    entry->m_has_finalizer = false;
+    entry->m_has_sample = false;
+    #ifdef _DEBUG
+        assert(file);
+        entry->m_site = MZC3_GC_InternSite(MZC3_GC_GetThreadEntry(), file, line);
+    #endif
+}
+
+// Records the sample of the new entry, if any.  Returns false if it is
+// dropped.
+static bool MZC3_GC_SetSample(MZC3_GC_ENTRY *entry, MZC3_GC_SAMPLE *sample)
+{
+    if (sample && MZC3_GC_SetExtra(entry, MZC3_GC_EXTRA_SAMPLE, sample))
+        entry->m_has_sample = true;
+    return (sample == NULL || entry->m_has_sample);
+}
+
+// Allocates a block aligned to align with its entry.  The padding for
+// the alignment is a part of the block after it.
+// If state is NULL, the block is not tracked.  In the hash index mode,
+// only tracked or aligned blocks have entries.
+static MZC3_GC_ENTRY *MZC3_GC_AllocEntry(MZC3_GC_STATE *state, std::size_t size,
+                                         std::size_t align,
+                                         bool zero MZC3_GC_SITE_PARAMS)
+{
+    const std::size_t pad = MZC3_GC_AlignPad(align);
+    if (pad > ~0U)
+        return NULL;    // larger than m_offset
+    MZC3_GC_ENTRY *entry;
+    MZC3_GC_SAMPLE *sample;
+    #ifdef MZC3_GC_HEADER
+        if (size > ~std::size_t(0) - MZC3_GC_HEADER_SIZE - pad)
+            return NULL;
+        char *raw = static_cast<char *>(
+            MZC3_GC_AllocBlock(MZC3_GC_HEADER_SIZE + size + pad, zero));
+        if (raw == NULL)
+            return NULL;
+        entry = reinterpret_cast<MZC3_GC_ENTRY *>(
+            MZC3_GC_AlignUp(raw + MZC3_GC_HEADER_SIZE, align) - MZC3_GC_HEADER_SIZE);
+        entry->m_ptr = reinterpret_cast<char *>(entry) + MZC3_GC_HEADER_SIZE;
+        entry->m_offset = static_cast<unsigned>(reinterpret_cast<char *>(entry) - raw);
+        // The rest of the padding is usable.
+        MZC3_GC_InitEntry(entry, size + pad - entry->m_offset MZC3_GC_SITE_ARGS);
+        MZC3_GC_MagicOf(entry->m_ptr) = MZC3_GC_Magic(entry->m_ptr);
+        sample = (state ? MZC3_GC_Sample(state->owner, entry->m_size) : NULL);
+        if (MZC3_GC_SetSample(entry, sample))
+            sample = NULL;
+    #else
+        assert(state || pad);
+        if (!s_gc_constructed || size > ~std::size_t(0) - pad)
+            return NULL;
+        char *raw = static_cast<char *>(MZC3_GC_AllocBlock(size + pad, zero));
+        if (raw == NULL)
+            return NULL;
+        void *ptr = MZC3_GC_AlignUp(raw, align);
+        const unsigned offset = static_cast<unsigned>(static_cast<char *>(ptr) - raw);
+
+        // The entry is filled in before it is indexed (see MZC3_GC_ENTRY).
+        // The rest of the padding is usable.
+        MZC3_GC_ENTRY fields;
+        MZC3_GC_InitEntry(&fields, size + pad - offset MZC3_GC_SITE_ARGS);
+        sample = (state ? MZC3_GC_Sample(state->owner, fields.m_size) : NULL);
+        MZC3_GC_SHARD *shard = MZC3_GC_ShardOf(ptr);
+        MZC3_GC_Lock(&shard->m_lock);
+        entry = NULL;
+        if (MZC3_GC_IndexReserve(&shard->m_index))
+            entry = MZC3_GC_NewEntry(shard);
+        if (entry)
+        {
+            *entry = fields;
+            entry->m_ptr = ptr;
+            entry->m_offset = offset;
+            if (MZC3_GC_SetSample(entry, sample))
+                sample = NULL;
+            MZC3_GC_IndexInsert(&shard->m_index, ptr, entry);
+        }
+        MZC3_GC_Unlock(&shard->m_lock);
+        if (entry == NULL)
+            MZC3_GC_FreeBlock(raw, size + pad);
+    #endif
+    // a sample not recorded
+    if (sample)
+        MZC3_GC_Unsample(sample, false);
+    if (entry == NULL)
+        return NULL;
+
+    if (state)
+    {
+        MZC3_GC_ListPush(state, entry);
+        MZC3_GC_CountIn(&state->owner->counters, entry->m_size, 1);
+    }
+    return entry;
+}
+
+// Reallocates the block of the entry.  Returns the new pointer, or NULL.
+// The entry must be untracked or of a section of the current thread.
+static void *MZC3_GC_ReallocEntry(MZC3_GC_ENTRY *entry, std::size_t size
+                                  MZC3_GC_SITE_PARAMS)
+{
+    using namespace std;
+    #ifdef MZC3_GC_HEADER
+        // The padding of an aligned block stays, but the alignment may not.
+        const std::size_t offset = entry->m_offset;
+        if (size > ~std::size_t(0) - MZC3_GC_HEADER_SIZE - offset)
+            return NULL;
+
+        // The header moves with the block, and the neighbours are relinked.
+        MZC3_GC_STATE *state =
+            (entry->m_state ? MZC3_GC_StateOf(entry->m_state) : NULL);
+
+        // The extras are keyed by the header, and leave it before the old
+        // block may go to another thread.
+        void *extras[MZC3_GC_EXTRA_KINDS];
+        const bool has[MZC3_GC_EXTRA_KINDS] = {
+            entry->m_has_finalizer, entry->m_has_sample
+        };
+        for (int kind = 0; kind < MZC3_GC_EXTRA_KINDS; kind++)
+        {
+            extras[kind] = (has[kind] ? MZC3_GC_GetExtra(
+                entry, static_cast<MZC3_GC_EXTRA>(kind), true) : NULL);
+        }
+
+        void *ptr = entry->m_ptr;
+        MZC3_GC_MagicOf(ptr) = 0;
+        char *newraw = static_cast<char *>(
+            MZC3_GC_ReallocBlock(reinterpret_cast<char *>(entry) - offset,
+                                 offset + MZC3_GC_HEADER_SIZE + entry->m_size,
+                                 offset + MZC3_GC_HEADER_SIZE + size));
+        MZC3_GC_ENTRY *newentry =
+            (newraw ? reinterpret_cast<MZC3_GC_ENTRY *>(newraw + offset) : entry);
+        for (int kind = 0; kind < MZC3_GC_EXTRA_KINDS; kind++)
+        {
+            // The tables may be full only if they shrank meanwhile.
+            if (has[kind] && !MZC3_GC_SetExtra(newentry,
+                    static_cast<MZC3_GC_EXTRA>(kind), extras[kind]))
+            {
+                MzcTraceA("MZC3_GC ERROR: realloc: a finalizer or a sample is lost\n");
+                if (kind == MZC3_GC_EXTRA_FINALIZER)
+                {
+                    newentry->m_has_finalizer = false;
+                    if (state)
+                        state->finalizers--;
+                }
+                else
+                {
+                    newentry->m_has_sample = false;
+                    MZC3_GC_Unsample(static_cast<MZC3_GC_SAMPLE *>(extras[kind]),
+                                     false);
+                }
+            }
+        }
+        if (newraw == NULL)
+        {
+            MZC3_GC_MagicOf(ptr) = MZC3_GC_Magic(ptr);
+            return NULL;
+        }
+
+        entry = newentry;
+        entry->m_ptr = reinterpret_cast<char *>(entry) + MZC3_GC_HEADER_SIZE;
+        MZC3_GC_MagicOf(entry->m_ptr) = MZC3_GC_Magic(entry->m_ptr);
+        const std::size_t oldsize = entry->m_size;
+        if (state)
+        {
+            state->bytes += size - entry->m_size;
+            entry->m_size = size;
+            if (MZC3_GC_ENTRY *prev = MZC3_GC_Prev(entry))
+                prev->m_next = entry;
+            else
+                state->entries = entry;
+            if (MZC3_GC_ENTRY *next = MZC3_GC_Next(entry))
+                next->m_prev = entry;
+        }
+        if (state)
+            MZC3_GC_CountResize(oldsize, size);
+    #else
+        // The padding of an aligned block stays, but the alignment may not.
+        const std::size_t offset = entry->m_offset;
+        if (size > ~std::size_t(0) - offset)
+            return NULL;
+        char *oldptr = static_cast<char *>(entry->m_ptr);
+        if (!MZC3_GC_BlockStays(oldptr - offset, offset + entry->m_size,
+                                offset + size))
+        {
+            // The old pointer leaves the registry before the block may be
+            // freed and handed out to another thread.
+            MZC3_GC_SHARD *shard = MZC3_GC_ShardOf(oldptr);
+            MZC3_GC_Lock(&shard->m_lock);
+            MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&shard->m_index, oldptr);
+            assert(slot);
+            MZC3_GC_IndexErase(&shard->m_index, slot);
+            MZC3_GC_Unlock(&shard->m_lock);
+
+            char *newraw = static_cast<char *>(
+                MZC3_GC_ReallocBlock(oldptr - offset, offset + entry->m_size,
+                                     offset + size));
+            char *newptr = (newraw ? newraw + offset : NULL);
+            if (newptr)
+                entry->m_ptr = newptr;
+
+            // An index that cannot grow is still at most half full, so the
+            // pointer fits unless the shard has no table at all.
+            shard = MZC3_GC_ShardOf(entry->m_ptr);
+            MZC3_GC_Lock(&shard->m_lock);
+            MZC3_GC_INDEX *index = &shard->m_index;
+            const bool ok = (MZC3_GC_IndexReserve(index) ||
+                             index->m_count + 1 < index->m_capacity);
+            if (ok)
+                MZC3_GC_IndexInsert(index, entry->m_ptr, entry);
+            MZC3_GC_Unlock(&shard->m_lock);
+
+            if (!ok)
+            {
+                // Give up tracking.  An untracked block must be from libc.
+                assert(newptr);
+                if (const unsigned id = entry->m_state)
+                {
+                    MZC3_GC_STATE *state = MZC3_GC_StateOf(id);
+                    MZC3_GC_ListRemove(state, entry);
+                    MZC3_GC_CountOut(&state->owner->counters, entry->m_size, 1);
+                }
+                MZC3_GC_Lock(&shard->m_lock);
+                MZC3_GC_SAMPLE *sample = MZC3_GC_RecycleEntry(shard, entry);
+                MZC3_GC_Unlock(&shard->m_lock);
+                if (sample)
+                    MZC3_GC_Unsample(sample, false);
+                if (offset == 0 && size > MZC3_GC_SLAB_MAX &&
+                    !MZC3_GC_LargeLength(newptr))
+                {
+                    return newptr;
+                }
+                void *ptr = malloc(size);
+                if (ptr)
+                    memcpy(ptr, newptr, size);
+                MZC3_GC_FreeBlock(newraw, offset + size);
+                return ptr;
+            }
+            if (newptr == NULL)
+                return NULL;
+        }
+
+        if (const unsigned id = entry->m_state)
+        {
+            const std::size_t oldsize = entry->m_size;
+            MZC3_GC_StateOf(id)->bytes += size - oldsize;
+            MZC3_GC_StoreCounter(&entry->m_size, size);
+            MZC3_GC_CountResize(oldsize, size);
+        }
+    #endif
+
+    MZC3_GC_StoreCounter(&entry->m_size, size);
+    #ifdef _DEBUG
+        MZC3_GC_StoreCounter(&entry->m_site,
+            MZC3_GC_InternSite(MZC3_GC_GetThreadEntry(), file, line));
+    #endif
+    return entry->m_ptr;
+}
+
+// Runs the finalizers of the allocations of the section, newest first.
+// The allocations stay linked meanwhile, so that a finalizer can free any
+// of them but its own.
+static void MZC3_GC_Finalize(MZC3_GC_STATE *state)
+{
+    bool ran = true;
+    while (state->finalizers && ran)
+    {
+        // Another pass is for the allocations of the finalizers.
+        ran = false;
+        for (MZC3_GC_ENTRY *e = state->entries; e && state->finalizers; )
+        {
+            if (e->m_has_finalizer)
+            {
+                MZC3_GC_FINALIZER finalizer = MZC3_GC_FinalizerOf(
+                    MZC3_GC_GetExtra(e, MZC3_GC_EXTRA_FINALIZER, true));
+                void *ptr = e->m_ptr;
+                e->m_has_finalizer = false;
+                state->finalizers--;
+                finalizer(ptr);
+                ran = true;
+            }
+            e = MZC3_GC_Next(e);
+        }
+    }
+}
+
+// Frees the allocations of the section.
+static void MZC3_GC_CollectState(MZC3_GC_STATE *state)
+{
+    MZC3_GC_DrainRemote(state->owner);
+    MZC3_GC_Finalize(state);
+    const std::size_t arena_bytes = state->arena_bytes;
+    MZC3_GC_ArenaRelease(state);
+
+    MZC3_GC_ENTRY *entry = state->entries;
+    const std::size_t bytes = state->bytes;
+    state->entries = NULL;
+    state->bytes = 0;
+    state->finalizers = 0;
+
+    MZC3_GC_COUNTERS *c = &state->owner->counters;
+    while (entry)
+    {
+        MZC3_GC_ENTRY *next = MZC3_GC_Next(entry);
+        MZC3_GC_CountFree(c, entry->m_depth, entry->m_size, true);
+        MZC3_GC_ReleaseEntry(entry, true);
+        entry = next;
+    }
+
+    MZC3_GC_MaybeTrim(bytes + arena_bytes);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// conservative marking (see MzcGC_EnterConservative)
+//
+// The candidates are the allocations of a conservative section.  The roots
+// are the stack and the registers of its thread, the registered ranges, and
+// the allocations and the arena chunks of the outer sections of the thread.
+// Any aligned word pointing into a candidate keeps it.  In multithread mode,
+// the other registered threads are stopped while marking, and their stacks
+// and registers are roots too (see MZC3_GC_StopThreads).
+
+// The minimum bytes allocated between periodic markings
+static const std::size_t MZC3_GC_MARK_THRESHOLD = 0x100000;
+
+#if defined(__GNUC__)
+    // The stack scan reads the redzones of ASan, and the stacks of the
+    // stopped threads.
+    #define MZC3_GC_NO_SANITIZE     \
+        __attribute__((no_sanitize_address, no_sanitize_thread))
+    #define MZC3_GC_NOINLINE        __attribute__((noinline))
+#elif defined(_MSC_VER)
+    #define MZC3_GC_NO_SANITIZE     /*empty*/
+    #define MZC3_GC_NOINLINE        __declspec(noinline)
+#else
+    #define MZC3_GC_NO_SANITIZE     /*empty*/
+    #define MZC3_GC_NOINLINE        /*empty*/
+#endif
+
+struct MZC3_GC_MARK
+{
+    const char *    m_begin;
+    const char *    m_end;
+    MZC3_GC_ENTRY * m_entry;
+    bool            m_marked;
+};
+
+struct MZC3_GC_MARKER
+{
+    MZC3_GC_MARK *  m_marks;    // the candidates sorted by m_begin
+    std::size_t     m_count;
+    const char *    m_low;      // the range of the candidates
+    const char *    m_high;
+    std::size_t *   m_pending;  // marked but not scanned (at most m_count)
+    std::size_t     m_npending;
+};
+
+static int MZC3_GC_CompareMarks(const void *a, const void *b)
+{
+    const char *x = static_cast<const MZC3_GC_MARK *>(a)->m_begin;
+    const char *y = static_cast<const MZC3_GC_MARK *>(b)->m_begin;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+// Returns the last candidate beginning at or before p.  p must be in
+// [m_low, m_high).
+inline std::size_t MZC3_GC_FindMark(MZC3_GC_MARKER *marker, const char *p)
+{
+    std::size_t lo = 0, hi = marker->m_count;
+    while (hi - lo > 1)
+    {
+        const std::size_t mid = (lo + hi) / 2;
+        if (marker->m_marks[mid].m_begin <= p)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Marks the candidate that p points into, if any.
+inline void MZC3_GC_MarkPointer(MZC3_GC_MARKER *marker, const char *p)
+{
+    if (p < marker->m_low || p >= marker->m_high)
+        return;
+
+    const std::size_t i = MZC3_GC_FindMark(marker, p);
+    MZC3_GC_MARK *mark = &marker->m_marks[i];
+    if (mark->m_marked || p < mark->m_begin ||
+        (p >= mark->m_end && p != mark->m_begin))
+    {
+        return;
+    }
+    mark->m_marked = true;
+    marker->m_pending[marker->m_npending++] = i;
+}
+
+// Marks from the aligned words in [begin, end).
+static MZC3_GC_NO_SANITIZE void
+MZC3_GC_MarkRange(MZC3_GC_MARKER *marker, const void *begin, const void *end)
+{
+    const char *p = reinterpret_cast<const char *>(
+        MZC3_GC_RoundUp(reinterpret_cast<std::size_t>(begin), sizeof(void *)));
+    for (; p + sizeof(void *) <= end; p += sizeof(void *))
+        MZC3_GC_MarkPointer(marker, *reinterpret_cast<const char * const *>(p));
+}
+
+// Returns the upper end of the stack of the current thread, or NULL.
+static const char *MZC3_GC_StackBase(void)
+{
+    #ifdef _WIN32
+        return reinterpret_cast<const char *>(
+            reinterpret_cast<NT_TIB *>(NtCurrentTeb())->StackBase);
+    #elif defined(__GLIBC__)
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0)
+            return NULL;
+        void *addr;
+        std::size_t size;
+        const bool ok = (pthread_attr_getstack(&attr, &addr, &size) == 0);
+        pthread_attr_destroy(&attr);
+        return (ok ? static_cast<const char *>(addr) + size : NULL);
+    #elif defined(__APPLE__)
+        return static_cast<const char *>(pthread_get_stackaddr_np(pthread_self()));
+    #else
+        return NULL;
+    #endif
+}
+
+// Marks from the other roots than the stacks: the registered roots and the
+// other sections of the thread, the inner ones too, since a budget may
+// collect state under them.  Needs s_gc_roots_lock.
+static void MZC3_GC_MarkRoots(MZC3_GC_MARKER *marker, MZC3_GC_STATE *state)
+{
+    for (std::size_t i = 0; i < s_gc_roots_count; i++)
+        MZC3_GC_MarkRange(marker, s_gc_roots[i].m_begin, s_gc_roots[i].m_end);
+
+    // The arena chunks of the section itself are from MzcGC_SectionAlloc,
+    // such as the nodes of the containers of MzcGCAllocator.
+    for (MZC3_GC_STATE *s = MZC3_GC_Top(state->owner); s; s = MZC3_GC_Outer(s))
+    {
+        if (s != state)
+        {
+            for (MZC3_GC_ENTRY *e = s->entries; e; e = MZC3_GC_Next(e))
+            {
+                const char *ptr = static_cast<const char *>(e->m_ptr);
+                MZC3_GC_MarkRange(marker, ptr, ptr + e->m_size);
+            }
+        }
+        for (MZC3_GC_ARENA_CHUNK *chunk = s->arena_chunks; chunk;
+             chunk = chunk->m_next)
+        {
+            MZC3_GC_MarkRange(marker, MZC3_GC_ArenaData(chunk),
+                              (chunk == s->arena_chunks ? s->arena_ptr
+                                                        : chunk->m_end));
+        }
+    }
+}
+
+#ifdef MZC3_GC_MT
+    // another thread stopped while marking
+    struct MZC3_GC_STOPPED
+    {
+        MZC3_GC_THREAD_ENTRY *  m_thread;   // NULL if failed to stop
+        const char *            m_top;      // the stack top, or NULL if unknown
+        #ifdef _WIN32
+            HANDLE              m_handle;
+            CONTEXT             m_context;  // the registers
+        #endif
+    };
+
+    #ifndef _WIN32
+        // A signal stops a thread in its handler, which leaves its registers
+        // on the stack, until the next one.
+        #ifndef MZC3_GC_SIG_SUSPEND
+            #ifdef SIGPWR
+                #define MZC3_GC_SIG_SUSPEND SIGPWR
+            #else
+                #define MZC3_GC_SIG_SUSPEND SIGXCPU
+            #endif
+        #endif
+
+        // odd while stopping the threads (written under s_gc_cs)
+        static unsigned s_gc_stop_epoch = 0;
+        static pthread_once_t s_gc_stop_once = PTHREAD_ONCE_INIT;
+        static bool s_gc_stop_ok = false;
+
+        static void MZC3_GC_SuspendHandler(int)
+        {
+            const int saved_errno = errno;
+            const unsigned epoch = MZC3_GC_LoadCounter(&s_gc_stop_epoch);
+            if (epoch & 1)
+            {
+                // The threads are not added nor removed while stopping.
+                MZC3_GC_THREAD_ENTRY *self = s_gc_thread_entries;
+                while (self && !pthread_equal(self->handle, pthread_self()))
+                    self = self->next;
+
+                // The signal that resumes the thread reenters here.
+                if (self && MZC3_GC_LoadPtr(&self->stop_top) == NULL)
+                {
+                    std::jmp_buf regs;
+                    setjmp(regs);
+                    MZC3_GC_StorePtr(&self->stop_top,
+                                     reinterpret_cast<const char *>(&regs));
+
+                    sigset_t mask;
+                    pthread_sigmask(SIG_BLOCK, NULL, &mask);
+                    sigdelset(&mask, MZC3_GC_SIG_SUSPEND);
+                    while (MZC3_GC_LoadCounter(&s_gc_stop_epoch) == epoch)
+                        sigsuspend(&mask);
+                }
+            }
+            errno = saved_errno;
+        }
+
+        static void MZC3_GC_InitStop(void)
+        {
+            using namespace std;
+            struct sigaction act;
+            memset(&act, 0, sizeof(act));
+            act.sa_handler = MZC3_GC_SuspendHandler;
+            act.sa_flags = SA_RESTART;
+            sigemptyset(&act.sa_mask);
+            s_gc_stop_ok = (sigaction(MZC3_GC_SIG_SUSPEND, &act, NULL) == 0);
+        }
+    #endif
+
+    // Returns the threads registered.  Needs s_gc_cs.
+    static std::size_t MZC3_GC_CountThreads(void)
+    {
+        std::size_t count = 0;
+        for (MZC3_GC_THREAD_ENTRY *e = s_gc_thread_entries; e; e = e->next)
+            count++;
+        return count;
+    }
+
+    // Stops the registered threads but self, until MZC3_GC_ResumeThreads.
+    // Needs s_gc_cs, and no other lock that they may wait for, and nothing
+    // may allocate meanwhile.  Returns the count of stopped.
+    static std::size_t MZC3_GC_StopThreads(MZC3_GC_STOPPED *stopped,
+                                           MZC3_GC_THREAD_ENTRY *self)
+    {
+        #ifndef _WIN32
+            pthread_once(&s_gc_stop_once, MZC3_GC_InitStop);
+            if (!s_gc_stop_ok)
+                return 0;
+        #endif
+
+        std::size_t count = 0;
+        for (MZC3_GC_THREAD_ENTRY *e = s_gc_thread_entries; e; e = e->next)
+        {
+            if (e == self || e->stack_base == NULL)
+                continue;
+            stopped[count].m_thread = e;
+            stopped[count].m_top = NULL;
+            count++;
+        }
+        if (count == 0)
+            return 0;
+
+        #ifdef _WIN32
+            for (std::size_t i = 0; i < count; i++)
+            {
+                MZC3_GC_STOPPED *s = &stopped[i];
+                s->m_handle = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT,
+                                         FALSE, s->m_thread->thread_id);
+                if (s->m_handle && SuspendThread(s->m_handle) == DWORD(-1))
+                {
+                    CloseHandle(s->m_handle);
+                    s->m_handle = NULL;
+                }
+                if (s->m_handle == NULL)
+                {
+                    s->m_thread = NULL;
+                    continue;
+                }
+
+                // It returns after the thread has stopped.
+                s->m_context.ContextFlags = CONTEXT_INTEGER | CONTEXT_CONTROL;
+                if (GetThreadContext(s->m_handle, &s->m_context))
+                {
+                    #if defined(_M_X64) || defined(_M_AMD64)
+                        s->m_top = reinterpret_cast<const char *>(s->m_context.Rsp);
+                    #elif defined(_M_IX86)
+                        s->m_top = reinterpret_cast<const char *>(s->m_context.Esp);
+                    #elif defined(_M_ARM64) || defined(_M_ARM)
+                        s->m_top = reinterpret_cast<const char *>(s->m_context.Sp);
+                    #endif
+                }
+            }
+        #else
+            for (std::size_t i = 0; i < count; i++)
+                MZC3_GC_StorePtr(&stopped[i].m_thread->stop_top,
+                                 static_cast<const char *>(NULL));
+            MZC3_GC_StoreCounter(&s_gc_stop_epoch, s_gc_stop_epoch + 1);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (pthread_kill(stopped[i].m_thread->handle,
+                                 MZC3_GC_SIG_SUSPEND) != 0)
+                {
+                    stopped[i].m_thread = NULL;
+                }
+            }
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (stopped[i].m_thread == NULL)
+                    continue;
+                const char *top;
+                while ((top = MZC3_GC_LoadPtr(&stopped[i].m_thread->stop_top)) == NULL)
+                    sched_yield();
+                stopped[i].m_top = top;
+            }
+        #endif
+        return count;
+    }
+
+    static void MZC3_GC_ResumeThreads(MZC3_GC_STOPPED *stopped, std::size_t count)
+    {
+        #ifdef _WIN32
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (stopped[i].m_thread)
+                {
+                    ResumeThread(stopped[i].m_handle);
+                    CloseHandle(stopped[i].m_handle);
+                }
+            }
+        #else
+            if (count == 0)
+                return;
+            MZC3_GC_StoreCounter(&s_gc_stop_epoch, s_gc_stop_epoch + 1);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (stopped[i].m_thread)
+                    pthread_kill(stopped[i].m_thread->handle, MZC3_GC_SIG_SUSPEND);
+            }
+        #endif
+    }
+
+    // Marks from the stacks and the registers of the stopped threads.
+    static void MZC3_GC_MarkStopped(MZC3_GC_MARKER *marker,
+                                    const MZC3_GC_STOPPED *stopped,
+                                    std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            if (stopped[i].m_thread == NULL)
+                continue;
+            #ifdef _WIN32
+                MZC3_GC_MarkRange(marker, &stopped[i].m_context,
+                                  &stopped[i].m_context + 1);
+            #endif
+            if (stopped[i].m_top)
+            {
+                MZC3_GC_MarkRange(marker, stopped[i].m_top,
+                                  stopped[i].m_thread->stack_base);
+            }
+        }
+    }
+#endif
+
+// Frees the unreachable allocations of the conservative section.  Frees
+// nothing if out of memory.  The stack is scanned from stack_top up.
+static MZC3_GC_NOINLINE void
+MZC3_GC_DoMarkSweep(MZC3_GC_STATE *state, const char *stack_top)
+{
+    using namespace std;
+    MZC3_GC_THREAD_ENTRY *thread = state->owner;
+    if (thread->stack_base == NULL)
+        thread->stack_base = MZC3_GC_StackBase();
+    state->allocated = 0;
+    if (thread->stack_base == NULL)
+        return;
+
+    // The blocks freed by other threads are no candidates.
+    MZC3_GC_DrainRemote(thread);
+
+    MZC3_GC_MARKER marker;
+    marker.m_count = 0;
+    for (MZC3_GC_ENTRY *e = state->entries; e; e = MZC3_GC_Next(e))
+        marker.m_count++;
+    marker.m_marks = reinterpret_cast<MZC3_GC_MARK *>(
+        malloc(marker.m_count * sizeof(MZC3_GC_MARK)));
+    marker.m_pending = reinterpret_cast<std::size_t *>(
+        malloc(marker.m_count * sizeof(std::size_t)));
+    marker.m_npending = 0;
+
+    // s_gc_cs keeps the other threads registered.
+    EnterLock();
+    #ifdef MZC3_GC_MT
+        MZC3_GC_STOPPED *stopped = reinterpret_cast<MZC3_GC_STOPPED *>(
+            malloc(MZC3_GC_CountThreads() * sizeof(MZC3_GC_STOPPED)));
+    #endif
+
+    // The unreachable ones move to a temporary section, to be collected
+    // with their finalizers.
+    MZC3_GC_STATE limbo;
+    memset(&limbo, 0, sizeof(limbo));
+    limbo.owner = thread;
+    limbo.gc_enabled = 1;
+    if (marker.m_count && marker.m_marks && marker.m_pending &&
+        #ifdef MZC3_GC_MT
+            stopped &&
+        #endif
+        MZC3_GC_AddState(&limbo))
+    {
+        std::size_t i = 0;
+        for (MZC3_GC_ENTRY *e = state->entries; e; e = MZC3_GC_Next(e), i++)
+        {
+            marker.m_marks[i].m_begin = static_cast<const char *>(e->m_ptr);
+            marker.m_marks[i].m_end = marker.m_marks[i].m_begin + e->m_size;
+            marker.m_marks[i].m_entry = e;
+            marker.m_marks[i].m_marked = false;
+        }
+        qsort(marker.m_marks, marker.m_count, sizeof(MZC3_GC_MARK),
+              MZC3_GC_CompareMarks);
+        marker.m_low = marker.m_marks[0].m_begin;
+        marker.m_high = marker.m_marks[marker.m_count - 1].m_end + 1;
+
+        // Taken before stopping, since a stopped thread would keep it.
+        MZC3_GC_Lock(&s_gc_roots_lock);
+        #ifdef MZC3_GC_MT
+            const std::size_t nstopped = MZC3_GC_StopThreads(stopped, thread);
+            MZC3_GC_MarkStopped(&marker, stopped, nstopped);
+        #endif
+        MZC3_GC_MarkRange(&marker, stack_top, thread->stack_base);
+        MZC3_GC_MarkRoots(&marker, state);
+        while (marker.m_npending)
+        {
+            const MZC3_GC_MARK *mark =
+                &marker.m_marks[marker.m_pending[--marker.m_npending]];
+            MZC3_GC_MarkRange(&marker, mark->m_begin, mark->m_end);
+        }
+        #ifdef MZC3_GC_MT
+            MZC3_GC_ResumeThreads(stopped, nstopped);
+        #endif
+        MZC3_GC_Unlock(&s_gc_roots_lock);
+
+        // The oldest is pushed first to keep the order.
+        MZC3_GC_ENTRY *e = MZC3_GC_Oldest(state);
+        while (e)
+        {
+            MZC3_GC_ENTRY *prev = MZC3_GC_Prev(e);
+            const char *ptr = static_cast<const char *>(e->m_ptr);
+            if (!marker.m_marks[MZC3_GC_FindMark(&marker, ptr)].m_marked)
+            {
+                MZC3_GC_ListRemove(state, e);
+                MZC3_GC_ListPush(&limbo, e);
+            }
+            e = prev;
+        }
+    }
+
+    state->collect_at = state->bytes;
+    if (state->collect_at < MZC3_GC_MARK_THRESHOLD)
+        state->collect_at = MZC3_GC_MARK_THRESHOLD;
+
+    #ifdef MZC3_GC_MT
+        free(stopped);
+    #endif
+    LeaveLock();
+    free(marker.m_marks);
+    free(marker.m_pending);
+
+    MZC3_GC_CollectState(&limbo);
+    if (limbo.id)
+        MZC3_GC_RemoveState(&limbo);
+}
+
+// The registers are spilled into this frame, and the stack is scanned from
+// here, without the stale slots in the frames of the marking.
+static void MZC3_GC_MarkSweep(MZC3_GC_STATE *state)
+{
+    std::jmp_buf regs;
+    #ifdef __GNUC__
+        __builtin_unwind_init();    // spill the callee-saved registers
+    #endif
+    setjmp(regs);
+    MZC3_GC_DoMarkSweep(state, reinterpret_cast<const char *>(&regs));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// budgets (see MzcGC_SetBudget)
+//
+// A budget of a section limits the bytes of the section and its inner
+// sections: their tracked blocks and their arena chunks.
+
+// the handler of MZC_GC_BUDGET_CALLBACK, or NULL
+static MZC_GC_BUDGET_HANDLER s_gc_budget_handler = NULL;
+
+// Returns the bytes of the section.
+inline std::size_t MZC3_GC_StateBytes(MZC3_GC_STATE *state)
+{
+    return state->bytes + state->arena_bytes;
+}
+
+// Returns the bytes of the sections from the top to last.
+static std::size_t MZC3_GC_BudgetUsed(MZC3_GC_THREAD_ENTRY *thread,
+                                      MZC3_GC_STATE *last)
+{
+    std::size_t used = 0;
+    for (MZC3_GC_STATE *state = MZC3_GC_Top(thread); state;
+         state = MZC3_GC_Outer(state))
+    {
+        used += MZC3_GC_StateBytes(state);
+        if (state == last)
+            break;
+    }
+    return used;
+}
+
+// Applies the policy of the budget of state, which size bytes more would
+// overrun.  Returns true if the allocation may go on.  used is updated.
+static bool MZC3_GC_Overrun(MZC3_GC_THREAD_ENTRY *thread, MZC3_GC_STATE *state,
+                            std::size_t *used, std::size_t size)
+{
+    switch (state->budget_policy)
+    {
+    case MZC_GC_BUDGET_CALLBACK:
+        {
+            MZC_GC_BUDGET_HANDLER handler =
+                MZC3_GC_LoadCounter(&s_gc_budget_handler);
+            return (handler && (*handler)(*used, size, state->budget));
+        }
+
+    case MZC_GC_BUDGET_COLLECT:
+        // Only the unreachable blocks of the conservative sections may go
+        // before leaving.
+        for (MZC3_GC_STATE *inner = MZC3_GC_Top(thread); inner;
+             inner = MZC3_GC_Outer(inner))
+        {
+            if (inner->conservative && s_gc_constructed)
+            {
+                const double start = MZC3_GC_Now();
+                MZC3_GC_MarkSweep(inner);
+                MZC3_GC_CountCollection(&thread->counters, start);
+            }
+            if (inner == state)
+                break;
+        }
+        *used = MZC3_GC_BudgetUsed(thread, state);
+        return (*used <= state->budget && size <= state->budget - *used);
+
+    default:
+        return false;
+    }
+}
+
+// Returns false if size bytes more in the current section would overrun a
+// budget that its policy does not let pass.
+static bool MZC3_GC_CheckBudget(MZC3_GC_THREAD_ENTRY *thread, std::size_t size)
+{
+    // The allocations of a handler or a finalizer are let pass.
+    if (thread == NULL || thread->budgets == 0 || thread->in_overrun)
+        return true;
+
+    thread->in_overrun = 1;
+    bool ok = true;
+    std::size_t used = 0;
+    std::size_t left = thread->budgets;
+    for (MZC3_GC_STATE *state = MZC3_GC_Top(thread); state && left;
+         state = MZC3_GC_Outer(state))
+    {
+        used += MZC3_GC_StateBytes(state);
+        if (state->budget == 0)
+            continue;
+
+        left--;
+        if (used > state->budget || size > state->budget - used)
+        {
+            if (!MZC3_GC_Overrun(thread, state, &used, size))
+            {
+                ok = false;
+                break;
+            }
+        }
+    }
+    thread->in_overrun = 0;
+
+    #ifdef _DEBUG
+        if (!ok)
+            MzcTraceA("MZC3_GC: budget exceeded (%lu bytes more)\n",
+                      static_cast<unsigned long>(size));
+    #endif
+    return ok;
+}
+
+// Moves the allocations of the section to the outer section, or untracks
+// them if the outer section is not GC-enabled.  Untracked blocks stay in the
+// hash index until freed.
+static void MZC3_GC_PassOut(MZC3_GC_STATE *state)
+{
+    MZC3_GC_STATE *outer = MZC3_GC_Outer(state);
+    if (outer && !outer->gc_enabled)
+        outer = NULL;
+
+    // The oldest is pushed first to keep the order.
+    const std::size_t bytes = state->bytes;
+    std::size_t blocks = 0;
+    MZC3_GC_ENTRY *entry = MZC3_GC_Oldest(state);
+    while (entry)
+    {
+        MZC3_GC_ENTRY *prev = MZC3_GC_Prev(entry);
+        MZC3_GC_ListRemove(state, entry);
+        if (outer)
+        {
+            MZC3_GC_StoreCounter(&entry->m_depth, entry->m_depth - 1);
+            MZC3_GC_ListPush(outer, entry);
+        }
+        blocks++;
+        entry = prev;
+    }
+
+    if (outer == NULL)
+        MZC3_GC_CountOut(&state->owner->counters, bytes, blocks);
+}
+
+// Moves the block to the section levels outer than its own in O(1), or
+// untracks it if there is no such section or it is not GC-enabled.  Only
+// the thread of the section may move the block.  Returns false if ptr is
+// not tracked by the current thread.
+static bool MZC3_GC_Promote(void *ptr, std::size_t levels)
+{
+    if (ptr == NULL || MZC3_GC_ArenaFind(ptr))
+        return false;
+
+    MZC3_GC_THREAD_ENTRY *thread = MZC3_GC_GetThreadEntry();
+    MZC3_GC_ENTRY *entry = MZC3_GC_Find(ptr);
+    const unsigned id = (entry ? MZC3_GC_LoadCounter(&entry->m_state) : 0);
+    if (thread == NULL || MZC3_GC_StateThread(id) != thread->id + 1)
+        return false;
+    MZC3_GC_STATE *state = MZC3_GC_StateOf(id);
+    if (levels == 0)
+        return true;
+
+    MZC3_GC_STATE *outer = state;
+    std::size_t depth = entry->m_depth;
+    for (; outer && levels; levels--, depth--)
+        outer = MZC3_GC_Outer(outer);
+    if (outer && !outer->gc_enabled)
+        outer = NULL;
+
+    MZC3_GC_ListRemove(state, entry);
+    if (outer)
+    {
+        MZC3_GC_StoreCounter(&entry->m_depth, static_cast<unsigned>(depth));
+        MZC3_GC_ListPush(outer, entry);
+    }
+    else
+    {
+        MZC3_GC_CountOut(&thread->counters, entry->m_size, 1);
+    }
+    return true;
+}
+
+// Frees the allocations of the current section only.  In a conservative
+// section, only the unreachable ones.
+static void MZC3_GC_GarbageCollect(void)
+{
+    MZC3_GC_STATE *state = MZC3_GC_GetState();
+    if (state == NULL || !s_gc_constructed)
+        return;
+
+    const double start = MZC3_GC_Now();
+    if (state->conservative)
+        MZC3_GC_MarkSweep(state);
+    else
+        MZC3_GC_CollectState(state);
+    MZC3_GC_CountCollection(&state->owner->counters, start);
+}
+
+#ifdef MZC3_GC_MT
+    // Frees the allocations in the batch, and the batch.
+    static void MZC3_GC_FreeBatch(MZC3_GC_BATCH *batch)
+    {
+        MZC3_GC_COUNTERS *c = MZC3_GC_GetCounters();
+        MZC3_GC_ArenaFreeChunks(batch->m_arena_chunks, c);
+
+        MZC3_GC_ENTRY *entry = batch->m_entries;
+        while (entry)
+        {
+            MZC3_GC_ENTRY *next = MZC3_GC_Next(entry);
+            if (c)
+                MZC3_GC_CountFree(c, entry->m_depth, entry->m_size, true);
+            MZC3_GC_ReleaseEntry(entry, true);
+            entry = next;
+        }
+
+        const std::size_t bytes = batch->m_bytes;
+        free(batch);
+        MZC3_GC_MaybeTrim(bytes);
+    }
+
+    // Detaches the allocations of the section in O(1) and hands them to
+    // the collector.  If the backlog is full, frees them by itself.
+    // Returns false if the collector is not running.
+    static bool MZC3_GC_HandOff(MZC3_GC_STATE *state)
+    {
+        if (!s_gc_collector_running)
+            return false;
+
+        MZC3_GC_BATCH *batch =
+            reinterpret_cast<MZC3_GC_BATCH *>(malloc(sizeof(MZC3_GC_BATCH)));
+        if (batch == NULL)
+            return false;
+
+        batch->m_entries = state->entries;
+        batch->m_bytes = state->bytes;
+        state->entries = NULL;
+        state->bytes = 0;
+
+        batch->m_arena_chunks = state->arena_chunks;
+        for (MZC3_GC_ARENA_CHUNK *chunk = state->arena_chunks; chunk;
+             chunk = chunk->m_next)
+        {
+            batch->m_bytes += chunk->m_end - reinterpret_cast<char *>(chunk);
+        }
+        state->arena_chunks = NULL;
+        state->arena_ptr = NULL;
+        state->arena_last = NULL;
+        state->arena_bytes = 0;
+
+        MZC3_GC_Lock(&s_gc_collector_lock);
+        const bool ok = (s_gc_collector_running && !s_gc_collector_stopping &&
+                         s_gc_backlog + batch->m_bytes <= s_gc_max_backlog);
+        if (ok)
+        {
+            batch->m_next = s_gc_batches;
+            s_gc_batches = batch;
+            s_gc_backlog += batch->m_bytes;
+            MZC3_GC_WakeAll(&s_gc_collector_wake);
+        }
+        MZC3_GC_Unlock(&s_gc_collector_lock);
+
+        if (!ok)
+            MZC3_GC_FreeBatch(batch);
+        return true;
+    }
+
+    // The body of the collector thread
+    static void MZC3_GC_CollectorMain(void)
+    {
+        MZC3_GC_Lock(&s_gc_collector_lock);
+        for (;;)
+        {
+            while (s_gc_batches == NULL && !s_gc_collector_stopping)
+                MZC3_GC_Wait(&s_gc_collector_wake, &s_gc_collector_lock);
+
+            MZC3_GC_BATCH *batch = s_gc_batches;
+            if (batch == NULL)
+                break;  // stopping and drained
+
+            s_gc_batches = NULL;
+            s_gc_collector_busy = true;
+            MZC3_GC_Unlock(&s_gc_collector_lock);
+
+            // The collections were counted by the threads that left.
+            const double start = MZC3_GC_Now();
+            std::size_t bytes = 0;
+            while (batch)
+            {
+                MZC3_GC_BATCH *next = batch->m_next;
+                bytes += batch->m_bytes;
+                MZC3_GC_FreeBatch(batch);
+                batch = next;
+            }
+            if (MZC3_GC_COUNTERS *c = MZC3_GC_GetCounters())
+                MZC3_GC_AddCounter(&c->collect_seconds, MZC3_GC_Now() - start);
+
+            MZC3_GC_Lock(&s_gc_collector_lock);
+            s_gc_backlog -= bytes;
+            s_gc_collector_busy = false;
+            if (s_gc_batches == NULL)
+                MZC3_GC_WakeAll(&s_gc_collector_idle);
+        }
+        MZC3_GC_Unlock(&s_gc_collector_lock);
+    }
+
+    #ifdef _WIN32
+        static DWORD WINAPI MZC3_GC_CollectorProc(LPVOID)
+        {
+            MZC3_GC_CollectorMain();
+            return 0;
+        }
+    #else
+        static void *MZC3_GC_CollectorProc(void *)
+        {
+            MZC3_GC_CollectorMain();
+            return NULL;
+        }
+    #endif
+
+    static bool MZC3_GC_StartCollector(std::size_t max_backlog)
+    {
+        bool ok = true;
+        MZC3_GC_Lock(&s_gc_collector_lock);
+        if (!s_gc_collector_running && !s_gc_collector_stopping)
+        {
+            #ifdef _WIN32
+                s_gc_collector_thread =
+                    CreateThread(NULL, 0, MZC3_GC_CollectorProc, NULL, 0, NULL);
+                ok = (s_gc_collector_thread != NULL);
+            #else
+                ok = (pthread_create(&s_gc_collector_thread, NULL,
+                                     MZC3_GC_CollectorProc, NULL) == 0);
+            #endif
+            s_gc_collector_running = ok;
+        }
+        if (ok)
+            s_gc_max_backlog = (max_backlog ? max_backlog : MZC3_GC_DEFAULT_MAX_BACKLOG);
+        MZC3_GC_Unlock(&s_gc_collector_lock);
+        return ok;
+    }
+
+    // Waits until the collector has nothing to do.
+    static void MZC3_GC_Drain(void)
+    {
+        MZC3_GC_Lock(&s_gc_collector_lock);
+        while (s_gc_batches || s_gc_collector_busy)
+            MZC3_GC_Wait(&s_gc_collector_idle, &s_gc_collector_lock);
+        MZC3_GC_Unlock(&s_gc_collector_lock);
+    }
+
+    // Drains and joins the collector.
+    static void MZC3_GC_StopCollector(void)
+    {
+        MZC3_GC_Lock(&s_gc_collector_lock);
+        if (!s_gc_collector_running || s_gc_collector_stopping)
+        {
+            MZC3_GC_Unlock(&s_gc_collector_lock);
+            return;
+        }
+        s_gc_collector_stopping = true;
+        MZC3_GC_WakeAll(&s_gc_collector_wake);
+        MZC3_GC_Unlock(&s_gc_collector_lock);
+
+        #ifdef _WIN32
+            WaitForSingleObject(s_gc_collector_thread, INFINITE);
+            CloseHandle(s_gc_collector_thread);
+            s_gc_collector_thread = NULL;
+        #else
+            pthread_join(s_gc_collector_thread, NULL);
+        #endif
+
+        MZC3_GC_Lock(&s_gc_collector_lock);
+        s_gc_collector_running = false;
+        s_gc_collector_stopping = false;
+        MZC3_GC_Unlock(&s_gc_collector_lock);
+    }
+
+    // Returns the peak of the counts peaking at peak, then from net, which
+    // may be negative, up to net + next.
+    inline std::size_t MZC3_GC_PeakAfter(std::size_t peak, std::size_t net,
+                                         std::size_t next)
+    {
+        const std::ptrdiff_t value = static_cast<std::ptrdiff_t>(net + next);
+        return (value > static_cast<std::ptrdiff_t>(peak) ? std::size_t(value) : peak);
+    }
+
+    // Called on thread exit.  Collects the sections left open by the thread.
+    static void MZC3_GC_ThreadExit(void *data)
+    {
+        MZC3_GC_THREAD_ENTRY *entry =
+            reinterpret_cast<MZC3_GC_THREAD_ENTRY *>(data);
+        #ifdef MZC3_GC_TLS
+            if (mzc3_gc_stack == &entry->stack)
+                mzc3_gc_stack = NULL;
+        #endif
+        if (!s_gc_constructed)
+        {
+            // MZC3_GC_MGR has released everything but the entry.
+            #ifdef MZC3_GC_THREAD_CACHE
+                if (entry->slab_cache)
+                    MZC3_GC_SlabCacheRelease(entry->slab_cache);
+            #endif
+            free(entry);
+            return;
+        }
+
+        // s_gc_cs keeps MZC3_GC_MGR from releasing the entry meanwhile.
+        EnterLock();
+        if (entry->stack.top)
+            MzcTraceA("MZC3_GC: thread exited in a GC section\n");
+        for (MZC3_GC_STATE *state = MZC3_GC_Top(entry); state;
+             state = MZC3_GC_Outer(state))
+        {
+            MZC3_GC_CollectState(state);
+        }
+        MZC3_GC_FreeStates(entry);
+
+        if (entry->prev)
+            entry->prev->next = entry->next;
+        else
+            s_gc_thread_entries = entry->next;
+        if (entry->next)
+            entry->next->prev = entry->prev;
+
+        // The exited threads count as one that ran them in turn.
+        MZC3_GC_COUNTERS *exited = &s_gc_exited_counters;
+        const MZC3_GC_COUNTERS before = *exited;
+        MZC3_GC_SumCounters(exited, &entry->counters);
+        exited->peak_bytes = MZC3_GC_PeakAfter(before.peak_bytes,
+            before.bytes_in - before.bytes_out, entry->counters.peak_bytes);
+        exited->peak_blocks = MZC3_GC_PeakAfter(before.peak_blocks,
+            before.blocks_in - before.blocks_out, entry->counters.peak_blocks);
+        LeaveLock();
+
+        #ifdef MZC3_GC_THREAD_CACHE
+            if (entry->slab_cache)
+                MZC3_GC_SlabCacheRelease(entry->slab_cache);
+        #endif
+        free(entry);
+    }
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC3_GC_Malloc, MZC3_GC_Realloc, MZC3_GC_Free
+
+// Allocates size bytes aligned to align, a power of two.  If arena is
+// false, the block is tracked even in an arena section.
+static void *MZC3_GC_MallocAligned(std::size_t size, std::size_t align,
+                                   bool zero, bool arena MZC3_GC_SITE_PARAMS)
+{
+    using namespace std;
+    MZC3_GC_STATE *state = MZC3_GC_GetState();
+    if (state)
+    {
+        MZC3_GC_THREAD_ENTRY *thread = state->owner;
+        const std::size_t slot = MZC3_GC_DepthSlot(thread->stack.depth);
+        MZC3_GC_AddCounter(&thread->counters.allocs[slot], std::size_t(1));
+        MZC3_GC_DrainRemote(thread);
+    }
+
+    if (state && state->arena_chunk_size && arena)
+    {
+        void *ptr = MZC3_GC_ArenaAllocAligned(state, size, align);
+        if (ptr && zero)
+            memset(ptr, 0, size);
+        return ptr;
+    }
+
+    if (state && !state->gc_enabled)
+        state = NULL;
+
+    if (state && state->conservative && s_gc_constructed)
+    {
+        // Mark before the new block exists, since nothing points to it yet.
+        state->allocated += size;
+        if (state->allocated >= state->collect_at)
+        {
+            const double start = MZC3_GC_Now();
+            MZC3_GC_MarkSweep(state);
+            MZC3_GC_CountCollection(&state->owner->counters, start);
+        }
+
+        // Stale pointers in uninitialized memory would keep garbage.
+        zero = true;
+    }
+
+    if (state && !MZC3_GC_CheckBudget(state->owner, size))
+        return NULL;
+
+    #ifdef MZC3_GC_HEADER
+        if (!s_gc_constructed)
+            state = NULL;
+
+        MZC3_GC_ENTRY *entry =
+            MZC3_GC_AllocEntry(state, size, align, zero MZC3_GC_SITE_ARGS);
+        return (entry ? entry->m_ptr : NULL);
+    #else
+        // An untracked block must be from libc, unless it has an entry.
+        if (state || MZC3_GC_AlignPad(align))
+        {
+            MZC3_GC_ENTRY *entry =
+                MZC3_GC_AllocEntry(state, size, align, zero MZC3_GC_SITE_ARGS);
+            if (entry)
+                return entry->m_ptr;
+
+            // not tracked
+            #ifdef _DEBUG
+                if (s_gc_constructed)
+                    MzcTraceA("%s (%d): MZC3_GC: ERROR: MZC3_GC_AllocEntry failed\n",
+                              file, line);
+            #endif
+            if (MZC3_GC_AlignPad(align))
+            {
+                // before or after the GC
+                return (s_gc_constructed ? NULL
+                                         : MZC3_GC_LibcAlignedAlloc(size, align, zero));
+            }
+        }
+
+        return (zero ? calloc(size ? size : 1, 1) : malloc(size));
+    #endif
+}
+
+inline void *MZC3_GC_Malloc(std::size_t size, bool zero MZC3_GC_SITE_PARAMS)
+{
+    return MZC3_GC_MallocAligned(size, MZC3_GC_MIN_ALIGNMENT, zero, true
+                                 MZC3_GC_SITE_ARGS);
+}
+
+static void MZC3_GC_Free(void *ptr);
+
+static void *MZC3_GC_Realloc(void *ptr, std::size_t size MZC3_GC_SITE_PARAMS)
+{
+    using namespace std;
+    if (ptr == NULL)
+        return MZC3_GC_Malloc(size, false MZC3_GC_SITE_ARGS);
+
+    if (MZC3_GC_ARENA_CHUNK *chunk = MZC3_GC_ArenaFind(ptr))
+    {
+        if (MZC3_GC_ArenaIsMine(chunk))
+            return MZC3_GC_ArenaRealloc(chunk, ptr, size);
+
+        // A block of an arena of another thread is copied out.
+        if (size == 0)
+            return NULL;
+        std::size_t count = static_cast<std::size_t>(
+            chunk->m_end - static_cast<char *>(ptr));
+        if (count > size)
+            count = size;
+        void *newptr = MZC3_GC_Malloc(size, false MZC3_GC_SITE_ARGS);
+        if (newptr)
+            memcpy(newptr, ptr, count);
+        return newptr;
+    }
+
+    if (MZC3_GC_ENTRY *entry = MZC3_GC_Find(ptr))
+    {
+        #ifdef MZC3_GC_MT
+            MZC3_GC_THREAD_ENTRY *thread = MZC3_GC_EntryThread(entry);
+            if (thread && thread != MZC3_GC_GetThreadEntry())
+            {
+                // A block of a section of another thread is copied out,
+                // and the old one is freed by that thread.
+                void *newptr = MZC3_GC_Malloc(size, false MZC3_GC_SITE_ARGS);
+                if (newptr)
+                {
+                    std::size_t count = MZC3_GC_LoadCounter(&entry->m_size);
+                    if (count > size)
+                        count = size;
+                    memcpy(newptr, ptr, count);
+                    MZC3_GC_Free(ptr);
+                }
+                return newptr;
+            }
+        #endif
+        if (size > entry->m_size &&
+            !MZC3_GC_CheckBudget(MZC3_GC_GetThreadEntry(), size - entry->m_size))
+        {
+            return NULL;
+        }
+        return MZC3_GC_ReallocEntry(entry, size MZC3_GC_SITE_ARGS);
+    }
+
+    #if defined(_WIN32) && !defined(MZC3_GC_HEADER)
+        if (std::size_t align = MZC3_GC_LibcAlignment(ptr))
+        {
+            // copied out, keeping only the alignment of malloc
+            void *newptr = (size ? MZC3_GC_Malloc(size, false MZC3_GC_SITE_ARGS) : NULL);
+            if (newptr)
+            {
+                std::size_t count = _aligned_msize(ptr, align, 0);
+                if (count > size)
+                    count = size;
+                memcpy(newptr, ptr, count);
+            }
+            if (newptr || size == 0)
+                MZC3_GC_LibcAlignedFree(ptr);
+            return newptr;
+        }
+    #endif
+
+    // not from mzcmalloc or not tracked
+    return realloc(ptr, size);
+}
+
+static void MZC3_GC_Free(void *ptr)
+{
+    using namespace std;
+    if (ptr == NULL)
+        return;
+
+    if (MZC3_GC_ARENA_CHUNK *chunk = MZC3_GC_ArenaFind(ptr))
+    {
+        if (MZC3_GC_ArenaIsMine(chunk))
+            MZC3_GC_ArenaFree(chunk, ptr);
+        return;
+    }
+
+    #ifdef MZC3_GC_HEADER
+        if (MZC3_GC_ENTRY *entry = MZC3_GC_Find(ptr))
+        {
+            #ifdef MZC3_GC_MT
+                MZC3_GC_THREAD_ENTRY *thread = MZC3_GC_EntryThread(entry);
+                if (thread && thread != MZC3_GC_GetThreadEntry())
+                {
+                    MZC3_GC_FreeRemote(thread, entry);
+                    return;
+                }
+            #endif
+            MZC3_GC_UnlinkEntry(entry);
+            MZC3_GC_ReleaseEntry(entry, false);
+            return;
+        }
+    #else
+        if (MZC3_GC_FreeTracked(ptr))
+            return;
+        #ifdef _WIN32
+            if (MZC3_GC_LibcAlignment(ptr))
+            {
+                MZC3_GC_LibcAlignedFree(ptr);
+                return;
+            }
+        #endif
+    #endif
+
+    // not from mzcmalloc or not tracked
+    free(ptr);
+}
+
+// Returns the usable bytes of the block, or zero if unknown.
+static std::size_t MZC3_GC_UsableSize(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+
+    if (MZC3_GC_ARENA_CHUNK *chunk = MZC3_GC_ArenaFind(ptr))
+    {
+        // Only the most recent block knows its end.
+        MZC3_GC_STATE *state = chunk->m_state;
+        if (MZC3_GC_ArenaIsMine(chunk) && ptr == state->arena_last)
+            return static_cast<std::size_t>(state->arena_ptr - state->arena_last);
+        return 0;
+    }
+
+    if (MZC3_GC_ENTRY *entry = MZC3_GC_Find(ptr))
+    {
+        const std::size_t offset = entry->m_offset;
+        #ifdef MZC3_GC_HEADER
+            const std::size_t head = offset + MZC3_GC_HEADER_SIZE;
+        #else
+            const std::size_t head = offset;
+        #endif
+        char *raw = static_cast<char *>(ptr) - head;
+        return MZC3_GC_BlockCapacity(raw, head + entry->m_size) - head;
+    }
+
+    #if defined(_WIN32) && !defined(MZC3_GC_HEADER)
+        if (std::size_t align = MZC3_GC_LibcAlignment(ptr))
+            return _aligned_msize(ptr, align, 0);
+    #endif
+
+    // not from mzcmalloc or not tracked
+    return MZC3_GC_MallocUsable(ptr);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// misc functions
+
+// The names are parenthesized against the inline wrappers of GC.h.
+// A section is pushed and popped without locking, since only its thread
+// touches its stack.  Spare sections are always empty.
+extern "C" void (MzcGC_Enter)(int enable_gc)
+{
+    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
+    if (entry == NULL)
+    {
+        MzcTraceA("ERROR: MzcGC_Enter: MZC3_GC_GetThreadEntry failed\n");
+        return;
+    }
+
+    MZC3_GC_STATE *state = static_cast<MZC3_GC_STATE *>(entry->stack.spare);
+    if (state)
+    {
+        entry->stack.spare = state->next;
+    }
+    else
+    {
+        state = reinterpret_cast<MZC3_GC_STATE *>(malloc(sizeof(MZC3_GC_STATE)));
+        if (state == NULL)
+        {
+            MzcTraceA("ERROR: MzcGC_Enter: malloc failed\n");
+            return;
+        }
+        state->owner = entry;
+        if (!MZC3_GC_AddState(state))
+        {
+            MzcTraceA("ERROR: MzcGC_Enter: MZC3_GC_AddState failed\n");
+            free(state);
+            return;
+        }
+        state->busy = 0;
+        state->entries = NULL;
+        state->bytes = 0;
+        state->finalizers = 0;
+        state->arena_chunk_size = 0;
+        state->arena_chunks = NULL;
+        state->arena_ptr = NULL;
+        state->arena_last = NULL;
+        state->arena_bytes = 0;
+        state->conservative = 0;
+        state->allocated = 0;
+        state->collect_at = 0;
+        state->budget = 0;
+        state->budget_policy = 0;
+    }
+
+    state->gc_enabled = enable_gc;
+    state->next = entry->stack.top;
+    entry->stack.top = state;
+    entry->stack.depth++;
+    assert(entry->stack.depth > 0);
+}
+
+extern "C" void MzcGC_EnterArena(std::size_t chunk_size)
+{
+    if (chunk_size == 0)
+        chunk_size = MZC3_GC_ARENA_DEFAULT_CHUNK_SIZE;
+    if (chunk_size > ~std::size_t(0) / 2)
+        chunk_size = ~std::size_t(0) / 2;
+
+    MZC3_GC_STATE *outer = MZC3_GC_GetState();
+    (MzcGC_Enter)(1);
+
+    MZC3_GC_STATE *state = MZC3_GC_GetState();
+    if (state && state != outer)
+    {
+        state->arena_chunk_size = chunk_size;
+        state->busy = 1;
+    }
+}
+
+extern "C" void MzcGC_EnterConservative(void)
+{
+    MZC3_GC_STATE *outer = MZC3_GC_GetState();
+    (MzcGC_Enter)(1);
+
+    MZC3_GC_STATE *state = MZC3_GC_GetState();
+    if (state && state != outer)
+    {
+        state->conservative = 1;
+        state->allocated = 0;
+        state->collect_at = MZC3_GC_MARK_THRESHOLD;
+        state->busy = 1;
+    }
+}
+
+extern "C" MZC_GC_SECTION MzcGC_GetSection(void)
+{
+    return MZC3_GC_GetState();
+}
+
+extern "C" void *MzcGC_SectionAlloc(MZC_GC_SECTION section, std::size_t size,
+                                    std::size_t align)
+{
+    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
+    MZC3_GC_STATE *state = (section ? static_cast<MZC3_GC_STATE *>(section)
+                                    : (entry ? MZC3_GC_Top(entry) : NULL));
+    if (state == NULL || entry == NULL || state->owner != entry ||
+        !MZC3_GC_IsAlignment(align))
+    {
+        return NULL;
+    }
+
+    #ifdef _DEBUG
+        MZC3_GC_STATE *s = MZC3_GC_Top(entry);
+        while (s && s != state)
+            s = MZC3_GC_Outer(s);
+        if (s == NULL)
+        {
+            MzcTraceA("ERROR: MzcGC_SectionAlloc: the section is left\n");
+            return NULL;
+        }
+    #endif
+
+    return MZC3_GC_ArenaAllocAligned(state, size, align);
+}
+
+extern "C" void (MzcGC_Leave)(void)
+{
+    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
+    if (entry == NULL)
+    {
+        MzcTraceA("ERROR: MzcGC_Leave: MZC3_GC_GetThreadEntry failed\n");
+        return;
+    }
+
+    MZC3_GC_STATE *state = MZC3_GC_Top(entry);
+    if (state == NULL)
+    {
+        MzcTraceA("ERROR: MzcGC_Enter and MzcGC_Leave mismatched\n");
+        return;
+    }
+    assert(entry->stack.depth > 0);
+
+    if (state->busy)
+    {
+        MZC3_GC_DrainRemote(entry);
+        if (state->gc_enabled && s_gc_constructed)
+        {
+            const double start = MZC3_GC_Now();
+            if (state->conservative)
+            {
+                // the reachable ones survive
+                MZC3_GC_MarkSweep(state);
+                MZC3_GC_PassOut(state);
+            }
+            else
+            {
+                #ifdef MZC3_GC_MT
+                    // The finalizers run on this thread.
+                    MZC3_GC_Finalize(state);
+                    if (!MZC3_GC_HandOff(state))
+                        MZC3_GC_CollectState(state);
+                #else
+                    MZC3_GC_CollectState(state);
+                #endif
+            }
+            MZC3_GC_CountCollection(&entry->counters, start);
+        }
+        // MzcGC_SectionAlloc of a GC-disabled or a conservative section
+        if (state->arena_chunks)
+            MZC3_GC_ArenaRelease(state);
+        assert(state->entries == NULL && state->arena_chunks == NULL);
+        state->busy = 0;
+        state->arena_chunk_size = 0;
+        state->conservative = 0;
+        if (state->budget)
+        {
+            state->budget = 0;
+            entry->budgets--;
+        }
+    }
+
+    entry->stack.top = state->next;
+    state->next = entry->stack.spare;
+    entry->stack.spare = state;
+    entry->stack.depth--;
+
+    #ifdef MZC3_GC_THREAD_CACHE
+        // the blocks freed by other threads
+        MZC3_GC_SLAB_CACHE *cache = entry->slab_cache;
+        if (cache && MZC3_GC_LoadPtr(&cache->m_remote))
+            MZC3_GC_SlabCacheDrain(cache);
+    #endif
+}
+
+#ifdef _DEBUG
+    // MZC3_GC_LEAK_SITE --- the leaks of a call site at a depth
+    struct MZC3_GC_LEAK_SITE
+    {
+        unsigned    m_site;     // see MZC3_GC_InternSite
+        unsigned    m_depth;
+        std::size_t m_count;    // zero if the slot is empty
+        std::size_t m_bytes;
+    };
+
+    // MZC3_GC_LEAK_TABLE --- the leak sites by (site, depth)
+    struct MZC3_GC_LEAK_TABLE
+    {
+        MZC3_GC_LEAK_SITE * m_sites;
+        std::size_t         m_count;
+        std::size_t         m_capacity;     // zero or power of two
+    };
+
+    static MZC3_GC_LEAK_SITE *MZC3_GC_LeakProbe(MZC3_GC_LEAK_TABLE *table,
+                                                unsigned site, unsigned depth)
+    {
+        const std::size_t mask = table->m_capacity - 1;
+        std::size_t i = ((static_cast<std::size_t>(site) * 0x9E3779B1) ^ depth) & mask;
+        for (;;)
+        {
+            MZC3_GC_LEAK_SITE *leak = &table->m_sites[i];
+            if (leak->m_count == 0 ||
+                (leak->m_site == site && leak->m_depth == depth))
+            {
+                return leak;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    // Adds the entry to its site.  Returns false if out of memory.
+    static bool MZC3_GC_LeakAdd(MZC3_GC_LEAK_TABLE *table, const MZC3_GC_ENTRY *e)
+    {
+        using namespace std;
+        if ((table->m_count + 1) * 2 > table->m_capacity)
+        {
+            const std::size_t capacity = (table->m_capacity ? table->m_capacity * 2 : 64);
+            MZC3_GC_LEAK_SITE *sites = reinterpret_cast<MZC3_GC_LEAK_SITE *>(
+                calloc(capacity, sizeof(MZC3_GC_LEAK_SITE)));
+            if (sites == NULL)
+                return false;
+            MZC3_GC_LEAK_TABLE newtable = {sites, table->m_count, capacity};
+            for (std::size_t i = 0; i < table->m_capacity; i++)
+            {
+                const MZC3_GC_LEAK_SITE *leak = &table->m_sites[i];
+                if (leak->m_count)
+                    *MZC3_GC_LeakProbe(&newtable, leak->m_site, leak->m_depth) = *leak;
+            }
+            free(table->m_sites);
+            *table = newtable;
+        }
+
+        MZC3_GC_LEAK_SITE *leak = MZC3_GC_LeakProbe(table, e->m_site, e->m_depth);
+        if (leak->m_count == 0)
+        {
+            leak->m_site = e->m_site;
+            leak->m_depth = e->m_depth;
+            table->m_count++;
+        }
+        leak->m_count++;
+        leak->m_bytes += e->m_size;
+        return true;
+    }
+
+    inline bool MZC3_GC_MoreBytes(const MZC3_GC_LEAK_SITE *a, const MZC3_GC_LEAK_SITE *b)
+    {
+        return (a->m_bytes != b->m_bytes ? a->m_bytes > b->m_bytes
+                                         : a->m_count > b->m_count);
+    }
+
+    inline bool MZC3_GC_MoreCount(const MZC3_GC_LEAK_SITE *a, const MZC3_GC_LEAK_SITE *b)
+    {
+        return (a->m_count != b->m_count ? a->m_count > b->m_count
+                                         : a->m_bytes > b->m_bytes);
+    }
+
+    static void MZC3_GC_ReportSite(const MZC3_GC_LEAK_SITE *leak)
+    {
+        const MZC3_GC_SITE *site = MZC3_GC_SiteOf(leak->m_site);
+        #ifdef _WIN64
+            MzcTraceA("%s (%d): MZC3_GC: %I64u bytes in %I64u leaked objects (depth %u)\n",
+                site->m_file, site->m_line, leak->m_bytes, leak->m_count,
+                leak->m_depth);
+        #else
+            MzcTraceA("%s (%d): MZC3_GC: %lu bytes in %lu leaked objects (depth %u)\n",
+                site->m_file, site->m_line,
+                static_cast<unsigned long>(leak->m_bytes),
+                static_cast<unsigned long>(leak->m_count), leak->m_depth);
+        #endif
+    }
+
+    // Reports the top sites by less, and the rest in total.
+    static void MZC3_GC_ReportTop(MZC3_GC_LEAK_SITE **sites, std::size_t count,
+                                  std::size_t top, const char *order,
+                                  bool (*less)(const MZC3_GC_LEAK_SITE *,
+                                               const MZC3_GC_LEAK_SITE *))
+    {
+        if (top > count)
+            top = count;
+        std::partial_sort(sites, sites + top, sites + count, less);
+        #ifdef _WIN64
+            MzcTraceA("MZC3_GC: top %I64u call sites by %s:\n", top, order);
+        #else
+            MzcTraceA("MZC3_GC: top %lu call sites by %s:\n",
+                      static_cast<unsigned long>(top), order);
+        #endif
+        std::size_t rest_count = 0, rest_bytes = 0;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            if (i < top)
+                MZC3_GC_ReportSite(sites[i]);
+            else
+            {
+                rest_count += sites[i]->m_count;
+                rest_bytes += sites[i]->m_bytes;
+            }
+        }
+        if (count > top)
+        {
+            #ifdef _WIN64
+                MzcTraceA("MZC3_GC: %I64u bytes in %I64u leaked objects at %I64u other call sites\n",
+                          rest_bytes, rest_count, count - top);
+            #else
+                MzcTraceA("MZC3_GC: %lu bytes in %lu leaked objects at %lu other call sites\n",
+                          static_cast<unsigned long>(rest_bytes),
+                          static_cast<unsigned long>(rest_count),
+                          static_cast<unsigned long>(count - top));
+            #endif
+        }
+    }
+
+    // Lists the leaked blocks one by one in allocation order.
+    static void MZC3_GC_ReportBlocks(MZC3_GC_STATE *state)
+    {
+        for (MZC3_GC_ENTRY *e = MZC3_GC_Oldest(state); e; e = MZC3_GC_Prev(e))
+        {
+            const MZC3_GC_SITE *site = MZC3_GC_SiteOf(e->m_site);
+            #ifdef _WIN64
+                MzcTraceA("%s (%d): MZC3_GC: leaked object 0x%p (size: %I64u)\n",
+                    site->m_file, site->m_line, e->m_ptr, e->m_size);
+            #else
+                MzcTraceA("%s (%d): MZC3_GC: leaked object 0x%p (size: %lu)\n",
+                    site->m_file, site->m_line, e->m_ptr,
+                    static_cast<unsigned long>(e->m_size));
+            #endif
+        }
+    }
+
+    extern "C" void MzcGC_ReportEx(std::size_t top, int flags)
+    {
+        using namespace std;
+        MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
+        if (entry == NULL)
+        {
+            MzcTraceA("ERROR: MzcGC_Report: MZC3_GC_GetThreadEntry failed\n");
+            return;
+        }
+        MZC3_GC_STATE *state = MZC3_GC_Top(entry);
+        if (state == NULL)
+            return;
+
+        // The blocks freed by other threads are no leaks.
+        MZC3_GC_DrainRemote(entry);
+        MZC3_GC_LEAK_TABLE table = {NULL, 0, 0};
+        std::size_t count = 0, bytes = 0;
+        bool ok = true;
+        if (flags & MZC_GC_REPORT_BLOCKS)
+            MZC3_GC_ReportBlocks(state);
+        for (MZC3_GC_ENTRY *e = state->entries; e && ok; e = MZC3_GC_Next(e))
+        {
+            ok = MZC3_GC_LeakAdd(&table, e);
+            count++;
+            bytes += e->m_size;
+        }
+
+        MZC3_GC_LEAK_SITE **sites = NULL;
+        if (ok && table.m_count)
+        {
+            sites = reinterpret_cast<MZC3_GC_LEAK_SITE **>(
+                malloc(table.m_count * sizeof(MZC3_GC_LEAK_SITE *)));
+            ok = (sites != NULL);
+        }
+        if (!ok)
+        {
+            MzcTraceA("ERROR: MzcGC_Report: out of memory\n");
+            free(table.m_sites);
+            return;
+        }
+
+        if (count)
+        {
+            #ifdef _WIN64
+                MzcTraceA("MZC3_GC: %I64u bytes in %I64u leaked objects at %I64u call sites\n",
+                          bytes, count, table.m_count);
+            #else
+                MzcTraceA("MZC3_GC: %lu bytes in %lu leaked objects at %lu call sites\n",
+                          static_cast<unsigned long>(bytes),
+                          static_cast<unsigned long>(count),
+                          static_cast<unsigned long>(table.m_count));
+            #endif
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < table.m_capacity; i++)
+            {
+                if (table.m_sites[i].m_count)
+                    sites[n++] = &table.m_sites[i];
+            }
+            MZC3_GC_ReportTop(sites, n, top, "bytes", MZC3_GC_MoreBytes);
+            // the same sites if all of them are listed
+            if (n > top)
+                MZC3_GC_ReportTop(sites, n, top, "count", MZC3_GC_MoreCount);
+        }
+
+        free(sites);
+        free(table.m_sites);
+    }
+
+    extern "C" void MzcGC_Report(void)
+    {
+        MzcGC_ReportEx(MZC_GC_REPORT_TOP, 0);
+    }
+#endif
+
+extern "C" void MzcGC_GarbageCollect(void)
+{
+    MZC3_GC_GarbageCollect();
+}
+
+extern "C" int MzcGC_SetFinalizer(void *ptr, void (*finalizer)(void *))
+{
+    if (ptr == NULL || MZC3_GC_ArenaFind(ptr))
+        return 0;
+
+    // Only the thread of the section touches the entry.
+    MZC3_GC_THREAD_ENTRY *thread = MZC3_GC_GetThreadEntry();
+    MZC3_GC_ENTRY *entry = MZC3_GC_Find(ptr);
+    if (entry == NULL || thread == NULL || MZC3_GC_EntryThread(entry) != thread)
+        return 0;
+    MZC3_GC_STATE *state = MZC3_GC_StateOf(entry->m_state);
+
+    bool ok = true;
+    if (finalizer)
+    {
+        ok = MZC3_GC_SetExtra(entry, MZC3_GC_EXTRA_FINALIZER,
+                              MZC3_GC_FinalizerValue(finalizer));
+        if (ok && !entry->m_has_finalizer)
+        {
+            entry->m_has_finalizer = true;
+            state->finalizers++;
+        }
+    }
+    else if (entry->m_has_finalizer)
+    {
+        MZC3_GC_GetExtra(entry, MZC3_GC_EXTRA_FINALIZER, true);
+        entry->m_has_finalizer = false;
+        state->finalizers--;
+    }
+    return ok;
+}
+
+extern "C" int MzcGC_Promote(void *ptr, std::size_t levels)
+{
+    return MZC3_GC_Promote(ptr, levels);
+}
+
+extern "C" int MzcGC_Detach(void *ptr)
+{
+    return MZC3_GC_Promote(ptr, ~std::size_t(0));
+}
+
+extern "C" std::size_t MzcGC_PromoteArray(void **ptrs, std::size_t count,
+                                          std::size_t levels)
+{
+    std::size_t moved = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (MZC3_GC_Promote(ptrs[i], levels))
+            moved++;
+    }
+    return moved;
+}
+
+extern "C" int MzcGC_AddRoots(const void *ptr, std::size_t size)
+{
+    using namespace std;
+    MZC3_GC_Lock(&s_gc_roots_lock);
+    if (s_gc_roots_count == s_gc_roots_capacity)
+    {
+        const std::size_t capacity = (s_gc_roots_capacity ? s_gc_roots_capacity * 2 : 16);
+        MZC3_GC_ROOTS *roots = reinterpret_cast<MZC3_GC_ROOTS *>(
+            realloc(s_gc_roots, capacity * sizeof(MZC3_GC_ROOTS)));
+        if (roots == NULL)
+        {
+            MZC3_GC_Unlock(&s_gc_roots_lock);
+            return 0;
+        }
+        s_gc_roots = roots;
+        s_gc_roots_capacity = capacity;
+    }
+    s_gc_roots[s_gc_roots_count].m_begin = static_cast<const char *>(ptr);
+    s_gc_roots[s_gc_roots_count].m_end = static_cast<const char *>(ptr) + size;
+    s_gc_roots_count++;
+    MZC3_GC_Unlock(&s_gc_roots_lock);
+    return 1;
+}
+
+extern "C" void MzcGC_RemoveRoots(const void *ptr)
+{
+    MZC3_GC_Lock(&s_gc_roots_lock);
+    for (std::size_t i = s_gc_roots_count; i > 0; i--)
+    {
+        if (s_gc_roots[i - 1].m_begin == ptr)
+        {
+            s_gc_roots[i - 1] = s_gc_roots[--s_gc_roots_count];
+            break;
+        }
+    }
+    MZC3_GC_Unlock(&s_gc_roots_lock);
+}
+
+extern "C" int MzcGC_StartCollector(std::size_t max_backlog)
+{
+    #ifdef MZC3_GC_MT
+        return MZC3_GC_StartCollector(max_backlog);
+    #else
+        (void)max_backlog;
+        return 0;
+    #endif
+}
+
+extern "C" void MzcGC_Drain(void)
+{
+    #ifdef MZC3_GC_MT
+        MZC3_GC_Drain();
+    #endif
+}
+
+extern "C" void MzcGC_StopCollector(void)
+{
+    #ifdef MZC3_GC_MT
+        MZC3_GC_StopCollector();
+    #endif
+}
+
+extern "C" int MzcGC_GetStats(MZC_GC_STATS *stats)
+{
+    using namespace std;
+    if (stats == NULL || !s_gc_constructed)
+        return 0;
+
+    // s_gc_cs only keeps the threads from exiting meanwhile.
+    MZC3_GC_COUNTERS sum;
+    memset(&sum, 0, sizeof(sum));
+    EnterLock();
+    #ifdef MZC3_GC_MT
+        MZC3_GC_SumCounters(&sum, &s_gc_exited_counters);
+        for (MZC3_GC_THREAD_ENTRY *entry = s_gc_thread_entries; entry;
+             entry = entry->next)
+        {
+            MZC3_GC_SumCounters(&sum, &entry->counters);
+        }
+    #else
+        MZC3_GC_SumCounters(&sum, &s_only_one_gc_thread_entry.counters);
+    #endif
+    LeaveLock();
+
+    stats->live_bytes = sum.bytes_in - sum.bytes_out;
+    stats->live_blocks = sum.blocks_in - sum.blocks_out;
+    stats->peak_bytes = (sum.peak_bytes > stats->live_bytes ? sum.peak_bytes
+                                                            : stats->live_bytes);
+    stats->peak_blocks = (sum.peak_blocks > stats->live_blocks ? sum.peak_blocks
+                                                               : stats->live_blocks);
+    for (std::size_t i = 0; i < MZC_GC_STATS_DEPTHS; i++)
+    {
+        stats->allocs[i] = sum.allocs[i];
+        stats->frees[i] = sum.frees[i];
+    }
+    stats->collections = sum.collections;
+    stats->reclaimed_bytes = sum.reclaimed_bytes;
+    stats->reclaimed_blocks = sum.reclaimed_blocks;
+    stats->collect_seconds = sum.collect_seconds;
+    MZC3_GC_Lock(&s_gc_trim_lock);
+    stats->trimmed_bytes = s_gc_trimmed_bytes;
+    MZC3_GC_Unlock(&s_gc_trim_lock);
+    return 1;
+}
+
+// Writes the HELP and TYPE lines of a metric.
+static void MZC3_GC_ExportHeader(std::FILE *fp, const char *name,
+                                 const char *type, const char *help)
+{
+    using namespace std;
+    fprintf(fp, "# HELP mzcgc_%s %s\n# TYPE mzcgc_%s %s\n",
+            name, help, name, type);
+}
+
+static void MZC3_GC_ExportValue(std::FILE *fp, const char *name,
+                                const char *labels, std::size_t value)
+{
+    using namespace std;
+    #ifdef _WIN64
+        fprintf(fp, "mzcgc_%s%s %I64u\n", name, labels, value);
+    #else
+        fprintf(fp, "mzcgc_%s%s %lu\n", name, labels,
+                static_cast<unsigned long>(value));
+    #endif
+}
+
+static void MZC3_GC_ExportMetric(std::FILE *fp, const char *name,
+                                 const char *type, const char *help,
+                                 std::size_t value)
+{
+    MZC3_GC_ExportHeader(fp, name, type, help);
+    MZC3_GC_ExportValue(fp, name, "", value);
+}
+
+// Writes a counter labeled by the section depth.
+static void MZC3_GC_ExportByDepth(std::FILE *fp, const char *name,
+                                  const char *help, const std::size_t *values)
+{
+    using namespace std;
+    MZC3_GC_ExportHeader(fp, name, "counter", help);
+    for (std::size_t i = 0; i < MZC_GC_STATS_DEPTHS; i++)
+    {
+        char labels[32];
+        sprintf(labels, "{depth=\"%u%s\"}", static_cast<unsigned>(i + 1),
+                (i + 1 == MZC_GC_STATS_DEPTHS ? "+" : ""));
+        MZC3_GC_ExportValue(fp, name, labels, values[i]);
+    }
+}
+
+extern "C" int MzcGC_ExportStats(std::FILE *fp)
+{
+    using namespace std;
+    MZC_GC_STATS stats;
+    if (fp == NULL || !MzcGC_GetStats(&stats))
+        return 0;
+
+    MZC3_GC_ExportMetric(fp, "live_bytes", "gauge",
+        "Bytes of the tracked blocks and the arena chunks.", stats.live_bytes);
+    MZC3_GC_ExportMetric(fp, "live_blocks", "gauge",
+        "Number of the tracked blocks.", stats.live_blocks);
+    MZC3_GC_ExportMetric(fp, "peak_bytes", "gauge",
+        "Maximum of mzcgc_live_bytes.", stats.peak_bytes);
+    MZC3_GC_ExportMetric(fp, "peak_blocks", "gauge",
+        "Maximum of mzcgc_live_blocks.", stats.peak_blocks);
+    MZC3_GC_ExportByDepth(fp, "allocations_total",
+        "Allocations in GC sections by section depth.", stats.allocs);
+    MZC3_GC_ExportByDepth(fp, "frees_total",
+        "Tracked blocks freed by section depth.", stats.frees);
+    MZC3_GC_ExportMetric(fp, "collections_total", "counter",
+        "Garbage collections.", stats.collections);
+    MZC3_GC_ExportMetric(fp, "reclaimed_bytes_total", "counter",
+        "Bytes freed by garbage collections.", stats.reclaimed_bytes);
+    MZC3_GC_ExportMetric(fp, "reclaimed_blocks_total", "counter",
+        "Blocks freed by garbage collections.", stats.reclaimed_blocks);
+    MZC3_GC_ExportHeader(fp, "collection_seconds_total", "counter",
+        "Time spent in garbage collections.");
+    fprintf(fp, "mzcgc_collection_seconds_total %.9f\n", stats.collect_seconds);
+    MZC3_GC_ExportMetric(fp, "trimmed_bytes_total", "counter",
+        "Bytes given back to the OS by trimming.", stats.trimmed_bytes);
+    return !ferror(fp);
+}
+
+extern "C" void MzcGC_SetSampleRate(std::size_t bytes)
+{
+    MZC3_GC_StoreCounter(&s_gc_sample_rate, bytes);
+}
+
+// Writes a number in decimal, or in hexadecimal with 0x if hex.
+static void MZC3_GC_PrintSize(std::FILE *fp, std::size_t value, bool hex)
+{
+    using namespace std;
+    #ifdef _WIN64
+        fprintf(fp, (hex ? "0x%I64x" : "%I64u"), value);
+    #else
+        fprintf(fp, (hex ? "0x%lx" : "%lu"), static_cast<unsigned long>(value));
+    #endif
+}
+
+// Writes "live: bytes [alloc: bytes]" of the heap profile of gperftools.
+static void MZC3_GC_PrintHeapCounts(std::FILE *fp, std::size_t live_count,
+                                    std::size_t live_bytes,
+                                    std::size_t alloc_count,
+                                    std::size_t alloc_bytes)
+{
+    using namespace std;
+    MZC3_GC_PrintSize(fp, live_count, false);
+    fputs(": ", fp);
+    MZC3_GC_PrintSize(fp, live_bytes, false);
+    fputs(" [", fp);
+    MZC3_GC_PrintSize(fp, alloc_count, false);
+    fputs(": ", fp);
+    MZC3_GC_PrintSize(fp, alloc_bytes, false);
+    fputs("] @", fp);
+}
+
+extern "C" int MzcGC_DumpProfile(std::FILE *fp, int format)
+{
+    using namespace std;
+    if (fp == NULL || !s_gc_constructed ||
+        format < MZC_GC_PROFILE_PPROF || format > MZC_GC_PROFILE_FOLDED_RECLAIMED)
+    {
+        return 0;
+    }
+
+    MZC3_GC_Lock(&s_gc_profile_lock);
+    if (format == MZC_GC_PROFILE_PPROF)
+    {
+        std::size_t totals[4] = {0, 0, 0, 0};
+        for (std::size_t i = 0; i < MZC3_GC_PROFILE_BUCKETS; i++)
+        {
+            for (MZC3_GC_PROFILE_STACK *stack = s_gc_profile[i]; stack;
+                 stack = stack->m_next)
+            {
+                totals[0] += stack->m_live_count;
+                totals[1] += stack->m_live_bytes;
+                totals[2] += stack->m_alloc_count;
+                totals[3] += stack->m_alloc_bytes;
+            }
+        }
+        fputs("heap profile: ", fp);
+        MZC3_GC_PrintHeapCounts(fp, totals[0], totals[1], totals[2], totals[3]);
+        fputs(" heapprofile\n", fp);
+    }
+
+    for (std::size_t i = 0; i < MZC3_GC_PROFILE_BUCKETS; i++)
+    {
+        for (MZC3_GC_PROFILE_STACK *stack = s_gc_profile[i]; stack;
+             stack = stack->m_next)
+        {
+            if (format == MZC_GC_PROFILE_PPROF)
+            {
+                // innermost first
+                MZC3_GC_PrintHeapCounts(fp, stack->m_live_count,
+                                        stack->m_live_bytes,
+                                        stack->m_alloc_count,
+                                        stack->m_alloc_bytes);
+                for (std::size_t k = 0; k < stack->m_depth; k++)
+                {
+                    fputc(' ', fp);
+                    MZC3_GC_PrintSize(fp,
+                        reinterpret_cast<std::size_t>(stack->m_frames[k]), true);
+                }
+                fputc('\n', fp);
+                continue;
+            }
+
+            // outermost first
+            const std::size_t value = (format == MZC_GC_PROFILE_FOLDED_LIVE
+                                       ? stack->m_live_bytes
+                                       : stack->m_reclaimed_bytes);
+            if (value == 0 || stack->m_depth == 0)
+                continue;
+            for (std::size_t k = stack->m_depth; k > 0; k--)
+            {
+                MZC3_GC_PrintSize(fp,
+                    reinterpret_cast<std::size_t>(stack->m_frames[k - 1]), true);
+                fputc((k > 1 ? ';' : ' '), fp);
+            }
+            MZC3_GC_PrintSize(fp, value, false);
+            fputc('\n', fp);
+        }
+    }
+    MZC3_GC_Unlock(&s_gc_profile_lock);
+
+    #ifdef __linux__
+        if (format == MZC_GC_PROFILE_PPROF)
+        {
+            // for the symbols
+            fputs("\nMAPPED_LIBRARIES:\n", fp);
+            if (FILE *maps = fopen("/proc/self/maps", "r"))
+            {
+                char buf[4096];
+                std::size_t count;
+                while ((count = fread(buf, 1, sizeof(buf), maps)) > 0)
+                    fwrite(buf, 1, count, fp);
+                fclose(maps);
+            }
+        }
+    #endif
+    return !ferror(fp);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// heap dump (see MzcGC_DumpHeap)
+//
+// The records of a shard (or a section) are copied under its lock and
+// written after unlocking, so that allocations wait only for the copying.
+// A call site is a file name if debugging, or else a sampled call stack.
+
+struct MZC3_GC_HEAP_DUMP
+{
+    std::FILE *         m_fp;
+    MZC_GC_HEAP_HEADER  m_header;
+    MZC_GC_HEAP_RECORD *m_records;      // the records to write
+    std::size_t         m_count;
+    std::size_t         m_capacity;
+    MZC3_GC_INDEX       m_site_ids;     // site --> id
+    const void **       m_sites;        // id - 1 --> site
+    std::size_t         m_site_count;
+    std::size_t         m_site_capacity;
+    bool                m_ok;
+};
+
+// Returns the id of a call site in the dump, or zero if unknown.
+static unsigned MZC3_GC_DumpSite(MZC3_GC_HEAP_DUMP *dump, const void *site)
+{
+    using namespace std;
+    if (site == NULL)
+        return 0;
+
+    MZC3_GC_INDEX_SLOT *slot = MZC3_GC_IndexFind(&dump->m_site_ids, site);
+    if (slot)
+        return static_cast<unsigned>(reinterpret_cast<std::size_t>(slot->m_value));
+
+    if (dump->m_site_count == dump->m_site_capacity)
+    {
+        const std::size_t capacity =
+            (dump->m_site_capacity ? dump->m_site_capacity * 2 : 64);
+        const void **sites = reinterpret_cast<const void **>(
+            realloc(dump->m_sites, capacity * sizeof(const void *)));
+        if (sites == NULL)
+            return 0;
+        dump->m_sites = sites;
+        dump->m_site_capacity = capacity;
+    }
+    if (!MZC3_GC_IndexReserve(&dump->m_site_ids))
+        return 0;
+    dump->m_sites[dump->m_site_count++] = site;
+    MZC3_GC_IndexInsert(&dump->m_site_ids, const_cast<void *>(site),
+                        reinterpret_cast<void *>(dump->m_site_count));
+    return static_cast<unsigned>(dump->m_site_count);
+}
+
+// Adds the record of a tracked entry of the thread.  Needs the lock of the
+// entry.
+static void MZC3_GC_DumpEntry(MZC3_GC_HEAP_DUMP *dump, MZC3_GC_ENTRY *entry,
+                              std::size_t thread)
+{
+    using namespace std;
+    if (dump->m_count == dump->m_capacity)
+    {
+        const std::size_t capacity = (dump->m_capacity ? dump->m_capacity * 2 : 1024);
+        MZC_GC_HEAP_RECORD *records = reinterpret_cast<MZC_GC_HEAP_RECORD *>(
+            realloc(dump->m_records, capacity * sizeof(MZC_GC_HEAP_RECORD)));
+        if (records == NULL)
+        {
+            dump->m_ok = false;
+            return;
+        }
+        dump->m_records = records;
+        dump->m_capacity = capacity;
+    }
+
+    MZC_GC_HEAP_RECORD *record = &dump->m_records[dump->m_count++];
+    record->ptr = reinterpret_cast<std::size_t>(entry->m_ptr);
+    record->size = MZC3_GC_LoadCounter(&entry->m_size);
+    record->thread = thread;
+    record->depth = MZC3_GC_LoadCounter(&entry->m_depth);
+    #ifdef _DEBUG
+        // The site may have been interned by another thread just now.
+        const unsigned id = MZC3_GC_LoadCounter(&entry->m_site);
+        MZC3_GC_Lock(&s_gc_site_lock);
+        const MZC3_GC_SITE site = *MZC3_GC_SiteOf(id);
+        MZC3_GC_Unlock(&s_gc_site_lock);
+        record->site = MZC3_GC_DumpSite(dump, (id ? site.m_file : NULL));
+        record->line = (site.m_line > 0 ? site.m_line : 0);
+    #else
+        const MZC3_GC_SAMPLE *sample = (entry->m_has_sample ?
+            static_cast<MZC3_GC_SAMPLE *>(
+                MZC3_GC_GetExtra(entry, MZC3_GC_EXTRA_SAMPLE, false)) : NULL);
+        record->site = MZC3_GC_DumpSite(dump, (sample ? sample->m_stack : NULL));
+        record->line = 0;
+    #endif
+    record->reserved = 0;
+}
+
+// Writes the records added, after unlocking.
+static void MZC3_GC_DumpFlush(MZC3_GC_HEAP_DUMP *dump)
+{
+    using namespace std;
+    if (dump->m_count == 0)
+        return;
+    if (fwrite(dump->m_records, sizeof(MZC_GC_HEAP_RECORD), dump->m_count,
+               dump->m_fp) != dump->m_count)
+    {
+        dump->m_ok = false;
+    }
+    dump->m_header.records += dump->m_count;
+    for (std::size_t i = 0; i < dump->m_count; i++)
+        dump->m_header.bytes += dump->m_records[i].size;
+    dump->m_count = 0;
+}
+
+// Writes the length and the text of a site.
+static void MZC3_GC_DumpSiteName(MZC3_GC_HEAP_DUMP *dump, const void *site)
+{
+    using namespace std;
+    #ifdef _DEBUG
+        const char *name = static_cast<const char *>(site);
+        const std::size_t length = strlen(name);
+    #else
+        // outermost first, like the folded stacks
+        const MZC3_GC_PROFILE_STACK *stack =
+            static_cast<const MZC3_GC_PROFILE_STACK *>(site);
+        char name[MZC3_GC_PROFILE_DEPTH * (2 * sizeof(void *) + 3)];
+        std::size_t length = 0;
+        for (std::size_t k = stack->m_depth; k > 0; k--)
+        {
+            const std::size_t frame =
+                reinterpret_cast<std::size_t>(stack->m_frames[k - 1]);
+            #ifdef _WIN64
+                length += sprintf(name + length, "%s0x%I64x",
+                                  (length ? ";" : ""), frame);
+            #else
+                length += sprintf(name + length, "%s0x%lx",
+                                  (length ? ";" : ""),
+                                  static_cast<unsigned long>(frame));
+            #endif
+        }
+    #endif
+    if (fwrite(&length, sizeof(length), 1, dump->m_fp) != 1 ||
+        fwrite(name, 1, length, dump->m_fp) != length)
+    {
+        dump->m_ok = false;
+    }
+}
+
+extern "C" int MzcGC_DumpHeap(const char *path)
+{
+    using namespace std;
+    if (path == NULL || !s_gc_constructed)
+        return 0;
+
+    MZC3_GC_HEAP_DUMP dump;
+    memset(&dump, 0, sizeof(dump));
+    dump.m_fp = fopen(path, "wb");
+    if (dump.m_fp == NULL)
+        return 0;
+    dump.m_ok = true;
+    memcpy(dump.m_header.magic, MZC_GC_HEAP_MAGIC, sizeof(dump.m_header.magic));
+    dump.m_header.word_size = sizeof(std::size_t);
+    dump.m_header.byte_order = MZC_GC_HEAP_BYTE_ORDER;
+    if (fwrite(&dump.m_header, sizeof(dump.m_header), 1, dump.m_fp) != 1)
+        dump.m_ok = false;
+
+    #ifdef MZC3_GC_HEADER
+        // No registry of all the blocks, so the sections of this thread only
+        MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
+        if (entry)
+            MZC3_GC_DrainRemote(entry);
+        for (MZC3_GC_STATE *state = (entry ? MZC3_GC_Top(entry) : NULL);
+             state && dump.m_ok; state = MZC3_GC_Outer(state))
+        {
+            for (MZC3_GC_ENTRY *e = state->entries; e; e = MZC3_GC_Next(e))
+                MZC3_GC_DumpEntry(&dump, e, entry->id);
+            MZC3_GC_DumpFlush(&dump);
+        }
+    #else
+        for (std::size_t i = 0; i < MZC3_GC_STRIPES && dump.m_ok; i++)
+        {
+            MZC3_GC_SHARD *shard = &s_gc_shards[i];
+            MZC3_GC_Lock(&shard->m_lock);
+            for (std::size_t k = 0; k < shard->m_index.m_capacity; k++)
+            {
+                MZC3_GC_INDEX_SLOT *slot = &shard->m_index.m_slots[k];
+                if (slot->m_key == NULL)
+                    continue;
+                // untracked if no thread
+                MZC3_GC_ENTRY *e = static_cast<MZC3_GC_ENTRY *>(slot->m_value);
+                const unsigned thread =
+                    MZC3_GC_StateThread(MZC3_GC_LoadCounter(&e->m_state));
+                if (thread)
+                    MZC3_GC_DumpEntry(&dump, e, thread - 1);
+            }
+            MZC3_GC_Unlock(&shard->m_lock);
+            MZC3_GC_DumpFlush(&dump);
+        }
+    #endif
+
+    for (std::size_t i = 0; i < dump.m_site_count; i++)
+        MZC3_GC_DumpSiteName(&dump, dump.m_sites[i]);
+    dump.m_header.sites = dump.m_site_count;
+
+    // the counts are known now
+    if (fseek(dump.m_fp, 0, SEEK_SET) != 0 ||
+        fwrite(&dump.m_header, sizeof(dump.m_header), 1, dump.m_fp) != 1)
+    {
+        dump.m_ok = false;
+    }
+    if (fclose(dump.m_fp) != 0)
+        dump.m_ok = false;
+
+    free(dump.m_records);
+    free(dump.m_sites);
+    MZC3_GC_IndexDestroy(&dump.m_site_ids);
+    return dump.m_ok;
+}
+
+extern "C" int MzcGC_SetBudget(std::size_t budget, int policy)
+{
+    if (policy < MZC_GC_BUDGET_FAIL || policy > MZC_GC_BUDGET_COLLECT)
+        return 0;
+
+    MZC3_GC_THREAD_ENTRY *entry = MZC3_GC_GetThreadEntry();
+    MZC3_GC_STATE *state = (entry ? MZC3_GC_Top(entry) : NULL);
+    if (state == NULL)
+        return 0;
+
+    if (state->budget == 0 && budget)
+        entry->budgets++;
+    else if (state->budget && budget == 0)
+        entry->budgets--;
+    state->budget = budget;
+    state->budget_policy = policy;
+    if (budget)
+        state->busy = 1;    // MzcGC_Leave resets it
+    return 1;
+}
+
+extern "C" void MzcGC_SetBudgetHandler(MZC_GC_BUDGET_HANDLER handler)
+{
+    MZC3_GC_StoreCounter(&s_gc_budget_handler, handler);
+}
+
+extern "C" void MzcGC_SetLargeThreshold(std::size_t bytes)
+{
+    MZC3_GC_StoreCounter(&s_gc_large_threshold, bytes);
+}
+
+extern "C" void MzcGC_SetTrimPolicy(std::size_t threshold)
+{
+    MZC3_GC_StoreCounter(&s_gc_trim_threshold, threshold);
+}
+
+extern "C" std::size_t MzcGC_Trim(void)
+{
+    if (!s_gc_initialized)
+        return 0;
+    return MZC3_GC_Trim();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// mzcmalloc, mzccalloc, mzcrealloc, mzcfree, mzcstrdup, mzcwcsdup
+
+#ifdef _DEBUG
+    extern "C" void *mzcmalloc(std::size_t size, const char *file, int line)
+    {
+        void *ptr = MZC3_GC_Malloc(size, false, file, line);
+        if (ptr == NULL && size > 0)
+        {
+            #ifdef _WIN64
+                MzcTraceA("%s (%d): MZC3_GC ERROR: malloc(%I64u) failed\n",
+                    file, line, size);
+            #else
+                MzcTraceA("%s (%d): MZC3_GC ERROR: malloc(%u) failed\n",
+                    file, line, size);
+            #endif
+        }
+        return ptr;
+    }
+
+    extern "C" void *mzccalloc(std::size_t num, std::size_t size, const char *file, int line)
+    {
+        void *ptr = NULL;
+        if (size == 0 || num <= ~std::size_t(0) / size)
+            ptr = MZC3_GC_Malloc(num * size, true, file, line);
+        if (ptr == NULL && num && size)
+        {
+            #ifdef _WIN64
+                MzcTraceA(
+                    "%s (%d): MZC3_GC ERROR: calloc(%I64u, %I64u) failed\n",
+                    file, line, num, size);
+            #else
+                MzcTraceA(
+                    "%s (%d): MZC3_GC ERROR: calloc(%u, %u) failed\n",
+                    file, line, num, size);
+            #endif
+        }
+        return ptr;
+    }
+
+    extern "C" void *mzcrealloc(void *ptr, std::size_t size, const char *file, int line)
+    {
+        void *newptr = MZC3_GC_Realloc(ptr, size, file, line);
+        if (newptr == NULL && size)
+        {
+            #ifdef _WIN64
+                MzcTraceA(
+                    "%s (%d): MZC3_GC ERROR: realloc(%p, %I64u) failed\n",
+                    file, line, ptr, size);
+            #else
+                MzcTraceA(
+                    "%s (%d): MZC3_GC ERROR: realloc(%p, %u) failed\n",
+                    file, line, ptr, size);
+            #endif
+        }
+        return newptr;
+    }
+
+    extern "C" void mzcfree(void *ptr)
+    {
+        MZC3_GC_Free(ptr);
+    }
+
+    extern "C" char *mzcstrdup(const char *str, const char *file, int line)
+    {
+        using namespace std;
+        const std::size_t len = strlen(str);
+        const std::size_t size = (len + 1) * sizeof(char);
+        char *p = reinterpret_cast<char *>(mzcmalloc(size, file, line));
+        if (p)
+            memcpy(p, str, size);
+        return p;
+    }
+
+    extern "C" wchar_t *mzcwcsdup(const wchar_t *str, const char *file, int line)
+    {
+        using namespace std;
+        const std::size_t len = wcslen(str);
+        const std::size_t size = (len + 1) * sizeof(wchar_t);
+        wchar_t *p = reinterpret_cast<wchar_t *>(mzcmalloc(size, file, line));
+        if (p)
+            memcpy(p, str, size);
+        return p;
+    }
+
+    extern "C" void *mzcaligned_alloc(std::size_t align, std::size_t size,
+                                      const char *file, int line)
+    {
+        void *ptr = NULL;
+        if (MZC3_GC_IsAlignment(align))
+            ptr = MZC3_GC_MallocAligned(size, align, false, true, file, line);
+        if (ptr == NULL && size > 0)
+        {
+            #ifdef _WIN64
+                MzcTraceA(
+                    "%s (%d): MZC3_GC ERROR: aligned_alloc(%I64u, %I64u) failed\n",
+                    file, line, align, size);
+            #else
+                MzcTraceA(
+                    "%s (%d): MZC3_GC ERROR: aligned_alloc(%lu, %lu) failed\n",
+                    file, line, static_cast<unsigned long>(align),
+                    static_cast<unsigned long>(size));
+            #endif
+        }
+        return ptr;
+    }
+
+    extern "C" int mzcposix_memalign(void **pptr, std::size_t align,
+                                     std::size_t size, const char *file, int line)
+    {
+        if (!MZC3_GC_IsAlignment(align) || align % sizeof(void *))
+            return EINVAL;
+        void *ptr = mzcaligned_alloc(align, size, file, line);
+        if (ptr == NULL && size > 0)
+            return ENOMEM;
+        *pptr = ptr;
+        return 0;
+    }
+
+    extern "C" void *mzc3_gc_alloc_tracked(std::size_t align, std::size_t size,
+                                           const char *file, int line)
+    {
+        if (!MZC3_GC_IsAlignment(align))
+            return NULL;
+        return MZC3_GC_MallocAligned(size, align, false, false, file, line);
+    }
+#else   // ndef _DEBUG
+    extern "C" void *mzcmalloc(std::size_t size)
+    {
+        return MZC3_GC_Malloc(size, false);
+    }
+
+    extern "C" void *mzccalloc(std::size_t num, std::size_t size)
+    {
+        if (size && num > ~std::size_t(0) / size)
+            return NULL;
+        return MZC3_GC_Malloc(num * size, true);
+    }
+
+    extern "C" void *mzcrealloc(void *ptr, std::size_t size)
+    {
+        return MZC3_GC_Realloc(ptr, size);
+    }
+
+    extern "C" void mzcfree(void *ptr)
+    {
+        MZC3_GC_Free(ptr);
+    }
+
+    extern "C" char *mzcstrdup(const char *str)
+    {
+        using namespace std;
+        const std::size_t len = strlen(str);
+        const std::size_t size = (len + 1) * sizeof(char);
+        char *p = reinterpret_cast<char *>(mzcmalloc(size));
+        if (p)
+            memcpy(p, str, size);
+        return p;
+    }
+
+    extern "C" wchar_t *mzcwcsdup(const wchar_t *str)
+    {
+        using namespace std;
+        const std::size_t len = wcslen(str);
+        const std::size_t size = (len + 1) * sizeof(wchar_t);
+        wchar_t *p = reinterpret_cast<wchar_t *>(mzcmalloc(size));
+        if (p)
+            memcpy(p, str, size);
+        return p;
+    }
+
+    extern "C" void *mzcaligned_alloc(std::size_t align, std::size_t size)
+    {
+        if (!MZC3_GC_IsAlignment(align))
+            return NULL;
+        return MZC3_GC_MallocAligned(size, align, false, true);
+    }
+
+    extern "C" int mzcposix_memalign(void **pptr, std::size_t align, std::size_t size)
+    {
+        if (!MZC3_GC_IsAlignment(align) || align % sizeof(void *))
+            return EINVAL;
+        void *ptr = mzcaligned_alloc(align, size);
+        if (ptr == NULL && size > 0)
+            return ENOMEM;
+        *pptr = ptr;
+        return 0;
+    }
+
+    extern "C" void *mzc3_gc_alloc_tracked(std::size_t align, std::size_t size)
+    {
+        if (!MZC3_GC_IsAlignment(align))
+            return NULL;
+        return MZC3_GC_MallocAligned(size, align, false, false);
+    }
+#endif  // ndef _DEBUG
+
+extern "C" void mzcfree_sized(void *ptr, std::size_t size)
+{
+    #ifdef _DEBUG
+        // The entry is found anyway, since it links the block to its
+        // section.  Check the size on the way.
+        const std::size_t usable = MZC3_GC_UsableSize(ptr);
+        if (usable && size > usable)
+        {
+            #ifdef _WIN64
+                MzcTraceA("MZC3_GC ERROR: free_sized(%p, %I64u): the block has %I64u bytes\n",
+                    ptr, size, usable);
+            #else
+                MzcTraceA("MZC3_GC ERROR: free_sized(%p, %lu): the block has %lu bytes\n",
+                    ptr, static_cast<unsigned long>(size),
+                    static_cast<unsigned long>(usable));
+            #endif
+        }
+    #else
+        (void)size;
+    #endif
+    MZC3_GC_Free(ptr);
+}
+
+extern "C" std::size_t mzcusable_size(void *ptr)
+{
+    return MZC3_GC_UsableSize(ptr);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// new, delete
+
+void* operator new(std::size_t size) MZC3_GC_THROW_BAD_ALLOC
+{
+    #ifdef _DEBUG
+        void *ptr = mzcmalloc(size ? size : 1, __FILE__, __LINE__);
+    #else
+        void *ptr = mzcmalloc(size ? size : 1);
+    #endif
+    if (ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](std::size_t size) MZC3_GC_THROW_BAD_ALLOC
+{
+    #ifdef _DEBUG
+        void *ptr = mzcmalloc(size ? size : 1, __FILE__, __LINE__);
+    #else
+        void *ptr = mzcmalloc(size ? size : 1);
+    #endif
+    if (ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+#ifndef __BORLANDC__    // avoid E2171
+    void* operator new(std::size_t size, const std::nothrow_t&) MZC3_GC_NOTHROW
+    {
+        #ifdef _DEBUG
+            void *ptr = mzcmalloc(size ? size : 1, __FILE__, __LINE__);
+        #else
+            void *ptr = mzcmalloc(size ? size : 1);
+        #endif
+        return ptr;
+    }
+
+    void* operator new[](std::size_t size, const std::nothrow_t&) MZC3_GC_NOTHROW
+    {
+        #ifdef _DEBUG
+            void *ptr = mzcmalloc(size ? size : 1, __FILE__, __LINE__);
+        #else
+            void *ptr = mzcmalloc(size ? size : 1);
+        #endif
+        return ptr;
+    }
+#endif
+
+void operator delete(void* ptr) MZC3_GC_NOTHROW
+{
+    mzcfree(ptr);
+}
+
+void operator delete[](void* ptr) MZC3_GC_NOTHROW
+{
+    mzcfree(ptr);
+}
+
+#ifdef __cpp_sized_deallocation
+    void operator delete(void* ptr, std::size_t size) noexcept
+    {
+        mzcfree_sized(ptr, size);
+    }
+
+    void operator delete[](void* ptr, std::size_t size) noexcept
+    {
+        mzcfree_sized(ptr, size);
+    }
+#endif
+
+#ifdef _DEBUG
+    void* operator new(std::size_t size, const char *file, int line)
+          MZC3_GC_THROW_BAD_ALLOC
+    {
+        void *ptr = mzcmalloc((size ? size : 1), file, line);
+        if (ptr == NULL)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    void* operator new[](std::size_t size, const char *file, int line)
+          MZC3_GC_THROW_BAD_ALLOC
+    {
+        void *ptr = mzcmalloc((size ? size : 1), file, line);
+        if (ptr == NULL)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    void* operator new(std::size_t size, const std::nothrow_t&,
+                       const char *file, int line) MZC3_GC_NOTHROW
+    {
+        return mzcmalloc((size ? size : 1), file, line);
+    }
+
+    void* operator new[](std::size_t size, const std::nothrow_t&,
+                         const char *file, int line) MZC3_GC_NOTHROW
+    {
+        return mzcmalloc((size ? size : 1), file, line);
+    }
+#endif
+
+#ifdef __cpp_aligned_new
+    void* operator new(std::size_t size, std::align_val_t align)
+    {
+        #ifdef _DEBUG
+            void *ptr = mzcaligned_alloc(static_cast<std::size_t>(align),
+                                         (size ? size : 1), __FILE__, __LINE__);
+        #else
+            void *ptr = mzcaligned_alloc(static_cast<std::size_t>(align),
+                                         (size ? size : 1));
+        #endif
+        if (ptr == NULL)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    void* operator new[](std::size_t size, std::align_val_t align)
+    {
+        return operator new(size, align);
+    }
+
+    void* operator new(std::size_t size, std::align_val_t align,
+                       const std::nothrow_t&) noexcept
+    {
+        #ifdef _DEBUG
+            return mzcaligned_alloc(static_cast<std::size_t>(align),
+                                    (size ? size : 1), __FILE__, __LINE__);
+        #else
+            return mzcaligned_alloc(static_cast<std::size_t>(align),
+                                    (size ? size : 1));
+        #endif
+    }
+
+    void* operator new[](std::size_t size, std::align_val_t align,
+                         const std::nothrow_t& nothrow) noexcept
+    {
+        return operator new(size, align, nothrow);
+    }
+
+    void operator delete(void* ptr, std::align_val_t) noexcept
+    {
+        mzcfree(ptr);
+    }
+
+    void operator delete[](void* ptr, std::align_val_t) noexcept
+    {
+        mzcfree(ptr);
+    }
+
+    void operator delete(void* ptr, std::size_t size, std::align_val_t) noexcept
+    {
+        mzcfree_sized(ptr, size);
+    }
+
+    void operator delete[](void* ptr, std::size_t size, std::align_val_t) noexcept
+    {
+        mzcfree_sized(ptr, size);
+    }
+
+    #ifdef _DEBUG
+        void* operator new(std::size_t size, std::align_val_t align,
+                           const char *file, int line)
+        {
+            void *ptr = mzcaligned_alloc(static_cast<std::size_t>(align),
+                                         (size ? size : 1), file, line);
+            if (ptr == NULL)
+                throw std::bad_alloc();
+            return ptr;
+        }
+
+        void* operator new[](std::size_t size, std::align_val_t align,
+                             const char *file, int line)
+        {
+            return operator new(size, align, file, line);
+        }
+
+        void* operator new(std::size_t size, std::align_val_t align,
+                           const std::nothrow_t&,
+                           const char *file, int line) noexcept
+        {
+            return mzcaligned_alloc(static_cast<std::size_t>(align),
+                                    (size ? size : 1), file, line);
+        }
+
+        void* operator new[](std::size_t size, std::align_val_t align,
+                             const std::nothrow_t&,
+                             const char *file, int line) noexcept
+        {
+            return mzcaligned_alloc(static_cast<std::size_t>(align),
+                                    (size ? size : 1), file, line);
+        }
+    #endif
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+
+#ifdef UNITTEST
+    // unit test and example
+    #include "GC_wrap.h"
+
+    // the finalizers and the destructors run so far
+    static int s_test_finalized = 0;
+
+    static void MZC3_GC_TestFinalizer(void *)
+    {
+        s_test_finalized++;
+    }
+
+    struct MZC3_GC_TEST_OBJECT
+    {
+        int *m_destroyed;
+
+        MZC3_GC_TEST_OBJECT(int *destroyed) : m_destroyed(destroyed)
+        {
+        }
+
+        ~MZC3_GC_TEST_OBJECT()
+        {
+            ++*m_destroyed;
+        }
+    };
+
+    // Fills size bytes at ptr with a pattern of seed.
+    static void MZC3_GC_TestFill(void *ptr, std::size_t size, unsigned seed)
+    {
+        unsigned char *p = static_cast<unsigned char *>(ptr);
+        for (std::size_t i = 0; i < size; i++)
+            p[i] = static_cast<unsigned char>(seed + i * 7);
+    }
+
+    // Returns true if size bytes at ptr have the pattern of seed.
+    static bool MZC3_GC_TestCheck(const void *ptr, std::size_t size, unsigned seed)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(ptr);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            if (p[i] != static_cast<unsigned char>(seed + i * 7))
+                return false;
+        }
+        return true;
+    }
+
+    // A promoted block survives leaving, and a detached one is untracked.
+    static int MZC3_GC_TestPromote(void)
+    {
+        using namespace std;
+        int ret = 0;
+        void *kept;
+        void *detached;
+        s_test_finalized = 0;
+        MzcGC_Enter(1);
+        {
+            MzcGC_Enter(1);
+            {
+                kept = malloc(32);
+                detached = malloc(32);
+                MzcGC_SetFinalizer(kept, MZC3_GC_TestFinalizer);
+                MzcGC_SetFinalizer(detached, MZC3_GC_TestFinalizer);
+                if (!MzcGC_Promote(kept, 1) || !MzcGC_Detach(detached))
+                {
+                    printf("ERROR: MzcGC_Promote or MzcGC_Detach failed\n");
+                    ret = 1;
+                }
+            }
+            MzcGC_Leave();
+            if (s_test_finalized != 0 ||
+                !MzcGC_SetFinalizer(kept, MZC3_GC_TestFinalizer) ||
+                MzcGC_SetFinalizer(detached, NULL))
+            {
+                printf("ERROR: a promoted or detached block is lost\n");
+                ret = 1;
+            }
+        }
+        MzcGC_Leave();
+        if (s_test_finalized != 1)
+        {
+            printf("ERROR: a promoted block is not collected\n");
+            ret = 1;
+        }
+        free(detached);
+        return ret;
+    }
+
+    // The destructors of mzcgc_new run on mzcgc_delete and on collection,
+    // in an arena section too.
+    static int MZC3_GC_TestNew(void)
+    {
+        using namespace std;
+        int ret = 0;
+        int destroyed = 0;
+        MzcGC_Enter(1);
+        {
+            mzcgc_new<MZC3_GC_TEST_OBJECT>(&destroyed);
+            mzcgc_new<MZC3_GC_TEST_OBJECT>(&destroyed);
+            mzcgc_delete(mzcgc_new<MZC3_GC_TEST_OBJECT>(&destroyed));
+            if (destroyed != 1)
+            {
+                printf("ERROR: mzcgc_delete did not destroy\n");
+                ret = 1;
+            }
+        }
+        MzcGC_Leave();
+        MzcGC_EnterArena(0);
+        {
+            mzcgc_new<MZC3_GC_TEST_OBJECT>(&destroyed);
+        }
+        MzcGC_Leave();
+        if (destroyed != 4)
+        {
+            printf("ERROR: the GC destroyed %d of 4 objects\n", destroyed);
+            ret = 1;
+        }
+        return ret;
+    }
+
+    static void *s_test_root = NULL;
+
+    // Allocates the blocks of the conservative test out of the frame of
+    // the caller.  Only s_test_root points to the kept one.
+    static MZC3_GC_NOINLINE void MZC3_GC_TestConservativeAlloc(void)
+    {
+        using namespace std;
+        for (int i = 0; i < 100; i++)
+            MzcGC_SetFinalizer(malloc(64), MZC3_GC_TestFinalizer);
+        s_test_root = malloc(64);
+        MZC3_GC_TestFill(s_test_root, 64, 10);
+    }
+
+    // A conservative section frees the unreachable blocks only.
+    static int MZC3_GC_TestConservative(void)
+    {
+        using namespace std;
+        int ret = 0;
+        s_test_finalized = 0;
+        MzcGC_AddRoots(&s_test_root, sizeof(s_test_root));
+        MzcGC_EnterConservative();
+        {
+            MZC3_GC_TestConservativeAlloc();
+            MzcGC_GarbageCollect();
+            if (!MzcGC_SetFinalizer(s_test_root, NULL) ||
+                !MZC3_GC_TestCheck(s_test_root, 64, 10))
+            {
+                printf("ERROR: a reachable block is lost\n");
+                ret = 1;
+            }
+            // A stale word may keep a few.
+            if (s_test_finalized < 90)
+            {
+                printf("ERROR: %d of 100 unreachable blocks freed\n",
+                       s_test_finalized);
+                ret = 1;
+            }
+            s_test_root = NULL;
+        }
+        MzcGC_Leave();
+        MzcGC_RemoveRoots(&s_test_root);
+        return ret;
+    }
+
+    // Aligned, large and reallocated blocks keep their contents.
+    static int MZC3_GC_TestRoundTrips(void)
+    {
+        using namespace std;
+        int ret = 0;
+        MzcGC_Enter(1);
+        for (std::size_t align = 16; align <= 4096; align *= 4)
+        {
+            void *p = aligned_alloc(align, 100);
+            void *q = NULL;
+            if (p == NULL || posix_memalign(&q, align, 50) != 0 ||
+                (reinterpret_cast<std::size_t>(p) & (align - 1)) ||
+                (reinterpret_cast<std::size_t>(q) & (align - 1)))
+            {
+                printf("ERROR: a block is not aligned to %lu\n",
+                       static_cast<unsigned long>(align));
+                ret = 1;
+                continue;
+            }
+            MZC3_GC_TestFill(p, 100, 20);
+            p = realloc(p, 300);
+            if (p == NULL || !MZC3_GC_TestCheck(p, 100, 20))
+            {
+                printf("ERROR: reallocating an aligned block lost it\n");
+                ret = 1;
+            }
+            free(p);
+            free(q);
+        }
+
+        MzcGC_SetLargeThreshold(0x10000);
+        char *large = static_cast<char *>(malloc(100000));
+        MZC3_GC_TestFill(large, 100000, 30);
+        large = static_cast<char *>(realloc(large, 300000));
+        if (large == NULL || !MZC3_GC_TestCheck(large, 100000, 30))
+        {
+            printf("ERROR: growing a large block lost it\n");
+            ret = 1;
+        }
+        large = static_cast<char *>(realloc(large, 1000));
+        if (large == NULL || !MZC3_GC_TestCheck(large, 1000, 30) ||
+            malloc_usable_size(large) < 1000)
+        {
+            printf("ERROR: shrinking a large block lost it\n");
+            ret = 1;
+        }
+        free(large);
+        MzcGC_SetLargeThreshold(0x100000);
+
+        char *p = static_cast<char *>(malloc(1));
+        MZC3_GC_TestFill(p, 1, 40);
+        for (std::size_t size = 1; size < 10000; size = size * 3 + 1)
+        {
+            p = static_cast<char *>(realloc(p, size * 3 + 1));
+            if (p == NULL || !MZC3_GC_TestCheck(p, size, 40))
+            {
+                printf("ERROR: growing a block lost it\n");
+                ret = 1;
+                break;
+            }
+            MZC3_GC_TestFill(p, size * 3 + 1, 40);
+        }
+        const std::size_t usable = malloc_usable_size(p);
+        if (p && realloc(p, usable) != p)
+        {
+            printf("ERROR: reallocating to the usable size moved a block\n");
+            ret = 1;
+        }
+        free_sized(p, usable);
+        MzcGC_Leave();
+        return ret;
+    }
+
+    // Writes the dumps of a section before and after 10 blocks of 1000
+    // bytes, for GCHeapDiff.  Reads the header of the second back.
+    static int MZC3_GC_TestDump(const char *old_path, const char *new_path)
+    {
+        using namespace std;
+        int ret = 0;
+        MzcGC_Enter(1);
+        {
+            if (!MzcGC_DumpHeap(old_path))
+                ret = 1;
+            for (int i = 0; i < 10; i++)
+                malloc(1000);
+            if (!MzcGC_DumpHeap(new_path))
+                ret = 1;
+        }
+        MzcGC_Leave();
+
+        MZC_GC_HEAP_HEADER header;
+        FILE *fp = fopen(new_path, "rb");
+        if (fp == NULL || fread(&header, sizeof(header), 1, fp) != 1 ||
+            memcmp(header.magic, MZC_GC_HEAP_MAGIC, 8) != 0 ||
+            header.records < 10 || header.bytes < 10000)
+        {
+            ret = 1;
+        }
+        if (fp)
+            fclose(fp);
+        if (ret)
+            printf("ERROR: the heap dump is wrong\n");
+        return ret;
+    }
+
+    #ifdef MZC3_GC_MT
+        static const int MZC3_GC_TEST_THREADS = 4;
+        static const int MZC3_GC_TEST_BLOCKS = 2000;
+
+        // the blocks of each thread, freed by the next thread
+        static void *s_test_blocks[MZC3_GC_TEST_THREADS][MZC3_GC_TEST_BLOCKS];
+        static int s_test_errors = 0;
+        static MZC3_GC_LOCK s_test_lock;
+        static MZC3_GC_COND s_test_cond;
+        static int s_test_waiting = 0;
+        static int s_test_round = 0;
+
+        static void MZC3_GC_TestBarrier(void)
+        {
+            MZC3_GC_Lock(&s_test_lock);
+            const int round = s_test_round;
+            if (++s_test_waiting == MZC3_GC_TEST_THREADS)
+            {
+                s_test_waiting = 0;
+                s_test_round++;
+                MZC3_GC_WakeAll(&s_test_cond);
+            }
+            while (round == s_test_round)
+                MZC3_GC_Wait(&s_test_cond, &s_test_lock);
+            MZC3_GC_Unlock(&s_test_lock);
+        }
+
+        static void MZC3_GC_TestError(void)
+        {
+            MZC3_GC_Lock(&s_test_lock);
+            s_test_errors++;
+            MZC3_GC_Unlock(&s_test_lock);
+        }
+
+        // Each thread allocates its blocks in its section, and frees or
+        // reallocates those of the next thread while it allocates more.
+        static void MZC3_GC_TestThreadMain(int me)
+        {
+            using namespace std;
+            const int next = (me + 1) % MZC3_GC_TEST_THREADS;
+            MzcGC_Enter(1);
+            for (int i = 0; i < MZC3_GC_TEST_BLOCKS; i++)
+            {
+                const std::size_t size = 1 + (i * 13 + me) % 300;
+                s_test_blocks[me][i] = malloc(size);
+                MZC3_GC_TestFill(s_test_blocks[me][i], size, me + i);
+            }
+            MZC3_GC_TestBarrier();
+
+            for (int i = 0; i < MZC3_GC_TEST_BLOCKS; i++)
+            {
+                const std::size_t size = 1 + (i * 13 + next) % 300;
+                void *p = s_test_blocks[next][i];
+                if (!MZC3_GC_TestCheck(p, size, next + i))
+                    MZC3_GC_TestError();
+                if (i % 3 == 0)
+                {
+                    // copied out into the section of this thread
+                    p = realloc(p, size + 100);
+                    if (p == NULL || !MZC3_GC_TestCheck(p, size, next + i))
+                        MZC3_GC_TestError();
+                }
+                free(p);
+                free(malloc(size));
+            }
+            MZC3_GC_TestBarrier();
+            MzcGC_Leave();
+        }
+
+        #ifdef _WIN32
+            static DWORD WINAPI MZC3_GC_TestThreadProc(LPVOID param)
+            {
+                MZC3_GC_TestThreadMain(static_cast<int>(
+                    reinterpret_cast<std::size_t>(param)));
+                return 0;
+            }
+        #else
+            static void *MZC3_GC_TestThreadProc(void *param)
+            {
+                MZC3_GC_TestThreadMain(static_cast<int>(
+                    reinterpret_cast<std::size_t>(param)));
+                return NULL;
+            }
+        #endif
+
+        // 4 threads free and reallocate the tracked blocks of each other.
+        static int MZC3_GC_TestThreads(void)
+        {
+            using namespace std;
+            MZC3_GC_InitLock(&s_test_lock);
+            MZC3_GC_InitCond(&s_test_cond);
+            MZC_GC_STATS before, after;
+            MzcGC_GetStats(&before);
+            #ifdef _WIN32
+                HANDLE threads[MZC3_GC_TEST_THREADS];
+                for (int i = 0; i < MZC3_GC_TEST_THREADS; i++)
+                {
+                    threads[i] = CreateThread(NULL, 0, MZC3_GC_TestThreadProc,
+                        reinterpret_cast<LPVOID>(std::size_t(i)), 0, NULL);
+                }
+                WaitForMultipleObjects(MZC3_GC_TEST_THREADS, threads, TRUE, INFINITE);
+                for (int i = 0; i < MZC3_GC_TEST_THREADS; i++)
+                    CloseHandle(threads[i]);
+            #else
+                pthread_t threads[MZC3_GC_TEST_THREADS];
+                for (int i = 0; i < MZC3_GC_TEST_THREADS; i++)
+                {
+                    pthread_create(&threads[i], NULL, MZC3_GC_TestThreadProc,
+                                   reinterpret_cast<void *>(std::size_t(i)));
+                }
+                for (int i = 0; i < MZC3_GC_TEST_THREADS; i++)
+                    pthread_join(threads[i], NULL);
+            #endif
+            MzcGC_GetStats(&after);
+
+            int ret = 0;
+            if (s_test_errors)
+            {
+                printf("ERROR: %d blocks lost between threads\n", s_test_errors);
+                ret = 1;
+            }
+            if (after.live_blocks != before.live_blocks ||
+                after.live_bytes != before.live_bytes)
+            {
+                printf("ERROR: %ld blocks left by threads\n",
+                       static_cast<long>(after.live_blocks - before.live_blocks));
+                ret = 1;
+            }
+            return ret;
+        }
+
+        static void *volatile s_test_handoff = NULL;
+        static int s_test_held = 0;     // 1 held, 2 to drop
+
+        // Keeps the block handed off on its stack only, until told to drop.
+        #ifdef _WIN32
+            static DWORD WINAPI MZC3_GC_TestHolderProc(LPVOID)
+        #else
+            static void *MZC3_GC_TestHolderProc(void *)
+        #endif
+        {
+            using namespace std;
+            free(malloc(1));    // registers this thread
+            MZC3_GC_Lock(&s_test_lock);
+            while (s_test_held == 0)
+                MZC3_GC_Wait(&s_test_cond, &s_test_lock);
+            void *volatile held = s_test_handoff;
+            s_test_handoff = NULL;
+            s_test_held = 1;
+            MZC3_GC_WakeAll(&s_test_cond);
+            while (s_test_held != 2)
+                MZC3_GC_Wait(&s_test_cond, &s_test_lock);
+            if (held == NULL)
+                s_test_errors++;
+            held = NULL;
+            MZC3_GC_Unlock(&s_test_lock);
+            return 0;
+        }
+
+        static MZC3_GC_NOINLINE void MZC3_GC_TestHandOff(void)
+        {
+            using namespace std;
+            void *p = malloc(64);
+            MzcGC_SetFinalizer(p, MZC3_GC_TestFinalizer);
+            MZC3_GC_Lock(&s_test_lock);
+            s_test_handoff = p;
+            s_test_held = -1;
+            MZC3_GC_WakeAll(&s_test_cond);
+            while (s_test_held != 1)
+                MZC3_GC_Wait(&s_test_cond, &s_test_lock);
+            MZC3_GC_Unlock(&s_test_lock);
+        }
+
+        // A block of a conservative section that only the stack of another
+        // thread points to survives.
+        static int MZC3_GC_TestOtherStack(void)
+        {
+            using namespace std;
+            s_test_finalized = 0;
+            s_test_held = 0;
+            #ifdef _WIN32
+                HANDLE thread = CreateThread(NULL, 0, MZC3_GC_TestHolderProc,
+                                             NULL, 0, NULL);
+            #else
+                pthread_t thread;
+                pthread_create(&thread, NULL, MZC3_GC_TestHolderProc, NULL);
+            #endif
+            MzcGC_EnterConservative();
+            MZC3_GC_TestHandOff();
+            MzcGC_GarbageCollect();
+            const int finalized = s_test_finalized;
+            MZC3_GC_Lock(&s_test_lock);
+            s_test_held = 2;
+            MZC3_GC_WakeAll(&s_test_cond);
+            MZC3_GC_Unlock(&s_test_lock);
+            #ifdef _WIN32
+                WaitForSingleObject(thread, INFINITE);
+                CloseHandle(thread);
+            #else
+                pthread_join(thread, NULL);
+            #endif
+            MzcGC_Leave();
+            if (finalized != 0 || s_test_errors)
+            {
+                printf("ERROR: a block on the stack of another thread is lost\n");
+                return 1;
+            }
+            return 0;
+        }
+    #endif  // def MZC3_GC_MT
+
+    // Usage: GC [old_dump new_dump]
+    int main(int argc, char **argv)
+    {
+        using namespace std;
+        void *p1;
+        void *p2;
+        void *p3;
+        char *p4;
+        void *p5;
+        char *p6;
+        MzcGC_Enter(1); // GC-enabled section
+        {
+            p1 = malloc(1);
+            printf("p1: %p\n", p1);
+            MzcGC_Enter(1); // GC-enabled section
+            {
+                p2 = realloc(NULL, 2);
+                printf("p2: %p\n", p2);
+                p3 = new char[3];
+                printf("p3: %p\n", p3);
+                MzcGC_Enter(0); // GC-disabled section
+                {
+                    p4 = new char[4];
+                    printf("p4: %p\n", p4);
+                    MzcGC_Report();
+                }
+                MzcGC_Leave();
+                MzcGC_Report();
+            }
+            MzcGC_Leave();
+            p5 = new char[5];
+            printf("p5: %p\n", p5);
+            p6 = strdup("test6");
+            printf("p6: %p\n", p6);
+            char *p7 = new char[7];
+            printf("p7: %p\n", p7);
+            MzcGC_Report();
+        }
+        MzcGC_Leave();
+        delete[] p4;
+
+        // A budget collects a conservative section while an inner section
+        // is open.  The blocks of the inner section keep a.
+        int ret = 0;
+        MzcGC_EnterConservative();
+        {
+            MzcGC_SetBudget(4096, MZC_GC_BUDGET_COLLECT);
+            char *a = reinterpret_cast<char *>(malloc(64));
+            memset(a, 0x5a, 64);
+            for (int i = 0; i < 16; i++)
+                malloc(200);    // garbage
+            MzcGC_Enter(1);
+            {
+                char **holder = reinterpret_cast<char **>(malloc(sizeof(char *)));
+                *holder = a;
+                a = NULL;
+                void *p8 = malloc(1024);    // overruns
+                printf("p8: %p\n", p8);
+                if (!MzcGC_SetFinalizer(*holder, NULL) || (*holder)[0] != 0x5a)
+                {
+                    printf("ERROR: the block of the inner section is lost\n");
+                    ret = 1;
+                }
+            }
+            MzcGC_Leave();
+        }
+        MzcGC_Leave();
+
+        ret |= MZC3_GC_TestPromote();
+        ret |= MZC3_GC_TestNew();
+        ret |= MZC3_GC_TestConservative();
+        ret |= MZC3_GC_TestRoundTrips();
+        #ifdef MZC3_GC_MT
+            ret |= MZC3_GC_TestThreads();
+            ret |= MZC3_GC_TestOtherStack();
+        #endif
+        if (argc == 3)
+            ret |= MZC3_GC_TestDump(argv[1], argv[2]);
+        printf(ret ? "FAILED\n" : "OK\n");
+        return ret;
+    }
+#endif  // def UNITTEST
+
+#endif  // ndef MZC_NO_GC
@@ -1,119 +1,928 @@
-////////////////////////////////////////////////////////////////////////////
-// GC.h -- MZC3 GC
-// This file is part of MZC3.  See file "ReadMe.txt" and "License.txt".
-////////////////////////////////////////////////////////////////////////////
-
-#ifndef __MZC3_GC_H__
-#define __MZC3_GC_H__
-
-#if !defined(NDEBUG) && !defined(_DEBUG)
-    #define _DEBUG
-#endif
-
-#ifdef __cplusplus
-    #include <new>  // std::bad_alloc
-#endif
-
-//////////////////////////////////////////////////////////////////////////////
-
-#ifdef MZC_NO_GC
-    // no effect if defined(MZC_NO_GC)
-    #define MzcGC_Enter(enable_gc)
-    #define MzcGC_Leave()
-    #define MzcGC_GarbageCollect()
-    #define MzcGC_Report()
-    #define mzcnew new
-    #define mzcnew_nothrow new(std::nothrow)
-    #define mzcdelete delete
-    #undef new
-#else   // ndef MZC_NO_GC
-    #ifdef __cplusplus
-    extern "C" {
-    #endif
-
-    // Enter the GC section.
-    void MzcGC_Enter(int enable_gc);
-    // Leave the GC section.
-    void MzcGC_Leave(void);
-    // Do garbage collection in the current GC section.
-    void MzcGC_GarbageCollect(void);
-
-    #ifdef _DEBUG
-        // Report the leaks in the current GC section.
-        void MzcGC_Report(void);
-    #else
-        // No effect on release
-        #define MzcGC_Report()  /*empty*/
-    #endif
-
-    // mzcmalloc, mzccalloc, mzcrealloc, mzcfree
-    #ifdef _DEBUG
-        #ifdef __cplusplus
-            void *mzcmalloc(std::size_t size, const char *file, int line);
-            void *mzccalloc(std::size_t num, std::size_t size, const char *file, int line);
-            void *mzcrealloc(void *ptr, std::size_t size, const char *file, int line);
-            void mzcfree(void *ptr);
-            char *mzcstrdup(const char *str, const char *file, int line);
-            wchar_t *mzcwcsdup(const wchar_t *str, const char *file, int line);
-        #else  // def __cplusplus
-            void *mzcmalloc(size_t size, const char *file, int line);
-            void *mzccalloc(size_t num, size_t size, const char *file, int line);
-            void *mzcrealloc(void *ptr, size_t size, const char *file, int line);
-            void mzcfree(void *ptr, const char *file, int line);
-            char *mzcstrdup(const char *str, const char *file, int line);
-            wchar_t *mzcwcsdup(const wchar_t *str, const char *file, int line);
-        #endif // def __cplusplus
-    #else
-        #ifdef __cplusplus
-            void *mzcmalloc(std::size_t size);
-            void *mzccalloc(std::size_t num, std::size_t size);
-            void *mzcrealloc(void *ptr, std::size_t size);
-            void mzcfree(void *ptr);
-            char *mzcstrdup(const char *str);
-            wchar_t *mzcwcsdup(const wchar_t *str);
-        #else  // def __cplusplus
-            void *mzcmalloc(size_t size);
-            void *mzccalloc(size_t num, size_t size);
-            void *mzcrealloc(void *ptr, size_t size);
-            void mzcfree(void *ptr);
-            char *mzcstrdup(const char *str);
-            wchar_t *mzcwcsdup(const wchar_t *str);
-        #endif // def __cplusplus
-    #endif
-
-    #ifdef __cplusplus
-    } // extern "C"
-    #endif
-
-    #ifdef __cplusplus
-        // new and delete
-        void* operator new(std::size_t size) throw(std::bad_alloc);
-        void* operator new[](std::size_t size) throw(std::bad_alloc);
-
-        #ifndef __BORLANDC__    // avoid E2171
-            void* operator new(std::size_t size, const std::nothrow_t&) throw();
-            void* operator new[](std::size_t size, const std::nothrow_t&) throw();
-        #endif
-
-        void operator delete(void* ptr) throw();
-        void operator delete[](void* ptr) throw();
-
-        #ifdef _DEBUG
-            void* operator new(std::size_t size, const char *file, int line)
-                throw(std::bad_alloc);
-            void* operator new[](std::size_t size, const char *file, int line)
-                throw(std::bad_alloc);
-            void* operator new(std::size_t size, const std::nothrow_t&,
-                                         const char *file, int line) throw();
-            void* operator new[](std::size_t size, const std::nothrow_t&,
-                                         const char *file, int line) throw();
-        #endif
-    #endif  // __cplusplus
-
-    // wrapping
-    #include "GC_wrap.h"
-#endif  // ndef MZC_NO_GC
-
-//////////////////////////////////////////////////////////////////////////////
-
-#endif  /* ndef __MZC3_GC_H__ */
+////////////////////////////////////////////////////////////////////////////
+// GC.h -- MZC3 GC
+// This file is part of MZC3.  See file "ReadMe.txt" and "License.txt".
+////////////////////////////////////////////////////////////////////////////
+
+#ifndef __MZC3_GC_H__
+#define __MZC3_GC_H__
+
+#if !defined(NDEBUG) && !defined(_DEBUG)
+    #define _DEBUG
+#endif
+
+#ifdef __cplusplus
+    #include <new>      // std::bad_alloc
+    #include <cstdio>   // std::FILE
+    #include <cstddef>  // std::ptrdiff_t
+    #if (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)) && \
+        defined(__has_include)
+        #if __has_include(<memory_resource>)
+            #include <memory_resource>  // std::pmr::memory_resource
+        #endif
+    #endif
+#else
+    #include <stdio.h>  // FILE
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// MZC_GC_STATS --- the statistics (see MzcGC_GetStats)
+
+// allocs and frees are by the depth of the section: 1, 2, ..., and the
+// last one is also for the deeper ones.
+#define MZC_GC_STATS_DEPTHS 8
+
+#ifdef __cplusplus
+    typedef std::size_t MZC3_GC_SIZE;
+#else
+    typedef size_t MZC3_GC_SIZE;
+#endif
+
+typedef struct MZC_GC_STATS
+{
+    MZC3_GC_SIZE live_bytes;        // tracked blocks and arena chunks
+    MZC3_GC_SIZE live_blocks;       // tracked blocks
+    MZC3_GC_SIZE peak_bytes;        // the maximum of live_bytes (*)
+    MZC3_GC_SIZE peak_blocks;       // the maximum of live_blocks (*)
+    MZC3_GC_SIZE allocs[MZC_GC_STATS_DEPTHS];   // allocations in sections
+    MZC3_GC_SIZE frees[MZC_GC_STATS_DEPTHS];    // tracked blocks freed
+    MZC3_GC_SIZE collections;       // garbage collections
+    MZC3_GC_SIZE reclaimed_bytes;   // bytes freed by garbage collections
+    MZC3_GC_SIZE reclaimed_blocks;  // blocks freed by garbage collections
+    double collect_seconds;         // time spent in garbage collections
+    MZC3_GC_SIZE trimmed_bytes;     // bytes given back to the OS by trimming
+} MZC_GC_STATS;
+// (*) In multithread mode, the sum of the peaks of the threads, which may
+// exceed the real peak.
+
+// the formats of MzcGC_DumpProfile
+#define MZC_GC_PROFILE_PPROF            0   // heap profile of gperftools
+#define MZC_GC_PROFILE_FOLDED_LIVE      1   // folded stacks of live bytes
+#define MZC_GC_PROFILE_FOLDED_RECLAIMED 2   // folded stacks of reclaimed bytes
+
+// The file of MzcGC_DumpHeap is an MZC_GC_HEAP_HEADER, the records, and
+// the sites.  A site is its length (MZC3_GC_SIZE) and its text: a file name
+// if debugging, or else a sampled call stack, outermost first.  Records
+// have the site id 1, 2, ... in this order, or 0 if unknown.
+#define MZC_GC_HEAP_MAGIC       "MZCHEAP1"
+#define MZC_GC_HEAP_BYTE_ORDER  0x01020304
+
+typedef struct MZC_GC_HEAP_HEADER
+{
+    char magic[8];              // MZC_GC_HEAP_MAGIC without NUL
+    unsigned word_size;         // sizeof(MZC3_GC_SIZE) of the writer
+    unsigned byte_order;        // MZC_GC_HEAP_BYTE_ORDER of the writer
+    MZC3_GC_SIZE records;       // the number of the records
+    MZC3_GC_SIZE sites;         // the number of the sites
+    MZC3_GC_SIZE bytes;         // the total size of the records
+} MZC_GC_HEAP_HEADER;
+
+typedef struct MZC_GC_HEAP_RECORD
+{
+    MZC3_GC_SIZE ptr;           // the address of the block
+    MZC3_GC_SIZE size;          // the size of the block
+    MZC3_GC_SIZE thread;        // 0, 1, ... in the order of the threads
+    unsigned depth;             // the depth of its section
+    unsigned site;              // the call site, or 0 if unknown
+    unsigned line;              // the line of the call site, if debugging
+    unsigned reserved;
+} MZC_GC_HEAP_RECORD;
+
+// the flags of MzcGC_ReportEx
+#define MZC_GC_REPORT_BLOCKS    1   // also list the leaked blocks one by one
+
+// the call sites that MzcGC_Report lists
+#define MZC_GC_REPORT_TOP       20
+
+// the policies of MzcGC_SetBudget on an overrun
+#define MZC_GC_BUDGET_FAIL      0   // the allocation fails (new throws)
+#define MZC_GC_BUDGET_CALLBACK  1   // the budget handler decides
+#define MZC_GC_BUDGET_COLLECT   2   // collect the conservative sections first
+
+// a GC section (see MzcGC_GetSection)
+typedef struct MZC3_GC_FRAME *MZC_GC_SECTION;
+
+// The budget handler gets the bytes used, the bytes requested, and the
+// budget.  It returns non-zero to let the allocation pass.
+typedef int (*MZC_GC_BUDGET_HANDLER)(MZC3_GC_SIZE used, MZC3_GC_SIZE size,
+                                     MZC3_GC_SIZE budget);
+
+//////////////////////////////////////////////////////////////////////////////
+
+#ifdef MZC_NO_GC
+    // no effect if defined(MZC_NO_GC)
+    #define MzcGC_Enter(enable_gc)
+    #define MzcGC_EnterArena(chunk_size)
+    #define MzcGC_EnterConservative()
+    #define MzcGC_Leave()
+    #define MzcGC_GetSection()                  NULL
+    #define MzcGC_SectionAlloc(section, size, align)    NULL
+    #define MzcGC_GarbageCollect()
+    #define MzcGC_AddRoots(ptr, size)           1
+    #define MzcGC_RemoveRoots(ptr)
+    #define MzcGC_SetFinalizer(ptr, finalizer)  0
+    #define MzcGC_Promote(ptr, levels)          1
+    #define MzcGC_Detach(ptr)                   1
+    #define MzcGC_PromoteArray(ptrs, count, levels) (count)
+    #define MzcGC_StartCollector(max_backlog)   0
+    #define MzcGC_Drain()
+    #define MzcGC_StopCollector()
+    #define MzcGC_GetStats(stats)               0
+    #define MzcGC_ExportStats(fp)               0
+    #define MzcGC_SetSampleRate(bytes)
+    #define MzcGC_DumpProfile(fp, format)       0
+    #define MzcGC_DumpHeap(path)                0
+    #define MzcGC_SetBudget(budget, policy)     1
+    #define MzcGC_SetBudgetHandler(handler)
+    #define MzcGC_SetLargeThreshold(bytes)
+    #define MzcGC_SetTrimPolicy(threshold)
+    #define MzcGC_Trim()                        0
+    #define MzcGC_Report()
+    #define MzcGC_ReportEx(top, flags)
+    #define mzcnew new
+    #define mzcnew_nothrow new(std::nothrow)
+    #define mzcdelete delete
+    #undef new
+
+    #ifdef __cplusplus
+        template <typename T>
+        inline T *mzcgc_promote(T *ptr, std::size_t = 1)
+        {
+            return ptr;
+        }
+
+        template <typename T>
+        inline T *mzcgc_detach(T *ptr)
+        {
+            return ptr;
+        }
+
+        // for mzcgc_new
+        inline void *mzc3_gc_alloc_object(std::size_t size, std::size_t, bool,
+                                          const char *, int)
+        {
+            return ::operator new(size);
+        }
+
+        inline void mzc3_gc_free_object(void *ptr)
+        {
+            ::operator delete(ptr);
+        }
+
+        inline void mzc3_gc_set_dtor(void *, void (*)(void *))
+        {
+        }
+    #endif
+#else   // ndef MZC_NO_GC
+    #ifdef __cplusplus
+    extern "C" {
+    #endif
+
+    // Enter the GC section.
+    void MzcGC_Enter(int enable_gc);
+    // Enter the GC-enabled section whose allocations are bump-allocated
+    // from chunks of chunk_size bytes (zero for default) and freed at once
+    // on leaving.
+    #ifdef __cplusplus
+        void MzcGC_EnterArena(std::size_t chunk_size);
+    #else
+        void MzcGC_EnterArena(size_t chunk_size);
+    #endif
+    // Enter the GC-enabled section whose allocations are freed only when
+    // unreachable.  Leaving it or garbage collection in it scans the stack
+    // and the registers of the thread (and of the other threads that have
+    // used the GC, in multithread mode), the registered roots, and the
+    // allocations of the other sections of the thread.  The reachable
+    // allocations survive leaving, into the outer section.
+    void MzcGC_EnterConservative(void);
+    // Leave the GC section.
+    void MzcGC_Leave(void);
+    // Do garbage collection in the current GC section.
+    void MzcGC_GarbageCollect(void);
+    // The current GC section, or NULL if none.  It is valid until it is
+    // left, on its thread only.
+    MZC_GC_SECTION MzcGC_GetSection(void);
+    // Bump-allocate size bytes aligned to align, a power of two, from the
+    // storage of the section (NULL for the current one).  The memory is not
+    // tracked one by one, and is freed at once when the section is
+    // collected or left.  Only the thread of the section can allocate.
+    // Returns NULL on failure.
+    #ifdef __cplusplus
+        void *MzcGC_SectionAlloc(MZC_GC_SECTION section, std::size_t size,
+                                 std::size_t align);
+    #else
+        void *MzcGC_SectionAlloc(MZC_GC_SECTION section, size_t size,
+                                 size_t align);
+    #endif
+    // Register size bytes at ptr as roots of conservative sections, such as
+    // static data or the heap memory of other threads.  Returns non-zero on
+    // success.
+    #ifdef __cplusplus
+        int MzcGC_AddRoots(const void *ptr, std::size_t size);
+    #else
+        int MzcGC_AddRoots(const void *ptr, size_t size);
+    #endif
+    // Unregister the roots at ptr.
+    void MzcGC_RemoveRoots(const void *ptr);
+    // Make finalizer(ptr) called before the GC frees the block at ptr, but
+    // not on mzcfree.  Finalizers run in reverse allocation order, before
+    // any block of the batch is freed.  Only the thread of the section of
+    // the block can set it.  Returns non-zero if ptr is tracked.
+    int MzcGC_SetFinalizer(void *ptr, void (*finalizer)(void *));
+    // Move the block at ptr from its GC section to the section levels
+    // outer, so that it survives leaving.  The block becomes untracked if
+    // there is no such section or it is GC-disabled.  Only the thread of the
+    // section can move the block.  Returns non-zero on success.
+    #ifdef __cplusplus
+        int MzcGC_Promote(void *ptr, std::size_t levels);
+    #else
+        int MzcGC_Promote(void *ptr, size_t levels);
+    #endif
+    // Make the block at ptr untracked.  Returns non-zero on success.
+    int MzcGC_Detach(void *ptr);
+    // MzcGC_Promote for each of count blocks.  Returns how many moved.
+    #ifdef __cplusplus
+        std::size_t MzcGC_PromoteArray(void **ptrs, std::size_t count,
+                                       std::size_t levels);
+    #else
+        size_t MzcGC_PromoteArray(void **ptrs, size_t count, size_t levels);
+    #endif
+    // Start the background collector (MZC3_GC_MT only).  While it runs,
+    // leaving a GC-enabled section hands its allocations to it.  If more
+    // than max_backlog bytes (zero for default) are waiting, they are
+    // freed at once as usual.  Returns non-zero on success.
+    #ifdef __cplusplus
+        int MzcGC_StartCollector(std::size_t max_backlog);
+    #else
+        int MzcGC_StartCollector(size_t max_backlog);
+    #endif
+    // Wait until the collector has freed all the allocations handed to it.
+    void MzcGC_Drain(void);
+    // Drain and stop the collector.
+    void MzcGC_StopCollector(void);
+    // Get the statistics of all the threads.  Each thread counts by itself
+    // without locking, and they are summed up here.  Returns non-zero on
+    // success.
+    int MzcGC_GetStats(struct MZC_GC_STATS *stats);
+    // Write the statistics to fp in the Prometheus text exposition format.
+    // Returns non-zero on success.
+    #ifdef __cplusplus
+        int MzcGC_ExportStats(std::FILE *fp);
+    #else
+        int MzcGC_ExportStats(FILE *fp);
+    #endif
+    // Record the call stack of about one tracked allocation in every bytes
+    // bytes allocated, for MzcGC_DumpProfile.  Zero (default) stops it.
+    #ifdef __cplusplus
+        void MzcGC_SetSampleRate(std::size_t bytes);
+    #else
+        void MzcGC_SetSampleRate(size_t bytes);
+    #endif
+    // Write the live and the reclaimed bytes estimated for each call stack
+    // sampled, in the format MZC_GC_PROFILE_*.  Returns non-zero on success.
+    #ifdef __cplusplus
+        int MzcGC_DumpProfile(std::FILE *fp, int format);
+    #else
+        int MzcGC_DumpProfile(FILE *fp, int format);
+    #endif
+    // Write the tracked blocks to the file at path in the binary format of
+    // MZC_GC_HEAP_HEADER, for GCHeapDiff.  In the MZC3_GC_HEADER build, only
+    // those of the calling thread.  Returns non-zero on success.
+    int MzcGC_DumpHeap(const char *path);
+    // Limit the bytes of the current GC section and its inner sections to
+    // budget (zero for no limit) until leaving it.  An allocation that
+    // would exceed it is handled by policy, MZC_GC_BUDGET_*.  Returns
+    // non-zero on success.
+    #ifdef __cplusplus
+        int MzcGC_SetBudget(std::size_t budget, int policy);
+    #else
+        int MzcGC_SetBudget(size_t budget, int policy);
+    #endif
+    // Set the handler of MZC_GC_BUDGET_CALLBACK for all the threads.
+    void MzcGC_SetBudgetHandler(MZC_GC_BUDGET_HANDLER handler);
+    // Map the tracked blocks of bytes bytes or more (1MB by default) from
+    // the OS one by one, and unmap them when freed.  Zero stops it.
+    #ifdef __cplusplus
+        void MzcGC_SetLargeThreshold(std::size_t bytes);
+    #else
+        void MzcGC_SetLargeThreshold(size_t bytes);
+    #endif
+    // Give the freed memory back to the OS after garbage collections have
+    // freed threshold bytes in total since the last time.  Zero (default)
+    // stops it.
+    #ifdef __cplusplus
+        void MzcGC_SetTrimPolicy(std::size_t threshold);
+    #else
+        void MzcGC_SetTrimPolicy(size_t threshold);
+    #endif
+    // Give the freed memory back to the OS now.  Returns the bytes released.
+    #ifdef __cplusplus
+        std::size_t MzcGC_Trim(void);
+    #else
+        size_t MzcGC_Trim(void);
+    #endif
+
+    #ifdef _DEBUG
+        // Report the leaks in the current GC section, by call site and
+        // depth: the totals, and the top MZC_GC_REPORT_TOP sites by bytes
+        // and by count.
+        void MzcGC_Report(void);
+        // MzcGC_Report with the top sites, and MZC_GC_REPORT_* flags.
+        #ifdef __cplusplus
+            void MzcGC_ReportEx(std::size_t top, int flags);
+        #else
+            void MzcGC_ReportEx(size_t top, int flags);
+        #endif
+    #else
+        // No effect on release
+        #define MzcGC_Report()  /*empty*/
+        #define MzcGC_ReportEx(top, flags)  /*empty*/
+    #endif
+
+    // mzcmalloc, mzccalloc, mzcrealloc, mzcfree, and so on.
+    // mzcaligned_alloc and mzcposix_memalign allocate blocks aligned to a
+    // power of two.  Reallocating such a block keeps only the alignment of
+    // malloc.
+    // mzcfree_sized frees a block of size bytes, and checks the size if
+    // debugging.  mzcusable_size returns the usable bytes of a block, which
+    // reallocating up to keeps in place, or zero if unknown.
+    #ifdef __cplusplus
+        void mzcfree_sized(void *ptr, std::size_t size);
+        std::size_t mzcusable_size(void *ptr);
+    #else
+        void mzcfree_sized(void *ptr, size_t size);
+        size_t mzcusable_size(void *ptr);
+    #endif
+    #ifdef _DEBUG
+        #ifdef __cplusplus
+            void *mzcmalloc(std::size_t size, const char *file, int line);
+            void *mzccalloc(std::size_t num, std::size_t size, const char *file, int line);
+            void *mzcrealloc(void *ptr, std::size_t size, const char *file, int line);
+            void mzcfree(void *ptr);
+            char *mzcstrdup(const char *str, const char *file, int line);
+            wchar_t *mzcwcsdup(const wchar_t *str, const char *file, int line);
+            void *mzcaligned_alloc(std::size_t align, std::size_t size,
+                                   const char *file, int line);
+            int mzcposix_memalign(void **pptr, std::size_t align, std::size_t size,
+                                  const char *file, int line);
+        #else  // def __cplusplus
+            void *mzcmalloc(size_t size, const char *file, int line);
+            void *mzccalloc(size_t num, size_t size, const char *file, int line);
+            void *mzcrealloc(void *ptr, size_t size, const char *file, int line);
+            void mzcfree(void *ptr, const char *file, int line);
+            char *mzcstrdup(const char *str, const char *file, int line);
+            wchar_t *mzcwcsdup(const wchar_t *str, const char *file, int line);
+            void *mzcaligned_alloc(size_t align, size_t size,
+                                   const char *file, int line);
+            int mzcposix_memalign(void **pptr, size_t align, size_t size,
+                                  const char *file, int line);
+        #endif // def __cplusplus
+    #else
+        #ifdef __cplusplus
+            void *mzcmalloc(std::size_t size);
+            void *mzccalloc(std::size_t num, std::size_t size);
+            void *mzcrealloc(void *ptr, std::size_t size);
+            void mzcfree(void *ptr);
+            char *mzcstrdup(const char *str);
+            wchar_t *mzcwcsdup(const wchar_t *str);
+            void *mzcaligned_alloc(std::size_t align, std::size_t size);
+            int mzcposix_memalign(void **pptr, std::size_t align, std::size_t size);
+        #else  // def __cplusplus
+            void *mzcmalloc(size_t size);
+            void *mzccalloc(size_t num, size_t size);
+            void *mzcrealloc(void *ptr, size_t size);
+            void mzcfree(void *ptr);
+            char *mzcstrdup(const char *str);
+            wchar_t *mzcwcsdup(const wchar_t *str);
+            void *mzcaligned_alloc(size_t align, size_t size);
+            int mzcposix_memalign(void **pptr, size_t align, size_t size);
+        #endif // def __cplusplus
+    #endif
+
+    #ifdef __cplusplus
+        // for mzcgc_new: mzcaligned_alloc, but tracked even in an arena
+        // section, so that the finalizer of the block runs.
+        #ifdef _DEBUG
+            void *mzc3_gc_alloc_tracked(std::size_t align, std::size_t size,
+                                        const char *file, int line);
+        #else
+            void *mzc3_gc_alloc_tracked(std::size_t align, std::size_t size);
+        #endif
+    #endif
+
+    // The section stack of a thread, for the inline fast path below.
+    // Frames are recycled on leaving, so entering allocates nothing.
+    typedef struct MZC3_GC_FRAME
+    {
+        struct MZC3_GC_FRAME *next;     // the outer section or the next free one
+        int gc_enabled;
+        int busy;                       // non-zero if it may own anything
+    } MZC3_GC_FRAME;
+
+    typedef struct MZC3_GC_STACK
+    {
+        #ifdef __cplusplus
+            std::size_t depth;
+        #else
+            size_t depth;
+        #endif
+        MZC3_GC_FRAME *top;         // the current section
+        MZC3_GC_FRAME *spare;       // free frames
+    } MZC3_GC_STACK;
+
+    #ifndef MZC3_GC_MT
+        #define MZC3_GC_TLS     /*empty*/
+    #elif defined(_MSC_VER)
+        #define MZC3_GC_TLS     __declspec(thread)
+    #elif defined(__GNUC__)
+        #define MZC3_GC_TLS     __thread
+    #endif
+
+    #ifdef MZC3_GC_TLS
+        // NULL until the thread first enters a section.
+        extern MZC3_GC_TLS MZC3_GC_STACK *mzc3_gc_stack;
+    #endif
+
+    #ifdef __cplusplus
+    } // extern "C"
+    #endif
+
+    #ifdef MZC3_GC_TLS
+        #ifdef __cplusplus
+            #define MZC3_GC_INLINE  inline
+        #else
+            #define MZC3_GC_INLINE  static __inline
+        #endif
+
+        // Enters a section without locking or allocation if a free frame
+        // is at hand.
+        MZC3_GC_INLINE void MzcGC_EnterInline(int enable_gc)
+        {
+            MZC3_GC_STACK *stack = mzc3_gc_stack;
+            MZC3_GC_FRAME *frame;
+            if (stack && (frame = stack->spare) != NULL)
+            {
+                stack->spare = frame->next;
+                frame->gc_enabled = enable_gc;
+                frame->next = stack->top;
+                stack->top = frame;
+                stack->depth++;
+            }
+            else
+                (MzcGC_Enter)(enable_gc);
+        }
+
+        // Leaves a section that owns nothing without locking.
+        MZC3_GC_INLINE void MzcGC_LeaveInline(void)
+        {
+            MZC3_GC_STACK *stack = mzc3_gc_stack;
+            MZC3_GC_FRAME *frame;
+            if (stack && (frame = stack->top) != NULL && !frame->busy)
+            {
+                stack->top = frame->next;
+                frame->next = stack->spare;
+                stack->spare = frame;
+                stack->depth--;
+            }
+            else
+                (MzcGC_Leave)();
+        }
+
+        #define MzcGC_Enter(enable_gc)  MzcGC_EnterInline(enable_gc)
+        #define MzcGC_Leave()           MzcGC_LeaveInline()
+    #endif
+
+    #ifdef __cplusplus
+        // MzcGC_Promote or MzcGC_Detach for an object from mzcnew (not
+        // mzcnew[]), returning it.
+        template <typename T>
+        inline T *mzcgc_promote(T *ptr, std::size_t levels = 1)
+        {
+            MzcGC_Promote(const_cast<void *>(static_cast<const void *>(ptr)), levels);
+            return ptr;
+        }
+
+        template <typename T>
+        inline T *mzcgc_detach(T *ptr)
+        {
+            MzcGC_Detach(const_cast<void *>(static_cast<const void *>(ptr)));
+            return ptr;
+        }
+
+        // for mzcgc_new.  An object with a finalizer is tracked even in an
+        // arena section.
+        inline void *mzc3_gc_alloc_object(std::size_t size, std::size_t align,
+                                          bool finalized, const char *file,
+                                          int line)
+        {
+            #ifdef _DEBUG
+                void *ptr = (finalized ? mzc3_gc_alloc_tracked(align, size, file, line)
+                                       : mzcaligned_alloc(align, size, file, line));
+            #else
+                (void)file;
+                (void)line;
+                void *ptr = (finalized ? mzc3_gc_alloc_tracked(align, size)
+                                       : mzcaligned_alloc(align, size));
+            #endif
+            if (ptr == NULL)
+                throw std::bad_alloc();
+            return ptr;
+        }
+
+        inline void mzc3_gc_free_object(void *ptr)
+        {
+            mzcfree(ptr);
+        }
+
+        inline void mzc3_gc_set_dtor(void *ptr, void (*dtor)(void *))
+        {
+            MzcGC_SetFinalizer(ptr, dtor);
+        }
+
+        // new and delete.  C++11 drops the dynamic exception specifications.
+        #if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+            #define MZC3_GC_THROW_BAD_ALLOC     /*empty*/
+            #define MZC3_GC_NOTHROW             noexcept
+        #else
+            #define MZC3_GC_THROW_BAD_ALLOC     throw(std::bad_alloc)
+            #define MZC3_GC_NOTHROW             throw()
+        #endif
+
+        void* operator new(std::size_t size) MZC3_GC_THROW_BAD_ALLOC;
+        void* operator new[](std::size_t size) MZC3_GC_THROW_BAD_ALLOC;
+
+        #ifndef __BORLANDC__    // avoid E2171
+            void* operator new(std::size_t size, const std::nothrow_t&) MZC3_GC_NOTHROW;
+            void* operator new[](std::size_t size, const std::nothrow_t&) MZC3_GC_NOTHROW;
+        #endif
+
+        void operator delete(void* ptr) MZC3_GC_NOTHROW;
+        void operator delete[](void* ptr) MZC3_GC_NOTHROW;
+        #ifdef __cpp_sized_deallocation
+            void operator delete(void* ptr, std::size_t size) noexcept;
+            void operator delete[](void* ptr, std::size_t size) noexcept;
+        #endif
+
+        #ifdef _DEBUG
+            void* operator new(std::size_t size, const char *file, int line)
+                MZC3_GC_THROW_BAD_ALLOC;
+            void* operator new[](std::size_t size, const char *file, int line)
+                MZC3_GC_THROW_BAD_ALLOC;
+            void* operator new(std::size_t size, const std::nothrow_t&,
+                                         const char *file, int line) MZC3_GC_NOTHROW;
+            void* operator new[](std::size_t size, const std::nothrow_t&,
+                                         const char *file, int line) MZC3_GC_NOTHROW;
+        #endif
+
+        #ifdef __cpp_aligned_new
+            // for over-aligned types (C++17)
+            void* operator new(std::size_t size, std::align_val_t align);
+            void* operator new[](std::size_t size, std::align_val_t align);
+            void* operator new(std::size_t size, std::align_val_t align,
+                               const std::nothrow_t&) noexcept;
+            void* operator new[](std::size_t size, std::align_val_t align,
+                                 const std::nothrow_t&) noexcept;
+            void operator delete(void* ptr, std::align_val_t align) noexcept;
+            void operator delete[](void* ptr, std::align_val_t align) noexcept;
+            void operator delete(void* ptr, std::size_t size,
+                                 std::align_val_t align) noexcept;
+            void operator delete[](void* ptr, std::size_t size,
+                                   std::align_val_t align) noexcept;
+
+            #ifdef _DEBUG
+                void* operator new(std::size_t size, std::align_val_t align,
+                                   const char *file, int line);
+                void* operator new[](std::size_t size, std::align_val_t align,
+                                     const char *file, int line);
+                void* operator new(std::size_t size, std::align_val_t align,
+                                   const std::nothrow_t&,
+                                   const char *file, int line) noexcept;
+                void* operator new[](std::size_t size, std::align_val_t align,
+                                     const std::nothrow_t&,
+                                     const char *file, int line) noexcept;
+            #endif
+        #endif
+    #endif  // __cplusplus
+
+#endif  // ndef MZC_NO_GC
+
+#ifdef __cplusplus
+    #ifdef __has_builtin
+        #if __has_builtin(__is_trivially_destructible)
+            #define MZC3_GC_TRIVIAL_DTOR(T)     __is_trivially_destructible(T)
+        #endif
+    #endif
+    #ifndef MZC3_GC_TRIVIAL_DTOR
+        #if defined(__GNUC__) || defined(_MSC_VER)
+            #define MZC3_GC_TRIVIAL_DTOR(T)     __has_trivial_destructor(T)
+        #else
+            #define MZC3_GC_TRIVIAL_DTOR(T)     false
+        #endif
+    #endif
+
+    template <typename T>
+    void mzc3_gc_destroy(void *ptr)
+    {
+        static_cast<T *>(ptr)->~T();
+    }
+
+    #if __cplusplus >= 201103L
+        #define MZC3_GC_ALIGNOF(T)      alignof(T)
+    #elif defined(__GNUC__)
+        #define MZC3_GC_ALIGNOF(T)      __alignof__(T)
+    #elif defined(_MSC_VER)
+        #define MZC3_GC_ALIGNOF(T)      __alignof(T)
+    #else
+        #define MZC3_GC_ALIGNOF(T)      1   // only the alignment of malloc
+    #endif
+
+    // Makes the destructor the finalizer, unless it is trivial.
+    template <typename T>
+    inline T *mzc3_gc_finalize(T *obj)
+    {
+        if (!MZC3_GC_TRIVIAL_DTOR(T))
+            mzc3_gc_set_dtor(obj, &mzc3_gc_destroy<T>);
+        return obj;
+    }
+
+    // MZC3_GC_NEW --- the call site of mzcgc_new, whose members construct
+    // the objects
+    class MZC3_GC_NEW
+    {
+    public:
+        MZC3_GC_NEW(const char *file, int line) : m_file(file), m_line(line)
+        {
+        }
+
+        template <typename T>
+        T *New() const
+        {
+            void *ptr = Alloc(sizeof(T), MZC3_GC_ALIGNOF(T), !MZC3_GC_TRIVIAL_DTOR(T));
+            try { return mzc3_gc_finalize(::new(ptr) T()); }
+            catch (...) { mzc3_gc_free_object(ptr); throw; }
+        }
+
+        template <typename T, typename A1>
+        T *New(const A1& a1) const
+        {
+            void *ptr = Alloc(sizeof(T), MZC3_GC_ALIGNOF(T), !MZC3_GC_TRIVIAL_DTOR(T));
+            try { return mzc3_gc_finalize(::new(ptr) T(a1)); }
+            catch (...) { mzc3_gc_free_object(ptr); throw; }
+        }
+
+        template <typename T, typename A1, typename A2>
+        T *New(const A1& a1, const A2& a2) const
+        {
+            void *ptr = Alloc(sizeof(T), MZC3_GC_ALIGNOF(T), !MZC3_GC_TRIVIAL_DTOR(T));
+            try { return mzc3_gc_finalize(::new(ptr) T(a1, a2)); }
+            catch (...) { mzc3_gc_free_object(ptr); throw; }
+        }
+
+        template <typename T, typename A1, typename A2, typename A3>
+        T *New(const A1& a1, const A2& a2, const A3& a3) const
+        {
+            void *ptr = Alloc(sizeof(T), MZC3_GC_ALIGNOF(T), !MZC3_GC_TRIVIAL_DTOR(T));
+            try { return mzc3_gc_finalize(::new(ptr) T(a1, a2, a3)); }
+            catch (...) { mzc3_gc_free_object(ptr); throw; }
+        }
+
+        template <typename T, typename A1, typename A2, typename A3, typename A4>
+        T *New(const A1& a1, const A2& a2, const A3& a3, const A4& a4) const
+        {
+            void *ptr = Alloc(sizeof(T), MZC3_GC_ALIGNOF(T), !MZC3_GC_TRIVIAL_DTOR(T));
+            try { return mzc3_gc_finalize(::new(ptr) T(a1, a2, a3, a4)); }
+            catch (...) { mzc3_gc_free_object(ptr); throw; }
+        }
+
+    private:
+        const char *m_file;
+        int         m_line;
+
+        void *Alloc(std::size_t size, std::size_t align, bool finalized) const
+        {
+            return mzc3_gc_alloc_object(size, align, finalized, m_file, m_line);
+        }
+    };
+
+    // mzcgc_new<T>(args...) --- new T(args...) whose destructor runs when
+    // the GC frees it.  Use mzcgc_delete to delete it by hand.  It is a
+    // macro passing the call site if debugging, as mzcnew is.
+    #ifdef _DEBUG
+        #define mzcgc_new MZC3_GC_NEW(__FILE__, __LINE__).New
+    #else
+        template <typename T>
+        inline T *mzcgc_new()
+        {
+            return MZC3_GC_NEW(NULL, 0).New<T>();
+        }
+
+        template <typename T, typename A1>
+        inline T *mzcgc_new(const A1& a1)
+        {
+            return MZC3_GC_NEW(NULL, 0).New<T>(a1);
+        }
+
+        template <typename T, typename A1, typename A2>
+        inline T *mzcgc_new(const A1& a1, const A2& a2)
+        {
+            return MZC3_GC_NEW(NULL, 0).New<T>(a1, a2);
+        }
+
+        template <typename T, typename A1, typename A2, typename A3>
+        inline T *mzcgc_new(const A1& a1, const A2& a2, const A3& a3)
+        {
+            return MZC3_GC_NEW(NULL, 0).New<T>(a1, a2, a3);
+        }
+
+        template <typename T, typename A1, typename A2, typename A3, typename A4>
+        inline T *mzcgc_new(const A1& a1, const A2& a2, const A3& a3, const A4& a4)
+        {
+            return MZC3_GC_NEW(NULL, 0).New<T>(a1, a2, a3, a4);
+        }
+    #endif
+
+    template <typename T>
+    inline void mzcgc_delete(T *obj)
+    {
+        if (obj)
+        {
+            obj->~T();
+            mzc3_gc_free_object(const_cast<void *>(static_cast<const void *>(obj)));
+        }
+    }
+
+    // MzcGCAllocator<T> --- an STL allocator that allocates from the storage
+    // of a GC section (the current one by default) by MzcGC_SectionAlloc.
+    // Deallocation is no-op, and the memory is freed at once when the
+    // section is collected or left, so the container must not outlive it.
+    template <typename T>
+    class MzcGCAllocator
+    {
+    public:
+        typedef T                   value_type;
+        typedef T *                 pointer;
+        typedef const T *           const_pointer;
+        typedef T&                  reference;
+        typedef const T&            const_reference;
+        typedef std::size_t         size_type;
+        typedef std::ptrdiff_t      difference_type;
+
+        template <typename U>
+        struct rebind
+        {
+            typedef MzcGCAllocator<U> other;
+        };
+
+        MzcGCAllocator() : m_section(MzcGC_GetSection())
+        {
+        }
+
+        explicit MzcGCAllocator(MZC_GC_SECTION section) : m_section(section)
+        {
+        }
+
+        template <typename U>
+        MzcGCAllocator(const MzcGCAllocator<U>& other)
+            : m_section(other.section())
+        {
+        }
+
+        MZC_GC_SECTION section() const
+        {
+            return m_section;
+        }
+
+        pointer address(reference r) const
+        {
+            return &r;
+        }
+
+        const_pointer address(const_reference r) const
+        {
+            return &r;
+        }
+
+        pointer allocate(size_type n, const void * = 0)
+        {
+            if (n > max_size())
+                throw std::bad_alloc();
+            #ifdef MZC_NO_GC
+                return static_cast<pointer>(::operator new(n * sizeof(T)));
+            #else
+                void *ptr = MzcGC_SectionAlloc(m_section, n * sizeof(T),
+                                               MZC3_GC_ALIGNOF(T));
+                if (ptr == NULL)
+                    throw std::bad_alloc();
+                return static_cast<pointer>(ptr);
+            #endif
+        }
+
+        void deallocate(pointer ptr, size_type)
+        {
+            #ifdef MZC_NO_GC
+                ::operator delete(ptr);
+            #else
+                (void)ptr;  // freed with the section
+            #endif
+        }
+
+        size_type max_size() const
+        {
+            return ~size_type(0) / sizeof(T);
+        }
+
+        #if __cplusplus < 201103L
+            // C++11 constructs by std::allocator_traits.
+            void construct(pointer ptr, const T& value)
+            {
+                ::new(static_cast<void *>(ptr)) T(value);
+            }
+
+            void destroy(pointer ptr)
+            {
+                ptr->~T();
+            }
+        #endif
+
+    private:
+        MZC_GC_SECTION m_section;
+    };
+
+    template <typename T, typename U>
+    inline bool operator==(const MzcGCAllocator<T>& a, const MzcGCAllocator<U>& b)
+    {
+        return a.section() == b.section();
+    }
+
+    template <typename T, typename U>
+    inline bool operator!=(const MzcGCAllocator<T>& a, const MzcGCAllocator<U>& b)
+    {
+        return a.section() != b.section();
+    }
+
+    #ifdef __cpp_lib_memory_resource
+        // MzcGC_MemoryResource --- a std::pmr::memory_resource like
+        // MzcGCAllocator, for the std::pmr containers.
+        class MzcGC_MemoryResource : public std::pmr::memory_resource
+        {
+        public:
+            MzcGC_MemoryResource() : m_section(MzcGC_GetSection())
+            {
+            }
+
+            explicit MzcGC_MemoryResource(MZC_GC_SECTION section)
+                : m_section(section)
+            {
+            }
+
+            MZC_GC_SECTION section() const noexcept
+            {
+                return m_section;
+            }
+
+        protected:
+            void *do_allocate(std::size_t bytes, std::size_t align) override
+            {
+                #ifdef MZC_NO_GC
+                    return std::pmr::new_delete_resource()->allocate(bytes, align);
+                #else
+                    void *ptr = MzcGC_SectionAlloc(m_section, bytes, align);
+                    if (ptr == NULL)
+                        throw std::bad_alloc();
+                    return ptr;
+                #endif
+            }
+
+            void do_deallocate(void *ptr, std::size_t bytes,
+                               std::size_t align) override
+            {
+                #ifdef MZC_NO_GC
+                    std::pmr::new_delete_resource()->deallocate(ptr, bytes, align);
+                #else
+                    (void)ptr;  // freed with the section
+                    (void)bytes;
+                    (void)align;
+                #endif
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource& other) const
+                noexcept override
+            {
+                const MzcGC_MemoryResource *r =
+                    dynamic_cast<const MzcGC_MemoryResource *>(&other);
+                return (r && r->m_section == m_section);
+            }
+
+        private:
+            MZC_GC_SECTION m_section;
+        };
+    #endif
+#endif  // __cplusplus
+
+#ifndef MZC_NO_GC
+    // wrapping
+    #include "GC_wrap.h"
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+
+#endif  /* ndef __MZC3_GC_H__ */
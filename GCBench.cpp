@@ -0,0 +1,552 @@
+////////////////////////////////////////////////////////////////////////////
+// GCBench.cpp -- MZC3 GC benchmark
+// This file is part of MZC3.  See file "ReadMe.txt" and "License.txt".
+////////////////////////////////////////////////////////////////////////////
+// Usage: GCBench [-s scale] [-t max_threads] [workload ...]
+// See LinuxBench.sh for the builds compared.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "GC.h"
+
+#if defined(MZC_NO_GC)
+    #define GCBENCH_BUILD "MZC_NO_GC"
+#elif defined(MZC3_GC_MT)
+    #define GCBENCH_BUILD "MZC3_GC_MT"
+#else
+    #define GCBENCH_BUILD "MZC3_GC"
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// GCBENCH_ALLOCATOR --- the allocator measured
+//
+// The names of libc are parenthesized against the wrappers of GC.h.
+
+struct GCBENCH_ALLOCATOR
+{
+    const char *name;
+    void *(*pmalloc)(std::size_t size);
+    void *(*prealloc)(void *ptr, std::size_t size);
+    void  (*pfree)(void *ptr);
+    void  (*penter)(int enable_gc);
+    void  (*pleave)(void);
+    bool    collects;   // MzcGC_Leave frees the blocks of the section
+};
+
+static void *LibcMalloc(std::size_t size)
+{
+    return (std::malloc)(size);
+}
+
+static void *LibcRealloc(void *ptr, std::size_t size)
+{
+    return (std::realloc)(ptr, size);
+}
+
+static void LibcFree(void *ptr)
+{
+    (std::free)(ptr);
+}
+
+static void LibcEnter(int)
+{
+}
+
+static void LibcLeave(void)
+{
+}
+
+static void *MzcMalloc(std::size_t size)
+{
+    return malloc(size);
+}
+
+static void *MzcRealloc(void *ptr, std::size_t size)
+{
+    return realloc(ptr, size);
+}
+
+static void MzcFree(void *ptr)
+{
+    free(ptr);
+}
+
+static void MzcEnter(int enable_gc)
+{
+    MzcGC_Enter(enable_gc);
+}
+
+static void MzcLeave(void)
+{
+    MzcGC_Leave();
+}
+
+static const GCBENCH_ALLOCATOR s_allocators[] =
+{
+    { "libc", LibcMalloc, LibcRealloc, LibcFree, LibcEnter, LibcLeave, false },
+#ifdef MZC_NO_GC
+    { "mzc", MzcMalloc, MzcRealloc, MzcFree, MzcEnter, MzcLeave, false },
+#else
+    { "mzc", MzcMalloc, MzcRealloc, MzcFree, MzcEnter, MzcLeave, true },
+#endif
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// timing
+
+static double GCBench_Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+}
+
+// the cost of a pair of GCBench_Now in nanoseconds, subtracted from the
+// latencies
+static double s_timer_ns = 0;
+
+// GCBENCH_HISTOGRAM --- latencies in nanoseconds, with 16 buckets per
+// power of two
+static const int GCBENCH_SUB_BUCKETS = 16;
+static const int GCBENCH_BUCKETS = GCBENCH_SUB_BUCKETS * 48;
+
+struct GCBENCH_HISTOGRAM
+{
+    std::size_t counts[GCBENCH_BUCKETS];
+    std::size_t total;
+    double      max_ns;
+};
+
+static void GCBench_Record(GCBENCH_HISTOGRAM *h, double ns)
+{
+    ns -= s_timer_ns;
+    if (ns < 0)
+        ns = 0;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+
+    std::size_t value = static_cast<std::size_t>(ns);
+    int bucket;
+    if (value < std::size_t(GCBENCH_SUB_BUCKETS))
+    {
+        bucket = static_cast<int>(value);
+    }
+    else
+    {
+        int shift = 0;
+        while ((value >> shift) >= std::size_t(2 * GCBENCH_SUB_BUCKETS))
+            shift++;
+        bucket = (shift + 1) * GCBENCH_SUB_BUCKETS +
+                 static_cast<int>((value >> shift) - GCBENCH_SUB_BUCKETS);
+    }
+    if (bucket >= GCBENCH_BUCKETS)
+        bucket = GCBENCH_BUCKETS - 1;
+    h->counts[bucket]++;
+    h->total++;
+}
+
+// Returns the lower end of the bucket in nanoseconds.
+static double GCBench_BucketValue(int bucket)
+{
+    if (bucket < GCBENCH_SUB_BUCKETS)
+        return bucket;
+    const int shift = bucket / GCBENCH_SUB_BUCKETS - 1;
+    const int sub = bucket % GCBENCH_SUB_BUCKETS + GCBENCH_SUB_BUCKETS;
+    return double(sub) * double(std::size_t(1) << shift);
+}
+
+static double GCBench_Percentile(const GCBENCH_HISTOGRAM *h, double percent)
+{
+    const double rank = double(h->total) * percent / 100.0;
+    double count = 0;
+    for (int i = 0; i < GCBENCH_BUCKETS; i++)
+    {
+        count += double(h->counts[i]);
+        if (count >= rank && h->counts[i])
+            return GCBench_BucketValue(i);
+    }
+    return h->max_ns;
+}
+
+static void GCBench_Merge(GCBENCH_HISTOGRAM *dest, const GCBENCH_HISTOGRAM *src)
+{
+    for (int i = 0; i < GCBENCH_BUCKETS; i++)
+        dest->counts[i] += src->counts[i];
+    dest->total += src->total;
+    if (src->max_ns > dest->max_ns)
+        dest->max_ns = src->max_ns;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// workloads
+//
+// A workload runs rounds of operations.  If h is not NULL, each operation
+// is timed into h.  Returns the number of operations.
+
+typedef std::size_t (*GCBENCH_WORKLOAD)(const GCBENCH_ALLOCATOR *a,
+                                        std::size_t scale,
+                                        GCBENCH_HISTOGRAM *h);
+
+static const std::size_t GCBENCH_BATCH = 1000;
+
+// a small xorshift for the sizes
+static unsigned GCBench_Rand(unsigned *seed)
+{
+    unsigned x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+// malloc and free of small blocks
+static std::size_t GCBench_MallocFree(const GCBENCH_ALLOCATOR *a,
+                                      std::size_t scale, GCBENCH_HISTOGRAM *h)
+{
+    void *ptrs[GCBENCH_BATCH];
+    unsigned seed = 12345;
+    std::size_t ops = 0;
+    for (std::size_t round = 0; round < 200 * scale; round++)
+    {
+        a->penter(1);
+        for (std::size_t i = 0; i < GCBENCH_BATCH; i++)
+        {
+            const std::size_t size = 16 + GCBench_Rand(&seed) % 497;
+            const double start = (h ? GCBench_Now() : 0);
+            ptrs[i] = a->pmalloc(size);
+            if (h)
+                GCBench_Record(h, (GCBench_Now() - start) * 1e9);
+        }
+        for (std::size_t i = GCBENCH_BATCH; i > 0; i--)
+        {
+            const double start = (h ? GCBench_Now() : 0);
+            a->pfree(ptrs[i - 1]);
+            if (h)
+                GCBench_Record(h, (GCBench_Now() - start) * 1e9);
+        }
+        a->pleave();
+        ops += 2 * GCBENCH_BATCH;
+    }
+    return ops;
+}
+
+// nested sections of a few blocks each
+static std::size_t GCBench_EnterLeave(const GCBENCH_ALLOCATOR *a,
+                                      std::size_t scale, GCBENCH_HISTOGRAM *h)
+{
+    static const std::size_t depth = 8;
+    void *ptrs[depth];
+    std::size_t ops = 0;
+    for (std::size_t round = 0; round < 25000 * scale; round++)
+    {
+        // An operation is entering, allocating a block, and leaving.
+        const double start = (h ? GCBench_Now() : 0);
+        for (std::size_t i = 0; i < depth; i++)
+        {
+            a->penter(1);
+            ptrs[i] = a->pmalloc(32 + 16 * i);
+        }
+        for (std::size_t i = depth; i > 0; i--)
+        {
+            if (!a->collects)
+                a->pfree(ptrs[i - 1]);
+            a->pleave();
+        }
+        if (h)
+            GCBench_Record(h, (GCBench_Now() - start) * 1e9 / depth);
+        ops += depth;
+    }
+    return ops;
+}
+
+// nested sections that own nothing, alternately without and with GC
+static std::size_t GCBench_EnterLeaveEmpty(const GCBENCH_ALLOCATOR *a,
+                                           std::size_t scale,
+                                           GCBENCH_HISTOGRAM *h)
+{
+    static const std::size_t depth = 8;
+    std::size_t ops = 0;
+    for (std::size_t round = 0; round < 100000 * scale; round++)
+    {
+        // An operation is entering and leaving.
+        const double start = (h ? GCBench_Now() : 0);
+        for (std::size_t i = 0; i < depth; i++)
+            a->penter(int(i & 1));
+        for (std::size_t i = depth; i > 0; i--)
+            a->pleave();
+        if (h)
+            GCBench_Record(h, (GCBench_Now() - start) * 1e9 / depth);
+        ops += depth;
+    }
+    return ops;
+}
+
+// realloc of blocks to random sizes
+static std::size_t GCBench_Realloc(const GCBENCH_ALLOCATOR *a,
+                                   std::size_t scale, GCBENCH_HISTOGRAM *h)
+{
+    void *ptrs[GCBENCH_BATCH];
+    unsigned seed = 54321;
+    std::size_t ops = 0;
+    a->penter(1);
+    for (std::size_t i = 0; i < GCBENCH_BATCH; i++)
+        ptrs[i] = a->pmalloc(16);
+    for (std::size_t round = 0; round < 200 * scale; round++)
+    {
+        for (std::size_t i = 0; i < GCBENCH_BATCH; i++)
+        {
+            const std::size_t slot = GCBench_Rand(&seed) % GCBENCH_BATCH;
+            const std::size_t size = 1 + GCBench_Rand(&seed) % 4096;
+            const double start = (h ? GCBench_Now() : 0);
+            void *ptr = a->prealloc(ptrs[slot], size);
+            if (h)
+                GCBench_Record(h, (GCBench_Now() - start) * 1e9);
+            if (ptr)
+                ptrs[slot] = ptr;
+        }
+        ops += GCBENCH_BATCH;
+    }
+    for (std::size_t i = 0; i < GCBENCH_BATCH; i++)
+        a->pfree(ptrs[i]);
+    a->pleave();
+    return ops;
+}
+
+// Allocates many blocks in a section, and leaves it.  The latency is of
+// freeing them all: leaving for the GC, freeing one by one otherwise.
+static std::size_t GCBench_CollectLarge(const GCBENCH_ALLOCATOR *a,
+                                        std::size_t scale, GCBENCH_HISTOGRAM *h)
+{
+    static const std::size_t count = 100000;
+    void **ptrs = static_cast<void **>((std::malloc)(count * sizeof(void *)));
+    if (ptrs == NULL)
+        return 0;
+
+    unsigned seed = 777;
+    std::size_t ops = 0;
+    for (std::size_t round = 0; round < 5 * scale; round++)
+    {
+        a->penter(1);
+        for (std::size_t i = 0; i < count; i++)
+            ptrs[i] = a->pmalloc(16 + GCBench_Rand(&seed) % 241);
+
+        const double start = (h ? GCBench_Now() : 0);
+        if (!a->collects)
+        {
+            for (std::size_t i = 0; i < count; i++)
+                a->pfree(ptrs[i]);
+        }
+        a->pleave();
+        if (h)
+            GCBench_Record(h, (GCBench_Now() - start) * 1e9);
+        ops += count;
+    }
+    (std::free)(ptrs);
+    return ops;
+}
+
+struct GCBENCH_ENTRY
+{
+    const char *        name;
+    GCBENCH_WORKLOAD    workload;
+    bool                threaded;   // also run by 1 to N threads
+};
+
+static const GCBENCH_ENTRY s_workloads[] =
+{
+    { "malloc-free", GCBench_MallocFree, false },
+    { "enter-leave", GCBench_EnterLeave, false },
+    { "enter-leave-empty", GCBench_EnterLeaveEmpty, false },
+    { "realloc", GCBench_Realloc, false },
+    { "collect-large", GCBench_CollectLarge, false },
+    { "mt-malloc-free", GCBench_MallocFree, true },
+    { "mt-enter-leave", GCBench_EnterLeave, true },
+    { "mt-enter-leave-empty", GCBench_EnterLeaveEmpty, true },
+    { "mt-realloc", GCBench_Realloc, true },
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// running
+
+struct GCBENCH_THREAD
+{
+    const GCBENCH_ALLOCATOR *   allocator;
+    GCBENCH_WORKLOAD            workload;
+    std::size_t                 scale;
+    GCBENCH_HISTOGRAM *         histogram;
+    std::size_t                 ops;
+    pthread_t                   thread;
+};
+
+static void *GCBench_ThreadProc(void *param)
+{
+    GCBENCH_THREAD *t = static_cast<GCBENCH_THREAD *>(param);
+    t->ops = t->workload(t->allocator, t->scale, t->histogram);
+    return NULL;
+}
+
+// Runs the workload by nthreads threads, and returns the operations per
+// second.  If h is not NULL, the operations are timed into it.
+static double GCBench_Run(const GCBENCH_ENTRY *entry, const GCBENCH_ALLOCATOR *a,
+                          std::size_t scale, int nthreads, GCBENCH_HISTOGRAM *h)
+{
+    if (!entry->threaded)
+    {
+        const double start = GCBench_Now();
+        const std::size_t ops = entry->workload(a, scale, h);
+        return double(ops) / (GCBench_Now() - start);
+    }
+
+    GCBENCH_THREAD *threads = static_cast<GCBENCH_THREAD *>(
+        (std::calloc)(nthreads, sizeof(GCBENCH_THREAD)));
+    GCBENCH_HISTOGRAM *histograms = static_cast<GCBENCH_HISTOGRAM *>(
+        (std::calloc)(nthreads, sizeof(GCBENCH_HISTOGRAM)));
+    if (threads == NULL || histograms == NULL)
+        return 0;
+
+    const double start = GCBench_Now();
+    int started = 0;
+    for (; started < nthreads; started++)
+    {
+        GCBENCH_THREAD *t = &threads[started];
+        t->allocator = a;
+        t->workload = entry->workload;
+        t->scale = scale;
+        t->histogram = (h ? &histograms[started] : NULL);
+        if (pthread_create(&t->thread, NULL, GCBench_ThreadProc, t) != 0)
+            break;
+    }
+    std::size_t ops = 0;
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        ops += threads[i].ops;
+        if (h)
+            GCBench_Merge(h, &histograms[i]);
+    }
+    const double seconds = GCBench_Now() - start;
+
+    (std::free)(threads);
+    (std::free)(histograms);
+    return double(ops) / seconds;
+}
+
+// Measures a workload in a child process, so that the peak RSS is its own.
+static void GCBench_Measure(const GCBENCH_ENTRY *entry, const GCBENCH_ALLOCATOR *a,
+                            std::size_t scale, int nthreads)
+{
+    std::fflush(stdout);
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        std::perror("fork");
+        return;
+    }
+    if (pid > 0)
+    {
+        int status;
+        waitpid(pid, &status, 0);
+        return;
+    }
+
+    // The throughput is measured without the timer in the way.
+    const double ops_per_sec = GCBench_Run(entry, a, scale, nthreads, NULL);
+
+    GCBENCH_HISTOGRAM *h = static_cast<GCBENCH_HISTOGRAM *>(
+        (std::calloc)(1, sizeof(GCBENCH_HISTOGRAM)));
+    if (h)
+        GCBench_Run(entry, a, scale, nthreads, h);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::printf("%-20s %7d %-9s %12.0f", entry->name, nthreads, a->name, ops_per_sec);
+    if (h)
+    {
+        std::printf(" %9.0f %9.0f %9.0f %11.0f", GCBench_Percentile(h, 50),
+                    GCBench_Percentile(h, 99), GCBench_Percentile(h, 99.9),
+                    h->max_ns);
+    }
+    std::printf(" %11ld\n", static_cast<long>(usage.ru_maxrss));
+    std::fflush(stdout);
+    _exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t scale = 1;
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int first = 1;
+    for (; first < argc; first++)
+    {
+        if (std::strcmp(argv[first], "-s") == 0 && first + 1 < argc)
+            scale = std::strtoul(argv[++first], NULL, 10);
+        else if (std::strcmp(argv[first], "-t") == 0 && first + 1 < argc)
+            max_threads = std::strtol(argv[++first], NULL, 10);
+        else
+            break;
+    }
+    if (scale == 0)
+        scale = 1;
+    if (max_threads < 1)
+        max_threads = 1;
+    if (max_threads > 64)
+        max_threads = 64;
+
+    double timer_min = 1;
+    for (int i = 0; i < 1000; i++)
+    {
+        const double start = GCBench_Now();
+        const double ns = GCBench_Now() - start;
+        if (ns < timer_min)
+            timer_min = ns;
+    }
+    s_timer_ns = timer_min * 1e9;
+
+    std::printf("# GCBench: build %s, scale %lu, timer %.0f ns (subtracted)\n",
+                GCBENCH_BUILD, static_cast<unsigned long>(scale), s_timer_ns);
+    std::printf("%-20s %7s %-9s %12s %9s %9s %9s %11s %11s\n", "workload",
+                "threads", "allocator", "ops/s", "p50 ns", "p99 ns",
+                "p99.9 ns", "max ns", "peak RSS KB");
+
+    const std::size_t nworkloads = sizeof(s_workloads) / sizeof(s_workloads[0]);
+    const std::size_t nallocators = sizeof(s_allocators) / sizeof(s_allocators[0]);
+    for (std::size_t w = 0; w < nworkloads; w++)
+    {
+        const GCBENCH_ENTRY *entry = &s_workloads[w];
+        bool selected = (first == argc);
+        for (int i = first; i < argc; i++)
+        {
+            if (std::strcmp(argv[i], entry->name) == 0)
+                selected = true;
+        }
+        if (!selected)
+            continue;
+
+        #if !defined(MZC3_GC_MT) && !defined(MZC_NO_GC)
+            if (entry->threaded)
+            {
+                std::printf("%-20s skipped (needs MZC3_GC_MT)\n", entry->name);
+                continue;
+            }
+        #endif
+
+        for (long nthreads = 1; nthreads <= (entry->threaded ? max_threads : 1);
+             nthreads *= 2)
+        {
+            for (std::size_t k = 0; k < nallocators; k++)
+                GCBench_Measure(entry, &s_allocators[k], scale, int(nthreads));
+            if (nthreads < max_threads && nthreads * 2 > max_threads)
+                nthreads = max_threads / 2;     // end with max_threads
+        }
+    }
+    return 0;
+}
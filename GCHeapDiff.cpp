@@ -0,0 +1,353 @@
+////////////////////////////////////////////////////////////////////////////
+// GCHeapDiff.cpp -- MZC3 GC heap dump comparer
+// This file is part of MZC3.  See file "ReadMe.txt" and "License.txt".
+////////////////////////////////////////////////////////////////////////////
+// Usage: GCHeapDiff [-n count] old_dump new_dump
+// Compares two files of MzcGC_DumpHeap, and reports the growth of the
+// tracked blocks by call site and by section depth.  Both dumps must be
+// from a build of the same word size and byte order as this tool.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// the format only; no need to link GC.cpp
+#ifndef MZC_NO_GC
+    #define MZC_NO_GC
+#endif
+#include "GC.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// GCHEAPDIFF_MAPPING --- a file mapped read-only
+
+struct GCHEAPDIFF_MAPPING
+{
+    const char *data;
+    std::size_t size;
+    #ifdef _WIN32
+        HANDLE file;
+        HANDLE mapping;
+    #endif
+};
+
+static bool MapFile(GCHEAPDIFF_MAPPING *m, const char *path)
+{
+    m->data = NULL;
+    m->size = 0;
+    #ifdef _WIN32
+        m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (m->file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m->file, &size) || size.QuadPart == 0 ||
+            static_cast<unsigned long long>(size.QuadPart) > ~std::size_t(0))
+        {
+            CloseHandle(m->file);
+            return false;
+        }
+        m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m->mapping == NULL)
+        {
+            CloseHandle(m->file);
+            return false;
+        }
+        m->data = static_cast<const char *>(
+            MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m->data == NULL)
+        {
+            CloseHandle(m->mapping);
+            CloseHandle(m->file);
+            return false;
+        }
+        m->size = static_cast<std::size_t>(size.QuadPart);
+    #else
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            close(fd);
+            return false;
+        }
+        void *data = mmap(NULL, static_cast<std::size_t>(st.st_size),
+                          PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            return false;
+        m->data = static_cast<const char *>(data);
+        m->size = static_cast<std::size_t>(st.st_size);
+    #endif
+    return true;
+}
+
+static void UnmapFile(GCHEAPDIFF_MAPPING *m)
+{
+    if (m->data == NULL)
+        return;
+    #ifdef _WIN32
+        UnmapViewOfFile(m->data);
+        CloseHandle(m->mapping);
+        CloseHandle(m->file);
+    #else
+        munmap(const_cast<char *>(m->data), m->size);
+    #endif
+    m->data = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// GCHEAPDIFF_DUMP --- a dump loaded
+
+struct GCHEAPDIFF_DUMP
+{
+    GCHEAPDIFF_MAPPING          mapping;
+    MZC_GC_HEAP_HEADER          header;
+    const MZC_GC_HEAP_RECORD *  records;    // in the mapping
+    std::vector<std::string>    sites;      // sites[0] is the unknown site
+};
+
+// Checks and loads the dump at path.  Prints the error and returns false
+// if it is not a dump of this build.
+static bool LoadDump(GCHEAPDIFF_DUMP *dump, const char *path)
+{
+    using namespace std;
+    if (!MapFile(&dump->mapping, path))
+    {
+        fprintf(stderr, "GCHeapDiff: %s: cannot map\n", path);
+        return false;
+    }
+
+    const char *data = dump->mapping.data;
+    const std::size_t size = dump->mapping.size;
+    if (size < sizeof(MZC_GC_HEAP_HEADER) ||
+        memcmp(data, MZC_GC_HEAP_MAGIC, sizeof(dump->header.magic)) != 0)
+    {
+        fprintf(stderr, "GCHeapDiff: %s: not a heap dump\n", path);
+        return false;
+    }
+    memcpy(&dump->header, data, sizeof(dump->header));
+    if (dump->header.word_size != sizeof(std::size_t) ||
+        dump->header.byte_order != MZC_GC_HEAP_BYTE_ORDER)
+    {
+        fprintf(stderr, "GCHeapDiff: %s: from a build of another word size "
+                        "or byte order\n", path);
+        return false;
+    }
+
+    std::size_t pos = sizeof(MZC_GC_HEAP_HEADER);
+    const std::size_t count = dump->header.records;
+    if (count > (size - pos) / sizeof(MZC_GC_HEAP_RECORD))
+    {
+        fprintf(stderr, "GCHeapDiff: %s: truncated\n", path);
+        return false;
+    }
+    // The header is a multiple of the word size, and so are the records.
+    dump->records = reinterpret_cast<const MZC_GC_HEAP_RECORD *>(data + pos);
+    pos += count * sizeof(MZC_GC_HEAP_RECORD);
+
+    dump->sites.push_back("(unknown)");
+    for (std::size_t i = 0; i < dump->header.sites; i++)
+    {
+        std::size_t length;
+        if (size - pos < sizeof(length))
+        {
+            fprintf(stderr, "GCHeapDiff: %s: truncated\n", path);
+            return false;
+        }
+        memcpy(&length, data + pos, sizeof(length));
+        pos += sizeof(length);
+        if (size - pos < length)
+        {
+            fprintf(stderr, "GCHeapDiff: %s: truncated\n", path);
+            return false;
+        }
+        dump->sites.push_back(std::string(data + pos, length));
+        pos += length;
+    }
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (dump->records[i].site >= dump->sites.size())
+        {
+            fprintf(stderr, "GCHeapDiff: %s: bad site of record %lu\n", path,
+                    static_cast<unsigned long>(i));
+            return false;
+        }
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// GCHEAPDIFF_TOTAL --- the blocks of a group in the two dumps
+
+struct GCHEAPDIFF_TOTAL
+{
+    std::size_t old_blocks;
+    std::size_t old_bytes;
+    std::size_t new_blocks;
+    std::size_t new_bytes;
+
+    GCHEAPDIFF_TOTAL() : old_blocks(0), old_bytes(0), new_blocks(0), new_bytes(0)
+    {
+    }
+
+    double Growth() const
+    {
+        return double(new_bytes) - double(old_bytes);
+    }
+};
+
+typedef std::map<std::string, GCHEAPDIFF_TOTAL> GCHEAPDIFF_BY_SITE;
+typedef std::map<unsigned, GCHEAPDIFF_TOTAL> GCHEAPDIFF_BY_DEPTH;
+
+// Adds the records of the dump to the old or the new side.
+static void Tally(const GCHEAPDIFF_DUMP *dump, bool is_new,
+                  GCHEAPDIFF_BY_SITE *by_site, GCHEAPDIFF_BY_DEPTH *by_depth)
+{
+    using namespace std;
+    char line[32];
+    for (std::size_t i = 0; i < dump->header.records; i++)
+    {
+        const MZC_GC_HEAP_RECORD *r = &dump->records[i];
+        std::string site = dump->sites[r->site];
+        if (r->line)
+        {
+            sprintf(line, " (%u)", r->line);
+            site += line;
+        }
+
+        GCHEAPDIFF_TOTAL *totals[2] = { &(*by_site)[site], &(*by_depth)[r->depth] };
+        for (int k = 0; k < 2; k++)
+        {
+            if (is_new)
+            {
+                totals[k]->new_blocks++;
+                totals[k]->new_bytes += r->size;
+            }
+            else
+            {
+                totals[k]->old_blocks++;
+                totals[k]->old_bytes += r->size;
+            }
+        }
+    }
+}
+
+// Prints a signed difference of two counts.
+static void PrintDelta(std::size_t old_value, std::size_t new_value)
+{
+    using namespace std;
+    if (new_value >= old_value)
+        printf(" +%lu", static_cast<unsigned long>(new_value - old_value));
+    else
+        printf(" -%lu", static_cast<unsigned long>(old_value - new_value));
+}
+
+static void PrintRow(const GCHEAPDIFF_TOTAL& t, const std::string& name)
+{
+    using namespace std;
+    PrintDelta(t.old_bytes, t.new_bytes);
+    PrintDelta(t.old_blocks, t.new_blocks);
+    printf("  %lu %lu  %s\n", static_cast<unsigned long>(t.new_bytes),
+           static_cast<unsigned long>(t.new_blocks), name.c_str());
+}
+
+// The largest growth first
+template <typename MAP>
+struct GCHEAPDIFF_BY_GROWTH
+{
+    bool operator()(typename MAP::const_iterator a, typename MAP::const_iterator b) const
+    {
+        return a->second.Growth() > b->second.Growth();
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+static void Usage(void)
+{
+    std::fprintf(stderr, "Usage: GCHeapDiff [-n count] old_dump new_dump\n");
+}
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+    std::size_t top = 20;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            top = strtoul(argv[++i], NULL, 10);
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (argc - i != 2)
+    {
+        Usage();
+        return 2;
+    }
+
+    GCHEAPDIFF_DUMP dumps[2];
+    dumps[0].mapping.data = dumps[1].mapping.data = NULL;
+    bool ok = LoadDump(&dumps[0], argv[i]) && LoadDump(&dumps[1], argv[i + 1]);
+    if (ok)
+    {
+        GCHEAPDIFF_BY_SITE by_site;
+        GCHEAPDIFF_BY_DEPTH by_depth;
+        Tally(&dumps[0], false, &by_site, &by_depth);
+        Tally(&dumps[1], true, &by_site, &by_depth);
+
+        printf("old: %lu bytes in %lu blocks\n",
+               static_cast<unsigned long>(dumps[0].header.bytes),
+               static_cast<unsigned long>(dumps[0].header.records));
+        printf("new: %lu bytes in %lu blocks\n",
+               static_cast<unsigned long>(dumps[1].header.bytes),
+               static_cast<unsigned long>(dumps[1].header.records));
+
+        std::vector<GCHEAPDIFF_BY_SITE::const_iterator> sites;
+        for (GCHEAPDIFF_BY_SITE::const_iterator it = by_site.begin();
+             it != by_site.end(); ++it)
+        {
+            if (it->second.Growth() > 0)
+                sites.push_back(it);
+        }
+        std::sort(sites.begin(), sites.end(),
+                  GCHEAPDIFF_BY_GROWTH<GCHEAPDIFF_BY_SITE>());
+        printf("\ngrowth by call site (bytes blocks  new_bytes new_blocks  site):\n");
+        for (std::size_t k = 0; k < sites.size() && k < top; k++)
+            PrintRow(sites[k]->second, sites[k]->first);
+        if (sites.size() > top)
+            printf("  ... %lu more\n", static_cast<unsigned long>(sites.size() - top));
+
+        printf("\ngrowth by depth (bytes blocks  new_bytes new_blocks  depth):\n");
+        char name[32];
+        for (GCHEAPDIFF_BY_DEPTH::const_iterator it = by_depth.begin();
+             it != by_depth.end(); ++it)
+        {
+            sprintf(name, "%u", it->first);
+            PrintRow(it->second, name);
+        }
+    }
+
+    UnmapFile(&dumps[0].mapping);
+    UnmapFile(&dumps[1].mapping);
+    return (ok ? 0 : 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////
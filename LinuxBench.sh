@@ -0,0 +1,14 @@
+#!/bin/sh
+# Builds GCBench.cpp in the single-thread, the multithread and the MZC_NO_GC
+# builds, and runs them with the arguments, e.g. "-s 2 -t 8 malloc-free".
+# Each build compares the allocator of the build ("mzc") with libc.
+set -e
+cd "$(dirname "$0")"
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++03 -O2 -DNDEBUG -Wall -pedantic"}
+$CXX $CXXFLAGS -o GCBench GCBench.cpp GC.cpp -lpthread
+$CXX $CXXFLAGS -DMZC3_GC_MT -o GCBenchMT GCBench.cpp GC.cpp -lpthread
+$CXX $CXXFLAGS -DMZC_NO_GC -o GCBenchNoGC GCBench.cpp GC.cpp -lpthread
+./GCBench "$@"
+./GCBenchMT "$@"
+./GCBenchNoGC "$@"
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Builds the unit test of GC.cpp (UNITTEST) in the single-thread and the
+# multithread builds, with and without MZC3_GC_HEADER and NDEBUG, and runs
+# them.  Each writes two heap dumps, and GCHeapDiff must find the 10 blocks
+# of 1000 bytes allocated between them.
+set -e
+cd "$(dirname "$0")"
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++03 -O2 -Wall -pedantic"}
+$CXX $CXXFLAGS -o GCHeapDiff GCHeapDiff.cpp
+for build in "" "-DMZC3_GC_MT" "-DMZC3_GC_HEADER" "-DMZC3_GC_HEADER -DMZC3_GC_MT"; do
+    for debug in "" "-DNDEBUG"; do
+        $CXX $CXXFLAGS -DUNITTEST $build $debug -o GCTest GC.cpp -lpthread
+        if ! ./GCTest GCTest_old.bin GCTest_new.bin > GCTest.log 2>&1; then
+            cat GCTest.log
+            echo "FAILED: GCTest $build $debug"
+            exit 1
+        fi
+        if ! ./GCHeapDiff GCTest_old.bin GCTest_new.bin |
+             grep -q "^ +10000 +10  10000 10  1$"; then
+            ./GCHeapDiff GCTest_old.bin GCTest_new.bin
+            echo "FAILED: GCHeapDiff $build $debug"
+            exit 1
+        fi
+        echo "OK: GCTest $build $debug"
+    done
+done
+rm -f GCTest GCTest.log GCTest_old.bin GCTest_new.bin GCHeapDiff
@@ -1,30 +1,46 @@
-#ifdef _WIN32
-    #ifndef _INC_WINDOWS
-        #include <windows.h>
-    #endif
-#else
-    #include <sys/types.h>  // gettid
-    #include <pthread.h>
-#endif
-
-#include <map>      // std::map
-
-#include <cstdlib>  // malloc, calloc, realloc, free
-#include <cstdio>   // std::fprintf, std::vfprintf
-#include <cstring>  // std::strcpy, std::memcpy
-#include <cwchar>   // std::wcscpy
-#include <cassert>  // assert
-
-// No GC
-//#define MZC_NO_GC
-
-// Multithread
-//#define MZC3_GC_MT
-
-// Debugging output to stderr
-//#define MZC_DEBUG_OUTPUT_IS_STDERR
-
-// Debugging output to stdout
-//#define MZC_DEBUG_OUTPUT_IS_STDOUT
-
-#include "GC.h"
+#ifdef _WIN32
+    #ifndef _INC_WINDOWS
+        #include <windows.h>
+    #endif
+    #include <malloc.h>     // _msize
+#else
+    #include <pthread.h>
+    #include <signal.h>     // pthread_kill, sigaction
+    #include <sched.h>      // sched_yield
+    #include <sys/mman.h>   // mmap
+    #include <unistd.h>     // sysconf
+    #if defined(__GLIBC__) || defined(__APPLE__)
+        #include <execinfo.h>   // backtrace
+    #endif
+    #ifdef __GLIBC__
+        #include <malloc.h>     // malloc_trim, malloc_usable_size
+    #endif
+#endif
+
+#include <map>      // std::map
+#include <algorithm> // std::partial_sort
+
+#include <cstdlib>  // malloc, calloc, realloc, free
+#include <cstdio>   // std::fprintf, std::vfprintf
+#include <cstdarg>  // va_list, va_start, va_end
+#include <cstring>  // std::strcpy, std::memcpy
+#include <cwchar>   // std::wcscpy
+#include <cassert>  // assert
+#include <csetjmp>  // setjmp
+#include <ctime>    // clock_gettime
+#include <cmath>    // std::log
+#include <cerrno>   // EINVAL, ENOMEM
+
+// No GC
+//#define MZC_NO_GC
+
+// Multithread
+//#define MZC3_GC_MT
+
+// Debugging output to stderr
+//#define MZC_DEBUG_OUTPUT_IS_STDERR
+
+// Debugging output to stdout
+//#define MZC_DEBUG_OUTPUT_IS_STDOUT
+
+#include "GC.h"